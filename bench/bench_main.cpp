@@ -0,0 +1,510 @@
+// bench_main.cpp
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <thread>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "../tests/gen_samples.h"
+#include "../include/k_mismatch_search.h"
+#include "../include/mcs.h"
+#include "../include/verification_kernels.h"
+#include "../include/number_theoretic_transform.h"
+
+// The parallel algorithms run on TBB, whose global control limits the number of worker threads
+#if __has_include(<tbb/global_control.h>)
+#include <tbb/global_control.h>
+#define KMISMATCH_BENCH_THREAD_CONTROL
+#endif
+
+/// Number of heap allocations of the process, counted by the replaced operator new.
+static std::atomic<size_t> allocationsCount = 0;
+
+void* operator new(std::size_t size)
+{
+    allocationsCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    allocationsCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/**
+ * A single benchmark measurement.
+ */
+struct BenchmarkResult
+{
+    std::string name;    ///< Benchmark name, including its parameters.
+    double timeMs;       ///< Median time of a repetition in milliseconds.
+    size_t ops;          ///< Number of operations in a repetition.
+    size_t allocations = 0;  ///< Heap allocations of a repetition.
+};
+
+/// Heap allocations of the last repetition measured by measureMs.
+static size_t lastAllocations = 0;
+
+/**
+ * Benchmark suite configuration, set from the command line.
+ */
+struct BenchmarkConfig
+{
+    std::vector<size_t> textLengths = { 10000, 100000 };
+    std::vector<size_t> alphabetSizes = { 4, 20 };
+    std::vector<size_t> queryLengths = { 12, 24 };
+    std::vector<size_t> misMatches = { 1, 2 };
+    std::vector<size_t> threads = { 1, std::max<size_t>(std::thread::hardware_concurrency(), 1) };
+    size_t queryCount = 100;
+    size_t repeat = 3;
+    bool microOnly = false;
+    bool macroOnly = false;
+    std::string outFile;
+    std::string baselineFile;
+    double threshold = 10.0;
+};
+
+// Accumulates benchmark outputs so the compiler can not drop the measured work
+static volatile size_t sink = 0;
+
+/**
+ * Measures the median wall time of a function over a number of repetitions.
+ * The heap allocations of the last repetition are stored in lastAllocations.
+ *
+ * @param function The function to measure.
+ * @param repeat Number of repetitions.
+ * @param setup Function called before every repetition, not measured.
+ * @return The median time in milliseconds.
+ */
+double measureMs(const std::function<void()>& function, size_t repeat, const std::function<void()>& setup = [] {})
+{
+    std::vector<double> times;
+    for (size_t i = 0; i < std::max<size_t>(repeat, 1); i++)
+    {
+        setup();
+        size_t allocationsStart = allocationsCount.load();
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto end = std::chrono::steady_clock::now();
+        lastAllocations = allocationsCount.load() - allocationsStart;
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+/**
+ * Parses a comma separated list of numbers.
+ *
+ * @param str The list to parse.
+ * @return The parsed numbers.
+ */
+std::vector<size_t> parseList(const std::string& str)
+{
+    std::vector<size_t> values;
+    std::stringstream ss(str);
+    std::string value;
+    while (std::getline(ss, value, ','))
+        values.push_back(std::stoul(value));
+    return values;
+}
+
+void runMicrobenchmarks(const BenchmarkConfig& config, std::vector<BenchmarkResult>& results)
+{
+    const size_t textLen = 1 << 20;
+    const size_t positions = 1 << 16;
+    std::string text = initRandomText(textLen, 4, 0);
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<size_t> posDist(0, textLen - 128);
+
+    // Form key extraction
+    {
+        auto forms = Form::generateAllForms(20, 2);
+        double timeMs = measureMs([&] {
+            size_t total = 0;
+            for (size_t pos = 0; pos < positions; pos++)
+                for (auto& form : forms)
+                    total += form.getStringFromPosition(text, pos).size();
+            sink = sink + total;
+            }, config.repeat);
+        results.push_back({ "form_get_string_from_position/length=20/k=2", timeMs, positions * forms.size(), lastAllocations });
+    }
+
+    // Combination::contains
+    {
+        auto forms = Form::generateAllForms(20, 3);
+        auto combinations = Combination::generateAllCombinations(20, 3);
+        double timeMs = measureMs([&] {
+            size_t total = 0;
+            for (auto& combination : combinations)
+                for (auto& form : forms)
+                    total += combination.contains(form);
+            sink = sink + total;
+            }, config.repeat);
+        results.push_back({ "combination_contains/length=20/k=3", timeMs, combinations.size() * forms.size(), lastAllocations });
+    }
+
+    // CheckQueryOnPosition
+    for (size_t queryLen : { 10, 32, 100 })
+    {
+        KMismatchSearch kMismatchSearch;
+        kMismatchSearch.setText(text);
+        std::string query = text.substr(posDist(gen), queryLen);
+        std::vector<size_t> checkPositions(positions);
+        for (auto& pos : checkPositions)
+            pos = posDist(gen);
+        double timeMs = measureMs([&] {
+            size_t total = 0;
+            for (size_t pos : checkPositions)
+                total += kMismatchSearch.CheckQueryOnPosition(query, pos, 2);
+            sink = sink + total;
+            }, config.repeat);
+        results.push_back({ "check_query_on_position/m=" + std::to_string(queryLen) + "/k=2", timeMs, positions, lastAllocations });
+    }
+
+    // Verification kernels, specialized for the common read lengths and generic otherwise
+    for (size_t queryLen : { 20, 32, 50, 100 })
+    {
+        std::string query = text.substr(posDist(gen), queryLen);
+        std::vector<size_t> checkPositions(positions);
+        for (auto& pos : checkPositions)
+            pos = std::min<size_t>(posDist(gen), textLen - queryLen);
+        for (bool specialized : { false, true })
+        {
+            VerificationKernel kernel = specialized ? selectVerificationKernel(queryLen, 2) : verifyGeneric;
+            double timeMs = measureMs([&] {
+                size_t total = 0;
+                for (size_t pos : checkPositions)
+                    total += kernel(text.data() + pos, query.data(), queryLen, 2);
+                sink = sink + total;
+                }, config.repeat);
+            results.push_back({ std::string(specialized ? "kernel_specialized" : "kernel_generic") + "/m="
+                + std::to_string(queryLen) + "/k=2", timeMs, positions, lastAllocations });
+        }
+    }
+
+    // Number theoretic transforms of the FFT search, forward and inverse
+    for (size_t transformSize : { 1 << 12, 1 << 16 })
+    {
+        NumberTheoreticTransform transform(transformSize);
+        std::vector<uint32_t> values(transformSize);
+        for (size_t i = 0; i < transformSize; i++)
+            values[i] = text[i] == 'A';
+        double timeMs = measureMs([&] {
+            transform.forward(values.data());
+            transform.inverse(values.data());
+            sink = sink + values[0];
+            }, config.repeat);
+        results.push_back({ "ntt_round_trip/size=" + std::to_string(transformSize), timeMs, transformSize, lastAllocations });
+    }
+
+    // Forms and combinations generation
+    for (auto [length, k] : std::vector<std::pair<size_t, size_t>>{ { 24, 4 }, { 32, 4 } })
+    {
+        std::string params = "/length=" + std::to_string(length) + "/k=" + std::to_string(k);
+        size_t formsNumber = 0;
+        size_t combinationsNumber = 0;
+        double timeMs = measureMs([&] { formsNumber = Form::generateAllForms(length, k).size(); }, config.repeat);
+        results.push_back({ "generate_all_forms" + params, timeMs, formsNumber, lastAllocations });
+        timeMs = measureMs([&] { combinationsNumber = Combination::generateAllCombinations(length, k).size(); }, config.repeat);
+        results.push_back({ "generate_all_combinations" + params, timeMs, combinationsNumber, lastAllocations });
+        timeMs = measureMs([&] {
+            size_t total = 0;
+            for (Combination combination : CombinationRange(length, k))
+                total += combination.getSize();
+            sink = sink + total;
+            }, config.repeat);
+        results.push_back({ "combination_range_iterate" + params, timeMs, combinationsNumber, lastAllocations });
+        timeMs = measureMs([&] { sink = sink + MCS::buildMCSNaiveMultithreaded(length, k).getMcsForms().size(); }, config.repeat);
+        results.push_back({ "mcs_build" + params, timeMs, combinationsNumber, lastAllocations });
+    }
+}
+
+void runMacrobenchmarks(const BenchmarkConfig& config, std::vector<BenchmarkResult>& results)
+{
+    for (size_t threads : config.threads)
+    {
+#ifdef KMISMATCH_BENCH_THREAD_CONTROL
+        tbb::global_control threadControl(tbb::global_control::max_allowed_parallelism, threads);
+#endif
+        for (size_t textLen : config.textLengths)
+            for (size_t alphabetSize : config.alphabetSizes)
+                for (size_t queryLen : config.queryLengths)
+                    for (size_t misMatches : config.misMatches)
+                    {
+                        std::string params = "/n=" + std::to_string(textLen) + "/sigma=" + std::to_string(alphabetSize)
+                            + "/m=" + std::to_string(queryLen) + "/k=" + std::to_string(misMatches)
+                            + "/threads=" + std::to_string(threads);
+                        std::string text = initRandomText(textLen, alphabetSize, 0);
+                        std::vector<std::string> queries = initRandomQueries(text, config.queryCount, queryLen);
+                        std::vector<std::string> noQueries;
+                        std::map<std::string, std::set<size_t>> emptyCache;
+
+                        MCS mcs;
+                        double timeMs = measureMs([&] { mcs = MCS::buildMCSNaiveMultithreaded(queryLen, misMatches); }, config.repeat);
+                        results.push_back({ "mcs_build" + params, timeMs, 1, lastAllocations });
+
+                        // Without queries the MCS search only builds the index
+                        KMismatchSearch kMismatchSearch;
+                        kMismatchSearch.setText(text);
+                        kMismatchSearch.setQueries(noQueries);
+                        kMismatchSearch.setMcs(mcs, misMatches);
+                        timeMs = measureMs([&] { kMismatchSearch.mcsSearch(misMatches); }, config.repeat,
+                            [&] { kMismatchSearch.setCache(emptyCache); });
+                        results.push_back({ "index_build" + params, timeMs, textLen, lastAllocations });
+
+                        kMismatchSearch.setQueries(queries);
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.mcsSearch(misMatches).size(); }, config.repeat);
+                        results.push_back({ "mcs_search" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.mcsSearch(misMatches, ResultMode::Exists).size(); }, config.repeat);
+                        results.push_back({ "mcs_search_exists" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.mcsSearch(misMatches, ResultMode::Count).size(); }, config.repeat);
+                        results.push_back({ "mcs_search_count" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.naiveSearch(misMatches).size(); }, config.repeat);
+                        results.push_back({ "naive_search" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.fftSearch(misMatches).size(); }, config.repeat);
+                        results.push_back({ "fft_search" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { kMismatchSearch.buildFmIndex(); }, config.repeat);
+                        results.push_back({ "fm_index_build" + params, timeMs, textLen, lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.fmSearch(misMatches).size(); }, config.repeat);
+                        results.push_back({ "fm_search" + params, timeMs, queries.size(), lastAllocations });
+
+                        timeMs = measureMs([&] { sink = sink + kMismatchSearch.seedSearch(misMatches).size(); }, config.repeat);
+                        results.push_back({ "seed_search" + params, timeMs, queries.size(), lastAllocations });
+
+                        std::cerr << "Finished" << params << std::endl;
+                    }
+    }
+}
+
+/**
+ * Writes the results as JSON, one benchmark per line.
+ *
+ * @param results The benchmark results.
+ * @param os The output stream.
+ */
+void writeJson(const std::vector<BenchmarkResult>& results, std::ostream& os)
+{
+    os << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto& result = results[i];
+        double nsPerOp = result.ops ? result.timeMs * 1e6 / result.ops : 0.0;
+        os << "    {\"name\": \"" << result.name << "\", \"time_ms\": " << result.timeMs
+            << ", \"ops\": " << result.ops << ", \"ns_per_op\": " << nsPerOp
+            << ", \"allocations\": " << result.allocations << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+/**
+ * Loads the times of a baseline written by writeJson.
+ *
+ * @param fileName The baseline file.
+ * @return The time in milliseconds of every benchmark name.
+ */
+std::map<std::string, double> loadBaseline(const std::string& fileName)
+{
+    std::ifstream file(fileName);
+    if (!file)
+        throw std::runtime_error("Unable to open baseline file: " + fileName);
+
+    std::map<std::string, double> baseline;
+    const std::string nameKey = "\"name\": \"";
+    const std::string timeKey = "\"time_ms\": ";
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t namePos = line.find(nameKey);
+        size_t timePos = line.find(timeKey);
+        if (namePos == std::string::npos || timePos == std::string::npos)
+            continue;
+        namePos += nameKey.size();
+        std::string name = line.substr(namePos, line.find('"', namePos) - namePos);
+        baseline[name] = std::stod(line.substr(timePos + timeKey.size()));
+    }
+    return baseline;
+}
+
+/**
+ * Compares the results with a baseline and reports the benchmarks slower than the threshold.
+ *
+ * @param results The benchmark results.
+ * @param baseline The baseline times.
+ * @param threshold Allowed slowdown in percent.
+ * @return The number of regressions.
+ */
+size_t compareWithBaseline(const std::vector<BenchmarkResult>& results, const std::map<std::string, double>& baseline, double threshold)
+{
+    size_t regressions = 0;
+    for (const auto& result : results)
+    {
+        auto base = baseline.find(result.name);
+        if (base == baseline.end() || base->second <= 0.0)
+            continue;
+        double change = (result.timeMs - base->second) / base->second * 100.0;
+        if (change > threshold)
+        {
+            regressions++;
+            std::cerr << "REGRESSION " << result.name << ": " << base->second << " ms -> "
+                << result.timeMs << " ms (+" << change << "%)" << std::endl;
+        }
+    }
+    std::cerr << regressions << " regression(s) over " << threshold << "% against the baseline" << std::endl;
+    return regressions;
+}
+
+void helpMsg(const std::string& programName)
+{
+    std::cout << "Usage: " << programName << " [options]\n\n"
+        << "Options:\n"
+        << "  --out <file>              Write the JSON results to a file instead of stdout.\n"
+        << "  --baseline <file>         Compare with a saved JSON result and flag regressions.\n"
+        << "  --threshold <percent>     Slowdown reported as a regression (default 10).\n"
+        << "  --repeat <number>         Repetitions per benchmark, the median is reported (default 3).\n"
+        << "  --text-lengths <list>     Comma separated text lengths (default 10000,100000).\n"
+        << "  --alphabets <list>        Comma separated alphabet sizes (default 4,20).\n"
+        << "  --query-lengths <list>    Comma separated query lengths (default 12,24).\n"
+        << "  --mismatches <list>       Comma separated mismatch numbers (default 1,2).\n"
+        << "  --threads <list>          Comma separated thread counts (default 1,<hardware threads>).\n"
+        << "  --queries <number>        Number of queries of the macrobenchmarks (default 100).\n"
+        << "  --micro                   Run the microbenchmarks only.\n"
+        << "  --macro                   Run the macrobenchmarks only.\n"
+        << "  -h, --help                Display this help message.\n";
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkConfig config;
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--out" && hasValue)
+                config.outFile = argv[++i];
+            else if (arg == "--baseline" && hasValue)
+                config.baselineFile = argv[++i];
+            else if (arg == "--threshold" && hasValue)
+                config.threshold = std::stod(argv[++i]);
+            else if (arg == "--repeat" && hasValue)
+                config.repeat = std::stoul(argv[++i]);
+            else if (arg == "--text-lengths" && hasValue)
+                config.textLengths = parseList(argv[++i]);
+            else if (arg == "--alphabets" && hasValue)
+                config.alphabetSizes = parseList(argv[++i]);
+            else if (arg == "--query-lengths" && hasValue)
+                config.queryLengths = parseList(argv[++i]);
+            else if (arg == "--mismatches" && hasValue)
+                config.misMatches = parseList(argv[++i]);
+            else if (arg == "--threads" && hasValue)
+                config.threads = parseList(argv[++i]);
+            else if (arg == "--queries" && hasValue)
+                config.queryCount = std::stoul(argv[++i]);
+            else if (arg == "--micro")
+                config.microOnly = true;
+            else if (arg == "--macro")
+                config.macroOnly = true;
+            else if (arg == "-h" || arg == "--help")
+            {
+                helpMsg(argv[0]);
+                return 0;
+            }
+            else
+            {
+                std::cerr << "Unknown option or missing argument for: " << arg << "\n";
+                helpMsg(argv[0]);
+                return 1;
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Thread counts collapse when the machine has a single hardware thread
+    std::sort(config.threads.begin(), config.threads.end());
+    config.threads.erase(std::unique(config.threads.begin(), config.threads.end()), config.threads.end());
+
+    std::vector<BenchmarkResult> results;
+    if (!config.macroOnly)
+        runMicrobenchmarks(config, results);
+    if (!config.microOnly)
+        runMacrobenchmarks(config, results);
+
+    if (config.outFile.empty())
+        writeJson(results, std::cout);
+    else
+    {
+        std::ofstream outFile(config.outFile);
+        writeJson(results, outFile);
+    }
+
+    if (!config.baselineFile.empty())
+    {
+        try
+        {
+            if (compareWithBaseline(results, loadBaseline(config.baselineFile), config.threshold))
+                return 2;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// The AhoCorasick class finds all occurrences of a set of patterns in one pass over a text.
+// The automaton is a complete transition table over the symbols of the patterns, every other byte
+// sharing one code that leads back to the root, so the scan does one table lookup per text symbol.
+// Patterns ending at a state are reached through dictionary links, which skip the states without output.
+//
+class AhoCorasick
+{
+public:
+    /// Creates an automaton without patterns.
+    AhoCorasick() = default;
+
+    /**
+     * Builds the automaton of a set of patterns.
+     *
+     * @param patterns The patterns, non-empty; the index of a pattern is its id in the matches.
+     */
+    explicit AhoCorasick(const std::vector<std::string>& patterns);
+
+    /// Returns the number of states, the root included.
+    size_t getStates() const;
+
+    /// Returns the length of the longest pattern.
+    size_t getLongestPattern() const;
+
+    /// Returns the memory of the automaton.
+    size_t memoryBytes() const;
+
+    /**
+     * Returns the memory of the automaton of patterns, without building it.
+     *
+     * @param patternSymbols Total length of the patterns, a bound on the number of states.
+     * @param symbols Number of distinct symbols of the patterns.
+     * @return The memory of the automaton.
+     */
+    static size_t estimateBytes(size_t patternSymbols, size_t symbols);
+
+    /**
+     * Reports the occurrences of the patterns in a text range.
+     *
+     * @param begin The beginning of the range.
+     * @param end The end of the range.
+     * @param onMatch Called with the pattern id and the offset from begin past the end of every occurrence.
+     */
+    template <typename OnMatch>
+    void scan(const char* begin, const char* end, OnMatch&& onMatch) const
+    {
+        if (this->transitions.empty())
+            return;
+        uint32_t state = 0;
+        for (const char* symbol = begin; symbol != end; ++symbol)
+        {
+            state = this->transitions[state * this->symbols + this->codes[static_cast<unsigned char>(*symbol)]];
+            uint32_t output = this->outputBegin[state] != this->outputBegin[state + 1] ? state : this->outputLinks[state];
+            while (output)
+            {
+                for (uint32_t i = this->outputBegin[output]; i < this->outputBegin[output + 1]; i++)
+                    onMatch(this->outputs[i], static_cast<size_t>(symbol - begin) + 1);
+                output = this->outputLinks[output];
+            }
+        }
+    }
+
+private:
+    uint8_t codes[256] = {};  ///< Code of every byte, 0 for the bytes absent from the patterns.
+    size_t symbols = 0;  ///< Number of codes, including the code 0 of the other bytes.
+    size_t longestPattern = 0;  ///< Length of the longest pattern.
+    std::vector<uint32_t> transitions;  ///< Next state of every state and code.
+    std::vector<uint32_t> outputLinks;  ///< Longest proper suffix state with output of every state, 0 if none.
+    std::vector<uint32_t> outputBegin;  ///< Offset of the patterns ending at every state in outputs, one past the states.
+    std::vector<uint32_t> outputs;  ///< Ids of the patterns ending at every state.
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <compare>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Position of a match in a document of a corpus.
+struct DocumentPosition
+{
+    size_t document = 0;  ///< Index of the document in the corpus.
+    size_t offset = 0;  ///< Offset of the match in the document.
+
+    auto operator<=>(const DocumentPosition&) const = default;
+};
+
+//
+// The Corpus class holds a collection of documents, such as the chromosomes or contigs of a genome or a set of
+// files, as one text. The documents are concatenated without separators and delimited by their start positions,
+// so a search over the corpus text can skip the windows crossing two documents and map a text position back
+// to its document and offset.
+//
+class Corpus
+{
+public:
+    /// Creates a corpus without documents.
+    Corpus() = default;
+
+    /**
+     * Loads a corpus with a document per file, named by its path. The files are read in parallel.
+     *
+     * @param fileNames Paths to the files, in the order of the documents.
+     * @return The corpus.
+     */
+    static Corpus loadFromFiles(const std::vector<std::string>& fileNames);
+
+    /**
+     * Loads a corpus with a document per FASTA record, named by the first word of its header line, the lines of
+     * a record being joined without their line breaks. The files are read and parsed in parallel.
+     *
+     * @param fileNames Paths to the FASTA files, their records following each other in the order of the files.
+     * @return The corpus.
+     */
+    static Corpus loadFromFasta(const std::vector<std::string>& fileNames);
+
+    /**
+     * Appends a document.
+     *
+     * @param name Name of the document.
+     * @param documentText Text of the document.
+     */
+    void addDocument(const std::string& name, const std::string& documentText);
+
+    /// Returns the number of documents.
+    size_t size() const;
+
+    /// Returns the name of every document.
+    const std::vector<std::string>& getNames() const;
+
+    /// Returns the concatenated text of the documents.
+    const std::string& getText() const;
+
+    /// Returns the start of every document in the text.
+    const std::vector<size_t>& getStarts() const;
+
+    /**
+     * Returns the document of a text position and the offset in it.
+     *
+     * @param position A position of the text.
+     * @return The document and the offset.
+     */
+    DocumentPosition locate(size_t position) const;
+
+    /**
+     * Returns the document of a text position and the offset in it.
+     *
+     * @param starts The start of every document, see getStarts.
+     * @param position A position of the text.
+     * @return The document and the offset, document 0 if there is no start.
+     */
+    static DocumentPosition locate(const std::vector<size_t>& starts, size_t position);
+
+    /**
+     * Returns whether a window of the text lies within one document.
+     *
+     * @param starts The start of every document, see getStarts; no start is a single document.
+     * @param position Start of the window.
+     * @param length Length of the window.
+     * @return False if the window crosses the start of a document.
+     */
+    static bool withinDocument(const std::vector<size_t>& starts, size_t position, size_t length);
+
+private:
+    std::vector<std::string> names;  ///< The name of every document.
+    std::vector<size_t> starts;  ///< The start of every document in text.
+    std::string text;  ///< The documents one after the other.
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include "type_defs.h"
+
+//
+// The FmIndex class is a compressed full-text index of the search text: the Burrows-Wheeler transform stored as
+// one bit vector per symbol with rank counts every 64 rows, the symbol counts C, and a sampled suffix array.
+// Queries are searched with backward search, backtracking over substitutions while a lower bound on the
+// mismatches of the remaining query prefix allows, and every occurrence is located through the samples.
+//
+// The index lives in a single buffer laid out exactly like its file, so a saved index is memory mapped on load
+// and shared by the processes that search the same reference, without parsing.
+//
+class FmIndex
+{
+public:
+    static constexpr size_t DEFAULT_SAMPLE_RATE = 32;  ///< Text positions per suffix array sample.
+
+    FmIndex(const FmIndex&) = delete;
+    FmIndex& operator=(const FmIndex&) = delete;
+
+    /// Unmaps the index file, if the index was loaded.
+    ~FmIndex();
+
+    /**
+     * Builds the index of a text. The suffix array is sorted by prefix doubling with parallel sorts,
+     * and the rank structures are filled over blocks of rows in parallel.
+     *
+     * @param text The text to index, of less than 2^32 - 1 symbols.
+     * @param sampleRate Text positions per suffix array sample, trading locate time for memory.
+     * @return The index.
+     */
+    static std::shared_ptr<const FmIndex> build(const std::string& text, size_t sampleRate = DEFAULT_SAMPLE_RATE);
+
+    /**
+     * Loads an index saved by save, memory mapping the file where the platform allows.
+     *
+     * @param fileName The index file.
+     * @return The index.
+     */
+    static std::shared_ptr<const FmIndex> load(const std::string& fileName);
+
+    /**
+     * Saves the index to a file.
+     *
+     * @param fileName The index file.
+     */
+    void save(const std::string& fileName) const;
+
+    /// Returns a hash of a text, stored in the index to detect a file built for another text.
+    static uint64_t hashText(const std::string& text);
+
+    /// Returns the size of the indexed text.
+    size_t getTextSize() const;
+
+    /// Returns the hash of the indexed text, see hashText.
+    uint64_t getTextHash() const;
+
+    /// Returns the memory of the index, which is also the size of its file.
+    size_t memoryBytes() const;
+
+    /**
+     * Returns the memory of the index of a text, without building it.
+     *
+     * @param textSize Size of the text.
+     * @param symbols Number of distinct symbols of the text.
+     * @param sampleRate Text positions per suffix array sample.
+     * @return The memory of the index.
+     */
+    static size_t estimateBytes(size_t textSize, size_t symbols, size_t sampleRate = DEFAULT_SAMPLE_RATE);
+
+    /**
+     * Returns the peak memory of the index build besides the text and the index, see build.
+     *
+     * @param textSize Size of the text.
+     * @return The memory of the suffix sorting buffers.
+     */
+    static size_t estimateBuildBytes(size_t textSize);
+
+    /**
+     * Finds the text positions where a query occurs with at most a number of mismatches.
+     *
+     * @param query The query.
+     * @param misMatches Maximum number of mismatches allowed.
+     * @param positions The positions, appended in no particular order.
+     * @param resource The memory resource of the search temporaries, usually a task arena.
+     * @return The number of backward search steps, a measure of the search work.
+     */
+    size_t search(const std::string& query, size_t misMatches, std::pmr::vector<size_t>& positions,
+        std::pmr::memory_resource* resource) const;
+
+private:
+    FmIndex() = default;
+
+    /// Fixed fields at the beginning of the index buffer and file.
+    struct Header
+    {
+        char magic[8];  ///< File signature, see MAGIC.
+        uint64_t version;  ///< Version of the layout.
+        uint64_t textSize;  ///< Size of the indexed text.
+        uint64_t textHash;  ///< Hash of the indexed text.
+        uint64_t symbols;  ///< Number of symbol codes, including the end of text code 0.
+        uint64_t sampleRate;  ///< Text positions per suffix array sample.
+        uint64_t samples;  ///< Number of suffix array samples.
+        uint8_t codes[256];  ///< Code of every byte, NO_CODE for bytes absent from the text.
+    };
+
+    /// Sets the section pointers of a buffer holding a header.
+    void bindSections(const uint64_t* buffer, size_t words);
+
+    /// Returns the number of 64-bit words of the index of a text.
+    static size_t layoutWords(size_t textSize, size_t symbols, size_t samples);
+
+    /// Returns the occurrences of a code in the first rows of the transform.
+    size_t rank(size_t code, size_t row) const
+    {
+        size_t block = (row >> 6) * symbols + code;
+        uint64_t below = (static_cast<uint64_t>(1) << (row & 63)) - 1;
+        return rankCounts[block] + popcount(rankBits[block] & below);
+    }
+
+    /// Returns the code of the transform at a row.
+    size_t codeAt(size_t row) const;
+
+    /// Returns the text position of the suffix of a row, walking back to a sampled row.
+    size_t locate(size_t row) const;
+
+    static constexpr char MAGIC[8] = { 'K', 'M', 'F', 'M', 'I', 'D', 'X', '\0' };  ///< File signature.
+    static constexpr uint64_t VERSION = 1;  ///< Version of the layout.
+    static constexpr uint8_t NO_CODE = 0xFF;  ///< Code of the bytes absent from the text.
+
+    std::vector<uint64_t> storage;  ///< The buffer of a built index.
+    void* mapping = nullptr;  ///< The mapped file of a loaded index.
+    size_t mappingBytes = 0;  ///< Size of the mapped file.
+
+    const Header* header = nullptr;  ///< Fixed fields.
+    size_t rows = 0;  ///< Rows of the transform, the text size plus the end of text.
+    size_t symbols = 0;  ///< Number of symbol codes, including the end of text code 0.
+    const uint64_t* cumulative = nullptr;  ///< C: rows whose suffix starts with a smaller code, per code.
+    const uint32_t* rankCounts = nullptr;  ///< Occurrences of every code before every block of 64 rows.
+    const uint64_t* rankBits = nullptr;  ///< Bit vector of every code within every block of 64 rows.
+    const uint32_t* sampledCounts = nullptr;  ///< Sampled rows before every block of 64 rows.
+    const uint64_t* sampledBits = nullptr;  ///< Bit vector of the sampled rows within every block.
+    const uint64_t* samples = nullptr;  ///< Text positions of the sampled rows, in row order.
+    size_t words = 0;  ///< Size of the buffer in 64-bit words.
+};
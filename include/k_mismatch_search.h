@@ -11,9 +11,65 @@
 #include <unordered_map>
 #include <immintrin.h>
 #include "type_defs.h"
+#include "verification_kernels.h"
+#include "fm_index.h"
+#include "aho_corasick.h"
+#include "posting_index.h"
+#include "corpus.h"
 #include <iostream>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <functional>
+#include <chrono>
 
 
+/// Strand of a match of a nucleotide query.
+enum class Strand : uint8_t
+{
+    Forward,  ///< The query occurs in the text.
+    Reverse   ///< The reverse complement of the query occurs in the text.
+};
+
+/// What a search reports for every query.
+enum class ResultMode : uint8_t
+{
+    All,     ///< Every position.
+    Exists,  ///< Whether the query occurs, its search stopping at the first occurrence.
+    Count,   ///< The number of positions, counted without storing them.
+    First,   ///< The first positions found, up to a limit, the search stopping at the limit.
+    Best     ///< The positions with the fewest mismatches, up to a limit.
+};
+
+/// The result of a query in a ResultMode other than All.
+struct QueryResult
+{
+    size_t count = 0;  ///< Number of positions: 1 with Exists, all of them with Count, the hits otherwise.
+    std::vector<std::pair<size_t, size_t>> hits;  ///< (position, mismatches) pairs with First, by position, and Best, by mismatches.
+};
+
+/// How far the search of a query went under the limits of the search, see SearchLimits.
+enum class QueryStatus : uint8_t
+{
+    NotStarted,  ///< The limits were reached before the query was searched, it has no positions.
+    Truncated,   ///< The limits were reached during the search of the query, its positions are a subset.
+    Complete     ///< The query was fully searched.
+};
+
+/// Bounds of a search, checked cooperatively by the search tasks, see KMismatchSearch::setSearchLimits.
+struct SearchLimits
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();  ///< Time at which the search stops.
+    const std::atomic<bool>* cancelled = nullptr;  ///< Flag set by the caller to stop the search, none if null.
+    size_t candidateBudget = 0;  ///< Most candidates verified per query by the MCS search, 0 for no budget.
+
+    /// Returns true if the search is cancelled or past its deadline.
+    bool reached() const
+    {
+        return (cancelled && cancelled->load(std::memory_order_relaxed)) || std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
 //
 // KMismatchSearch class performs k-mismatch search operations on text strings.
 // This class can be constructed using text and query files, and it allows for searches with specified mismatch thresholds.
@@ -22,11 +78,15 @@
 class KMismatchSearch
 {
 public:
+    /// Marks an MCS that was loaded or set without the number of mismatches it covers.
+    static constexpr size_t UNKNOWN_MISMATCHES = std::numeric_limits<size_t>::max();
+
     /// Default constructor that initializes empty text, queries, MCS, and cache.
     KMismatchSearch();
 
     /**
      * Constructor to initialize the search with text and queries from files, and a number of mismatches for building MCS.
+     * An MCS is built for every query length bucket, see buildLengthBucketsMcs.
      * @param textFile Path to the text file to search in.
      * @param queriesFile Path to the file containing query strings.
      * @param misMatches Number of allowed mismatches during the search.
@@ -56,23 +116,99 @@ public:
     /// Returns the current text used for the search.
     const std::string& getText() const;
 
+    /**
+     * Sets the text of the search to the documents of a corpus. The index leaves out the windows crossing two
+     * documents and every search reports the positions within one document only, see locate.
+     * @param corpus The corpus to search in.
+     */
+    void setCorpus(const Corpus& corpus);
+
+    /// Returns the start of every document of the text, empty if the text was not set from a corpus.
+    const std::vector<size_t>& getDocumentStarts() const;
+
+    /**
+     * Returns the document of a result position and the offset in it.
+     * @param position A position of the text.
+     * @return The document and the offset, document 0 if the text was not set from a corpus.
+     */
+    DocumentPosition locate(size_t position) const;
+
     /// Sets the query strings for the search.
     void setQueries(std::vector<std::string>& queriesToSet);
 
     /// Returns the current query strings used for the search.
     const std::vector<std::string>& getQueries() const;
 
-    /// Sets the MCS (multiple common subsequence) object for the search.
-    void setMcs(MCS& mcsToSet);
+    /**
+     * Sets the MCS (multiple common subsequence) object for the search, dropping the index of the previous one.
+     * @param mcsToSet The MCS to search with.
+     * @param builtForMismatches Mismatches the MCS covers, when known, searches with fewer mismatches use a subset of its forms.
+     */
+    void setMcs(MCS& mcsToSet, size_t builtForMismatches = UNKNOWN_MISMATCHES);
 
     /// Returns the current MCS object used for the search.
     const MCS& getMcs() const;
 
-    /// Sets the cache for the search.
+    /**
+     * Builds an MCS for every query length bucket, taking the forms from a shared pool so that
+     * the index tables are reused across buckets. The MCS of the search holds the whole pool.
+     * @param misMatches Number of allowed mismatches during the search.
+     */
+    void buildLengthBucketsMcs(size_t misMatches);
+
+    /**
+     * Builds a selectivity-aware MCS for every query length bucket, see MCS::buildMCSSelectivityAware, from
+     * statistics of a sample of the text. The MCS of the search holds the forms of all the buckets.
+     * @param misMatches Number of allowed mismatches during the search.
+     * @param textSampleSize Size of the text sample, see getTextSample.
+     */
+    void buildSelectivityAwareLengthBucketsMcs(size_t misMatches, size_t textSampleSize);
+
+    /**
+     * Shrinks the MCS with MCS::optimize while every query keeps its cover. Each length bucket is optimized for
+     * its own length within an equal share of the time limit, and a single MCS for the shortest query length,
+     * whose cover also covers the longer queries.
+     * @param misMatches Number of allowed mismatches during the search.
+     * @param timeLimit Maximal time to spend on the optimization.
+     */
+    void optimizeMcs(size_t misMatches, std::chrono::milliseconds timeLimit);
+
+    /// Returns the MCS of every query length bucket, empty when a single MCS is used for all queries.
+    const std::map<size_t, MCS>& getLengthMcs() const;
+
+    /// Sets the cache for the search, the keys and positions of the MCS forms, converted to the index of the forms.
     void setCache(std::map<std::string, std::set<size_t>>& cacheToSet);
 
-    /// Returns the current cache used for the search.
-    const std::map<std::string, std::set<size_t>>& getCache() const;
+    /// Returns the current cache used for the search, the keys and positions of the index.
+    std::map<std::string, std::set<size_t>> getCache() const;
+
+    /// Returns the index of the MCS forms over the text, empty until a search builds it.
+    const PostingIndex& getIndex() const;
+
+    /**
+     * Sets the wildcard symbols, which match any symbol in the text and in the queries, see Wildcards.
+     * They are supported by the naive search and the MCS search of one strand; the index does not depend on them.
+     * @param symbols The wildcard symbols, none to compare every symbol.
+     */
+    void setWildcards(const std::string& symbols);
+
+    /// Returns the wildcard symbols of the search.
+    const Wildcards& getWildcards() const;
+
+    /**
+     * Sets the limits of the MCS and naive searches. When they are reached, a search returns the positions found so far
+     * and the status of every query, see getLastQueryStatuses. The MCS search stops a query at its candidate budget
+     * without stopping the others. The deadline and the cancellation flag are checked every LIMITS_CHECK_INTERVAL
+     * candidates, the index being built before.
+     * @param limits The limits, none by default.
+     */
+    void setSearchLimits(const SearchLimits& limits);
+
+    /// Returns the limits of the searches.
+    const SearchLimits& getSearchLimits() const;
+
+    /// Returns the status of every query in the last MCS or naive search, in the order of the queries.
+    const std::vector<QueryStatus>& getLastQueryStatuses() const;
 
     /// Loads the text from a file.
     std::string loadTextFromFile(std::string& filename) const;
@@ -89,15 +225,199 @@ public:
     /// Performs an MCS-based search with a specified mismatch threshold.
     std::map<std::string, std::set<size_t>> mcsSearch(size_t misMatches);
 
+    /**
+     * Performs an MCS-based search with a mismatch threshold per query.
+     * The index is built once for the mismatches the MCS covers, and every smaller threshold is searched
+     * with the subset of the MCS forms that still covers its combinations.
+     * @param misMatchesPerQuery The mismatch threshold of every query, in the order of the queries.
+     */
+    std::map<std::string, std::set<size_t>> mcsSearch(const std::vector<size_t>& misMatchesPerQuery);
+
+    /**
+     * Performs an MCS-based search that reports a summary of every query, see ResultMode.
+     * The candidates of a query are dropped as soon as its answer is determined: at the first occurrence with Exists,
+     * at the limit with First, and with Best the mismatch threshold drops to the worst kept hit once the limit is
+     * reached, the search stopping when all kept hits are exact. Candidates found again through another window are
+     * skipped without storing the positions, by checking that no earlier window of the query finds them.
+     * @param misMatchesPerQuery The mismatch threshold of every query, in the order of the queries.
+     * @param mode The result mode, not All.
+     * @param limit The number of hits with First and Best, ties of Best keeping the hits found first.
+     * @return The result of every query with some position.
+     */
+    std::map<std::string, QueryResult> mcsSearch(const std::vector<size_t>& misMatchesPerQuery, ResultMode mode, size_t limit = 0);
+
+    /// Performs an MCS-based search that reports a summary of every query with a specified mismatch threshold.
+    std::map<std::string, QueryResult> mcsSearch(size_t misMatches, ResultMode mode, size_t limit = 0);
+
+    /// Performs an MCS-based search of both strands of nucleotide queries with a specified mismatch threshold.
+    std::map<std::string, std::set<std::pair<size_t, Strand>>> mcsSearchBothStrands(size_t misMatches);
+
+    /**
+     * Performs an MCS-based search of both strands of nucleotide queries, with a mismatch threshold per query.
+     * The keys of a query window and of its mirrored window in the reverse complement are extracted in one pass,
+     * see Form::fillStrandKeysFromPosition, and the reverse complement is verified from the query itself,
+     * so the second strand costs its lookups and candidates only.
+     * @param misMatchesPerQuery The mismatch threshold of every query, in the order of the queries.
+     * @return The positions of every query, tagged with the strand matching there.
+     */
+    std::map<std::string, std::set<std::pair<size_t, Strand>>> mcsSearchBothStrands(const std::vector<size_t>& misMatchesPerQuery);
+
     /// Performs a naive search with a specified mismatch threshold.
     std::map<std::string, std::set<size_t>> naiveSearch(size_t misMatches);
 
-private:
+    /// Performs a naive search with a mismatch threshold per query, in the order of the queries.
+    std::map<std::string, std::set<size_t>> naiveSearch(const std::vector<size_t>& misMatchesPerQuery);
+
+    /**
+     * Splits a query into consecutive segments of balanced lengths.
+     * @param queryLength Length of the query.
+     * @param segments Number of segments.
+     * @return The (offset, length) pairs of the segments.
+     */
+    static std::vector<std::pair<size_t, size_t>> splitQuery(size_t queryLength, size_t segments);
+
+    /**
+     * Computes the MCS used by the segment search. With at least k + 1 segments, every occurrence with
+     * k mismatches has a segment without mismatches, so a single contiguous form as long as the shortest
+     * query segment, capped to a short length, covers all combinations.
+     * @param queries The queries to search.
+     * @param misMatches Number of allowed mismatches for the whole query.
+     * @param segments Number of segments per query, raised to at least misMatches + 1.
+     * @return The segment MCS.
+     */
+    static MCS segmentMcs(const std::vector<std::string>& queries, size_t misMatches, size_t segments);
+
+    /**
+     * Sets the segment MCS of the queries as the MCS of the search, see segmentMcs.
+     * @param misMatches Number of allowed mismatches for the whole query.
+     * @param segments Number of segments per query, raised to at least misMatches + 1.
+     */
+    void buildSegmentMcs(size_t misMatches, size_t segments);
+
+    /**
+     * Performs a search for long queries by splitting every query into segments.
+     * Each segment is looked up in the index with the segment MCS, and the candidates are
+     * extended to the full query and verified, so the cost depends on the segment length.
+     * @param misMatches Number of allowed mismatches for the whole query.
+     * @param segments Number of segments per query, raised to at least misMatches + 1.
+     * @throws std::runtime_error if the MCS has no contiguous form fitting in the shortest segment.
+     */
+    std::map<std::string, std::set<size_t>> segmentSearch(size_t misMatches, size_t segments);
+
+    /**
+     * Returns the transform size of the text blocks of the FFT search: a power of two of several times the
+     * longest query, so that most alignments of a block are complete, and no larger than the text needs.
+     * @param longestQuery Length of the longest query.
+     * @param textSize Size of the text.
+     * @return The block size, at least the longest query.
+     */
+    static size_t fftBlockSize(size_t longestQuery, size_t textSize);
+
+    /**
+     * Performs a search that counts the matches of every query at every text position with convolutions.
+     * For every symbol of the queries, the symbol indicator of a text block is correlated with the one of the
+     * query through a number theoretic transform, and the sum over the symbols is the number of matches of every
+     * alignment. The cost is O(sigma * n log m) per query for sigma query symbols, independent of the mismatch
+     * threshold, and text blocks are processed in parallel.
+     * @param misMatches Number of allowed mismatches.
+     */
+    std::map<std::string, std::set<size_t>> fftSearch(size_t misMatches);
+
+    /// Performs an FFT search with a mismatch threshold per query, in the order of the queries.
+    std::map<std::string, std::set<size_t>> fftSearch(const std::vector<size_t>& misMatchesPerQuery);
+
+    /// Builds the FM-index of the text, see FmIndex::build.
+    void buildFmIndex();
+
+    /**
+     * Loads a saved FM-index, which must have been built for the text of the search.
+     * @param fileName The index file.
+     */
+    void loadFmIndex(const std::string& fileName);
+
+    /**
+     * Saves the FM-index of the text, building it first if needed.
+     * @param fileName The index file.
+     */
+    void saveFmIndex(const std::string& fileName);
+
+    /// Returns the FM-index of the text, null until it is built or loaded.
+    std::shared_ptr<const FmIndex> getFmIndex() const;
+
+    /**
+     * Performs a search with the FM-index of the text, building it first if needed.
+     * Every query is matched backwards with backtracking over substitutions, pruned by a lower bound on the
+     * mismatches of the unmatched query prefix, so no candidate is verified against the text.
+     * @param misMatches Number of allowed mismatches.
+     */
+    std::map<std::string, std::set<size_t>> fmSearch(size_t misMatches);
+
+    /// Performs an FM-index search with a mismatch threshold per query, in the order of the queries.
+    std::map<std::string, std::set<size_t>> fmSearch(const std::vector<size_t>& misMatchesPerQuery);
+
+    /**
+     * Performs a search that needs no text index. A query with k mismatches is split into k + 1 pieces,
+     * one of which occurs exactly in every match, so the pieces of all queries are matched in one pass over
+     * the text with an Aho-Corasick automaton, and the implied query positions are verified.
+     * Text chunks are scanned in parallel. Queries shorter than k + 1 are verified at every position.
+     * @param misMatches Number of allowed mismatches.
+     */
+    std::map<std::string, std::set<size_t>> seedSearch(size_t misMatches);
+
+    /// Performs a seed search with a mismatch threshold per query, in the order of the queries.
+    std::map<std::string, std::set<size_t>> seedSearch(const std::vector<size_t>& misMatchesPerQuery);
+
     /// Checks if a query matches the text at a given position with the allowed number of mismatches.
     bool CheckQueryOnPosition(const std::string& query, int64_t position, size_t misMatches) const;
 
+    /// Returns a sample of the text made of evenly spaced blocks, of at most sampleSize characters.
+    std::string getTextSample(size_t sampleSize) const;
+
+    /// Returns the number of candidate positions verified by the last MCS-based search.
+    size_t getLastCandidatesCount() const;
+
+private:
+    /// Builds the index of the MCS forms over the text, if it is not built or loaded yet.
+    void buildIndex();
+
+    /// Receives the forward and reverse strand positions of a query with ResultMode::All, or its result otherwise,
+    /// under the result lock.
+    using QueryHitsHandler = std::function<void(size_t queryIndex, const std::pmr::vector<size_t>& forward,
+        const std::pmr::vector<size_t>& reverse, QueryResult& result)>;
+
+    /**
+     * Runs the MCS-based search of the queries, see mcsSearch.
+     * @param misMatchesPerQuery The mismatch threshold of every query, in the order of the queries.
+     * @param bothStrands Whether the reverse complement of every query is searched too, with ResultMode::All only.
+     * @param mode The result mode.
+     * @param limit The number of hits with First and Best.
+     * @param onHits Called with the positions or the result of every query that has some.
+     */
+    void mcsSearchQueries(const std::vector<size_t>& misMatchesPerQuery, bool bothStrands, ResultMode mode, size_t limit,
+        const QueryHitsHandler& onHits);
+
+    /// Checks a query at a position with a kernel picked by selectVerificationKernel for the query.
+    bool verifyOnPosition(VerificationKernel kernel, const std::string& query, int64_t position, size_t misMatches) const;
+
     std::string text;  ///< The text to search in.
+    std::vector<size_t> documentStarts;  ///< The start of every document of the text, empty for a single document.
     std::vector<std::string> queries;  ///< The query strings for the search.
-    std::map<std::string, std::set<size_t>> cache;  ///< The cache storing previous search results.
+    PostingIndex index;  ///< The index of the MCS forms over the text.
     MCS mcs;  ///< The MCS object used in the search.
+    std::map<size_t, MCS> lengthMcs;  ///< The MCS of every query length bucket, built from the forms of mcs.
+    size_t mcsMismatches = UNKNOWN_MISMATCHES;  ///< The number of mismatches the MCS covers.
+    size_t lastCandidatesCount = 0;  ///< The number of candidates verified by the last MCS-based search.
+    std::shared_ptr<const FmIndex> fmIndex;  ///< The FM-index of the text, shared with the searches using it.
+    Wildcards wildcards;  ///< The symbols matching any symbol, in the text and in the queries.
+    SearchLimits searchLimits;  ///< The limits of the MCS and naive searches.
+    std::vector<QueryStatus> lastQueryStatuses;  ///< The status of every query in the last MCS or naive search.
+
+    static constexpr size_t MAX_SEGMENT_MCS_LENGTH = 32;  ///< Maximal length of the MCS built for the segment search.
+    static constexpr size_t MIN_FFT_BLOCK_SIZE = 1 << 12;  ///< Smallest text block of the FFT search, for texts that need it.
+    static constexpr size_t FFT_BLOCK_QUERY_RATIO = 4;  ///< Minimal ratio of the FFT text block to the longest query.
+    static constexpr size_t SEED_CHUNK_SIZE = 1 << 16;  ///< Text symbols scanned by a task of the seed search.
+    static constexpr size_t PROBE_BATCH_QUERIES = 32;  ///< Most queries of a length bucket whose index probes are grouped by key.
+    static constexpr size_t PROBE_PREFETCH_DISTANCE = 4;  ///< Probe groups ahead of the verified one whose first postings are prefetched.
+    static constexpr size_t LIMITS_CHECK_INTERVAL = 1024;  ///< Candidates or text positions between checks of the search limits.
+    static constexpr size_t MAX_WILDCARD_EXPANSIONS = 256;  ///< Most keys a query window is expanded to before its query is scanned.
 };
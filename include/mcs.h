@@ -10,6 +10,12 @@
 #include <iostream>
 #include <functional>
 #include <fstream>
+#include <numeric>
+#include <unordered_map>
+#include <chrono>
+#include <memory_resource>
+#include <bit>
+#include <iterator>
 
 //
 // The Form class represents a sequence of binary values (ones and zeros).
@@ -44,6 +50,45 @@ public:
      */
     std::string getStringFromPosition(const std::string& str, size_t pos) const;
 
+    /**
+     * Extracts a substring from a given position in the original string, allocated from a memory resource.
+     *
+     * @param str The original string.
+     * @param pos The starting position in the string.
+     * @param resource The memory resource of the returned string, usually a task arena.
+     * @return A string extracted from the original text based on the form's pattern.
+     */
+    std::pmr::string getStringFromPosition(const std::string& str, size_t pos, std::pmr::memory_resource* resource) const;
+
+    /**
+     * Extracts the keys of a position of a nucleotide string and of its reverse complement in one pass.
+     * The key of the reverse complement at the mirrored position, pos' = str.size() - pos - getSize(),
+     * reads the same window of the string backwards, complemented.
+     *
+     * @param str The original string.
+     * @param pos The starting position in the string.
+     * @param key Buffer of the form's size, filled with '_', that receives the key at pos.
+     * @param reverseComplementKey Buffer of the form's size, filled with '_', that receives the key of the
+     * reverse complement of the string at pos'.
+     */
+    void fillStrandKeysFromPosition(const std::string& str, size_t pos, char* key, char* reverseComplementKey) const;
+
+    /// Returns true if the form samples a position of its window, the position being below the form's size.
+    bool samples(size_t i) const;
+
+    /// Returns the number of positions the form samples, the size of its keys without the unsampled positions.
+    size_t getWeight() const;
+
+    /**
+     * Writes the form's pattern at a position of the original string into a buffer of the form's size,
+     * leaving the positions the form does not sample untouched.
+     *
+     * @param str The original string.
+     * @param pos The starting position in the string.
+     * @param result Buffer of the form's size, usually filled with '_'.
+     */
+    void fillStringFromPosition(const std::string& str, size_t pos, char* result) const;
+
     friend class Combination;
 };
 
@@ -76,6 +121,16 @@ public:
      */
     std::set<Form> getAllForms(uint64_t matches) const;
 
+    /**
+     * Generates all forms within the combination that have a specified number of matches,
+     * allocating the set from a memory resource.
+     *
+     * @param matches Number of matching ones in the form.
+     * @param resource The memory resource of the returned set, usually a task arena.
+     * @return A set of Form objects representing all matching forms.
+     */
+    std::pmr::set<Form> getAllForms(uint64_t matches, std::pmr::memory_resource* resource) const;
+
     /**
      * Generates all combinations with a given length and mismatch threshold.
      *
@@ -84,6 +139,142 @@ public:
      * @return A vector of Combination objects representing all generated combinations.
      */
     static std::vector<Combination> generateAllCombinations(uint64_t length, uint64_t mismatchK);
+
+    friend class CombinationRange;
+};
+
+//
+// The CombinationRange class enumerates the combinations of a length and a mismatch threshold without storing them.
+// Combinations are numbered by rank, the colexicographic rank of their mismatch positions, which is also the
+// order of generateAllCombinations. A range can be split into rank intervals for parallel workers, and its
+// iterators step from a combination to the next one with Gosper's next bit permutation.
+//
+class CombinationRange
+{
+public:
+    //
+    // Forward iterator over the combinations of a range, yielding combinations by value.
+    //
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using iterator_concept = std::forward_iterator_tag;
+        using value_type = Combination;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() = default;
+
+        /**
+         * Constructs an iterator at a combination.
+         *
+         * @param mismatches Bits of the mismatch positions of the combination.
+         * @param lengthMask Mask with a bit set for every position of the combination length.
+         * @param rank Rank of the combination.
+         */
+        Iterator(kMismatchIntegerType::uint_type mismatches, kMismatchIntegerType::uint_type lengthMask, uint64_t rank)
+            : mismatches(mismatches), lengthMask(lengthMask), rank(rank) {}
+
+        Combination operator*() const { return Combination(lengthMask & ~mismatches); }
+
+        Iterator& operator++()
+        {
+            if (mismatches)
+                mismatches = nextBitPermutation(mismatches);
+            rank++;
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const Iterator& other) const { return rank == other.rank; }
+
+        /// Returns the rank of the current combination.
+        uint64_t getRank() const { return rank; }
+
+        /// Returns the next integer with the same number of set bits (Gosper's hack).
+        static kMismatchIntegerType::uint_type nextBitPermutation(kMismatchIntegerType::uint_type bits)
+        {
+            kMismatchIntegerType::uint_type lowerOnes = bits | (bits - 1);
+            return (lowerOnes + 1) | (((~lowerOnes & (lowerOnes + 1)) - 1) >> (std::countr_zero(bits) + 1));
+        }
+
+    private:
+        kMismatchIntegerType::uint_type mismatches = 0;  ///< Bits of the mismatch positions.
+        kMismatchIntegerType::uint_type lengthMask = 0;  ///< Bits of all positions of the combination length.
+        uint64_t rank = 0;  ///< Rank of the current combination.
+    };
+
+    /**
+     * Constructs the range of all combinations with a given length and mismatch threshold.
+     *
+     * @param length Length of the combinations.
+     * @param mismatchK Number of mismatches of the combinations.
+     */
+    CombinationRange(uint64_t length, uint64_t mismatchK);
+
+    /// Returns the number of combinations in the range.
+    uint64_t size() const;
+
+    /// Returns true if the range has no combinations.
+    bool empty() const;
+
+    /// Returns the rank of the first combination of the range.
+    uint64_t getFirst() const;
+
+    /// Returns an iterator to the first combination of the range.
+    Iterator begin() const;
+
+    /// Returns an iterator past the last combination of the range.
+    Iterator end() const;
+
+    /**
+     * Returns the combination of a rank.
+     *
+     * @param rank Rank of the combination, among all combinations of the length and mismatch threshold.
+     * @return The combination.
+     */
+    Combination unrank(uint64_t rank) const;
+
+    /**
+     * Returns the rank of a combination.
+     *
+     * @param combination A combination of the length and mismatch threshold of the range.
+     * @return Rank of the combination among all combinations of the length and mismatch threshold.
+     */
+    uint64_t rank(const Combination& combination) const;
+
+    /**
+     * Returns the combinations of a rank interval.
+     *
+     * @param first Rank of the first combination.
+     * @param last Rank past the last combination, clamped to the range.
+     * @return The range of the combinations with first <= rank < last.
+     */
+    CombinationRange subrange(uint64_t first, uint64_t last) const;
+
+    /**
+     * Splits the range into consecutive rank intervals of nearly equal sizes.
+     *
+     * @param parts Number of intervals.
+     * @return The non-empty intervals, in rank order.
+     */
+    std::vector<CombinationRange> split(size_t parts) const;
+
+private:
+    /// Returns the bits of the mismatch positions of the combination of a rank.
+    kMismatchIntegerType::uint_type unrankMismatches(uint64_t rank) const;
+
+    uint64_t length;  ///< Length of the combinations.
+    uint64_t mismatchK;  ///< Number of mismatches of the combinations.
+    uint64_t first;  ///< Rank of the first combination of the range.
+    uint64_t last;  ///< Rank past the last combination of the range.
+    kMismatchIntegerType::uint_type lengthMask;  ///< Bits of all positions of the combination length.
 };
 
 //
@@ -96,6 +287,12 @@ public:
     /// Default constructor initializes an empty MCS.
     MCS();
 
+    /**
+     * Constructor that initializes the MCS with given forms.
+     * @param forms The forms of the MCS.
+     */
+    explicit MCS(const std::vector<Form>& forms);
+
     /**
      * Returns the forms contained in the MCS.
      *
@@ -112,6 +309,98 @@ public:
      */
     static MCS buildMCSNaiveMultithreaded(std::vector<std::string>& queries, uint64_t mismatchK);
 
+    /**
+     * Builds an MCS using a naive multithreaded approach for a given query length and mismatch threshold.
+     *
+     * @param length Length of the queries the MCS is built for.
+     * @param mismatchK Maximum number of mismatches allowed.
+     * @return An MCS object covering all combinations of the given length.
+     */
+    static MCS buildMCSNaiveMultithreaded(uint64_t length, uint64_t mismatchK);
+
+    /**
+     * Builds an MCS for a given query length that reuses forms of a shared pool where possible,
+     * so that MCSs of several query lengths share their index tables.
+     * Forms added to cover the remaining combinations are appended to the pool.
+     *
+     * @param length Length of the queries the MCS is built for.
+     * @param mismatchK Maximum number of mismatches allowed.
+     * @param pool The shared forms pool.
+     * @return An MCS object covering all combinations of the given length.
+     */
+    static MCS buildMCSFromPool(uint64_t length, uint64_t mismatchK, std::vector<Form>& pool);
+
+    /**
+     * Builds an MCS that covers all combinations while minimizing the expected verification work on the text.
+     * Every form is weighted by the number of candidates it is expected to produce per query, estimated
+     * from the key frequency histogram of the form over a text sample.
+     *
+     * @param queries A vector of query strings.
+     * @param mismatchK Maximum number of mismatches allowed.
+     * @param textSample A sample of the text the MCS will be used on.
+     * @param textSize Size of the full text, used to scale the sample statistics.
+     * @return An MCS object built from the queries and the text statistics.
+     */
+    static MCS buildMCSSelectivityAware(std::vector<std::string>& queries, uint64_t mismatchK,
+        const std::string& textSample, size_t textSize);
+
+    /**
+     * Estimates the expected number of text positions returned by a single index lookup of each form.
+     * The estimate is textSize * sum(p(key)^2), where p is the key distribution of the form on the sample.
+     *
+     * @param forms The forms to estimate.
+     * @param textSample A sample of the text.
+     * @param textSize Size of the full text, used to scale the sample statistics.
+     * @return A vector with the expected candidates per lookup, in the order of the given forms.
+     */
+    static std::vector<double> estimateCandidatesPerLookup(const std::vector<Form>& forms,
+        const std::string& textSample, size_t textSize);
+
+    /**
+     * Predicts the number of candidates a query of the given length produces with the forms of this MCS.
+     *
+     * @param queryLength Length of the query.
+     * @param textSample A sample of the text.
+     * @param textSize Size of the full text, used to scale the sample statistics.
+     * @return The expected number of candidates per query.
+     */
+    double predictCandidatesPerQuery(size_t queryLength, const std::string& textSample, size_t textSize) const;
+
+    /**
+     * Returns the subset of the MCS forms needed to cover the combinations of a smaller mismatch threshold.
+     * An MCS covering k mismatches covers every smaller threshold, as every combination with fewer
+     * mismatches contains a combination with k mismatches. If the forms fitting in the length do not
+     * cover all combinations, all of them are returned.
+     *
+     * @param length Length of the queries.
+     * @param mismatchK The mismatch threshold of the queries.
+     * @return An MCS with the subset of the forms.
+     */
+    MCS subsetForMismatches(uint64_t length, uint64_t mismatchK) const;
+
+    /**
+     * Removes forms whose combinations are all covered by the other forms of the MCS.
+     * Forms added last are tried first, as greedy construction adds the least useful forms at the end.
+     *
+     * @param length Length of the combinations the MCS has to cover.
+     * @param mismatchK Maximum number of mismatches allowed.
+     */
+    void removeRedundantForms(uint64_t length, uint64_t mismatchK);
+
+    /**
+     * Shrinks the number of forms of an MCS while keeping all combinations covered.
+     * Redundant forms are removed, then pairs of forms are replaced by a single form (local search),
+     * and for small instances an exact branch and bound set cover solver looks for a smaller cover.
+     * The search stops when the time limit is reached and the best cover found so far is returned.
+     *
+     * @param mcs The MCS to optimize, usually the result of a greedy construction.
+     * @param length Length of the combinations the MCS has to cover.
+     * @param mismatchK Maximum number of mismatches allowed.
+     * @param timeLimit Maximal time to spend on the optimization.
+     * @return An MCS with at most as many forms as the given one.
+     */
+    static MCS optimize(const MCS& mcs, uint64_t length, uint64_t mismatchK, std::chrono::milliseconds timeLimit);
+
     /**
      * Loads an MCS from a file.
      *
@@ -128,5 +417,19 @@ public:
     const void saveToFile(std::string fileName) const;
 
 private:
+    /**
+     * Greedily adds to the MCS forms the form covering the most remaining combinations per unit of cost, until
+     * all combinations are covered or none of the forms covers a remaining combination.
+     *
+     * @param combinations The combinations to cover.
+     * @param uncovered Bitset of the ranks of the combinations still to cover, covered combinations are cleared.
+     * @param forms The candidate forms.
+     * @param mcsForms The forms of the MCS the chosen forms are added to.
+     * @param formCosts Cost of every candidate form, all forms costing 1.0 when empty.
+     * @return Number of combinations left uncovered.
+     */
+    static uint64_t coverGreedily(const CombinationRange& combinations, std::vector<uint64_t>& uncovered,
+        const std::vector<Form>& forms, std::vector<Form>& mcsForms, const std::vector<double>& formCosts = {});
+
     std::vector<Form> mcsForms;  ///< The forms contained in the MCS.
 };
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// The NumberTheoreticTransform class computes exact cyclic convolutions of small integer sequences with a fast
+// Fourier transform over the integers modulo the prime 998244353 = 119 * 2^23 + 1, so sums of products stay
+// exact as long as they are smaller than the modulus. The forward transform leaves its output in bit-reversed
+// order and the inverse transform takes its input in that order, so convolutions need no reordering pass.
+// The twiddle factors of a size are computed once, at construction.
+//
+class NumberTheoreticTransform
+{
+public:
+    static constexpr uint32_t MODULUS = 998244353;  ///< Prime modulus with 2^23 roots of unity.
+    static constexpr size_t MAX_SIZE = static_cast<size_t>(1) << 23;  ///< Largest transform size.
+
+    /**
+     * Plans transforms of a size.
+     *
+     * @param size Number of values of the transforms, a power of two of at most MAX_SIZE.
+     */
+    explicit NumberTheoreticTransform(size_t size);
+
+    /// Returns the number of values of the transforms.
+    size_t getSize() const;
+
+    /**
+     * Transforms values in place, from natural to bit-reversed order.
+     *
+     * @param values The values to transform, smaller than MODULUS.
+     */
+    void forward(uint32_t* values) const;
+
+    /**
+     * Inverts a forward transform in place, from bit-reversed to natural order, including the scaling by 1 / size.
+     *
+     * @param values The transformed values.
+     */
+    void inverse(uint32_t* values) const;
+
+    /**
+     * Adds the pointwise products of two transforms to an accumulator, all modulo MODULUS.
+     *
+     * @param accumulator The transform the products are added to.
+     * @param a The first transform.
+     * @param b The second transform.
+     */
+    void multiplyAccumulate(uint32_t* accumulator, const uint32_t* a, const uint32_t* b) const;
+
+private:
+    size_t size;  ///< Number of values of the transforms.
+    uint32_t inverseSize;  ///< Inverse of the size modulo MODULUS.
+    std::vector<uint32_t> roots;  ///< Twiddle factors, the h powers of the 2h-th root of unity at index h.
+    std::vector<uint32_t> rootQuotients;  ///< Shoup quotients floor(w * 2^32 / MODULUS) of the twiddle factors.
+    std::vector<uint32_t> inverseRoots;  ///< Twiddle factors of the inverse transform, laid out like roots.
+    std::vector<uint32_t> inverseRootQuotients;  ///< Shoup quotients of the inverse twiddle factors.
+};
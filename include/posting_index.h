@@ -0,0 +1,178 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "mcs.h"
+
+//
+// The PostingIndex class stores the text positions of every key of a set of forms. The keys of a form are packed
+// into integers over the codes of the indexed symbols, and the (key, position) pairs are radix sorted in parallel
+// into one posting array per form, so positions are grouped by key and ascending within a key.
+// When the key space of a form is small, a lookup is a direct-address offset table indexed by the packed key;
+// otherwise it is a binary search over the sorted distinct keys. Keys too wide to pack are sorted by comparison.
+//
+class PostingIndex
+{
+public:
+    static constexpr size_t DIRECT_ADDRESS_MAX_KEYS = static_cast<size_t>(1) << 16;  ///< Largest key space of an offset table.
+    static constexpr size_t RADIX_BITS = 8;  ///< Key bits sorted by every radix sort pass.
+
+    //
+    // The postings of one form.
+    //
+    class Table
+    {
+    public:
+        /// Returns the indexed form.
+        const Form& getForm() const;
+
+        /// Returns the number of distinct keys.
+        size_t getKeys() const;
+
+        /// Returns the number of positions.
+        size_t getPostings() const;
+
+        /// Returns whether the lookups are direct-address.
+        bool isDirect() const;
+
+        /**
+         * Returns the positions of a key.
+         *
+         * @param key The key, of the form's size, as written by Form::fillStringFromPosition; the positions the form
+         * does not sample are ignored.
+         * @return The ascending positions of the key, empty if the key is absent.
+         */
+        std::span<const size_t> find(std::string_view key) const;
+
+        /**
+         * Calls a function with every key and its positions, in key order.
+         *
+         * @param onKey Called with the key, of the form's size with '_' on the positions the form does not sample,
+         * and its ascending positions.
+         */
+        template <typename OnKey>
+        void forEach(OnKey&& onKey) const
+        {
+            std::string key(form.getSize(), '_');
+            for (size_t group = 0; group + 1 < starts.size(); group++)
+                if (starts[group] != starts[group + 1])
+                {
+                    writeKey(group, key.data());
+                    onKey(std::as_const(key), std::span<const size_t>(positions.data() + starts[group], starts[group + 1] - starts[group]));
+                }
+        }
+
+    private:
+        friend class PostingIndex;
+
+        explicit Table(const Form& form);
+
+        /// Writes the sampled symbols of the key of a group into a buffer of the form's size.
+        void writeKey(size_t group, char* key) const;
+
+        /// Returns the packed key of a key of the form's size, false if a symbol has no code.
+        bool packKey(const char* key, uint64_t& packedKey) const;
+
+        Form form;  ///< The indexed form.
+        std::vector<uint32_t> offsets;  ///< Window offsets the form samples.
+        std::array<uint8_t, 256> codes{};  ///< Code of every byte, NO_CODE for the bytes absent from the keys.
+        std::string alphabet;  ///< Symbol of every code.
+        bool packed = false;  ///< Whether the keys are packed into 64-bit integers, base the alphabet size.
+        bool direct = false;  ///< Whether starts is indexed by the packed key.
+        size_t keys = 0;  ///< Number of distinct keys.
+        std::vector<size_t> starts;  ///< Offset of every group of positions in positions, one past the groups.
+        std::vector<uint64_t> packedKeys;  ///< Packed key of every group, when the keys are packed but not direct.
+        std::string wideKeys;  ///< Sampled symbols of every group one after the other, when the keys are not packed.
+        std::vector<size_t> positions;  ///< Positions of all the keys, grouped by key.
+    };
+
+    /// Creates an empty index.
+    PostingIndex() = default;
+
+    /**
+     * Builds the index of the windows of a text.
+     *
+     * @param text The indexed text.
+     * @param forms The indexed forms.
+     * @param documentStarts The start of every document of the text, whose windows crossing two documents are
+     * left out; empty for a single document.
+     * @return The index.
+     */
+    static PostingIndex build(const std::string& text, const std::vector<Form>& forms,
+        const std::vector<size_t>& documentStarts = {});
+
+    /**
+     * Builds the index of keys and their positions, such as a saved index.
+     *
+     * @param keys The positions of every key, a key having '_' on the positions its form does not sample.
+     * @param forms The indexed forms, every key belonging to one of them.
+     * @return The index.
+     */
+    static PostingIndex fromMap(const std::map<std::string, std::set<size_t>>& keys, const std::vector<Form>& forms);
+
+    /// Returns the positions of every key, in the layout of fromMap.
+    std::map<std::string, std::set<size_t>> toMap() const;
+
+    /// Returns true if the index has no form.
+    bool empty() const;
+
+    /**
+     * Returns the table of a form.
+     *
+     * @param form The form.
+     * @return The table, or nullptr if the form is not indexed.
+     */
+    const Table* findTable(const Form& form) const;
+
+    /// Returns the number of distinct keys of all the forms.
+    size_t getKeys() const;
+
+    /// Returns the number of positions of all the forms.
+    size_t getPostings() const;
+
+    /// Returns the memory of the tables.
+    size_t memoryBytes() const;
+
+    /**
+     * Returns the memory of a table, without building it.
+     *
+     * @param windows Positions of the form.
+     * @param keys Expected distinct keys of the form.
+     * @param keySpace Number of possible keys of the form.
+     * @param weight Number of positions the form samples.
+     * @return The memory of the table.
+     */
+    static double estimateTableBytes(double windows, double keys, double keySpace, size_t weight);
+
+private:
+    /**
+     * Sorts the windows of a form by key and groups them into a table.
+     *
+     * @param table The table, with its form and alphabet.
+     * @param windows The number of windows.
+     * @param windowPosition Returns the position of a window, the positions of equal keys ascending with the window.
+     * @param windowKey Returns the symbols of a window, of the form's size.
+     */
+    template <typename WindowPosition, typename WindowKey>
+    static void fillTable(Table& table, size_t windows, WindowPosition&& windowPosition, WindowKey&& windowKey);
+
+    /**
+     * Sorts positions by packed keys, least significant digit first, keeping the order of equal keys.
+     *
+     * @param keys The packed keys, sorted in place.
+     * @param positions The positions of the keys, permuted with them.
+     * @param bits Number of significant bits of the keys.
+     */
+    static void radixSort(std::vector<uint64_t>& keys, std::vector<size_t>& positions, size_t bits);
+
+    static constexpr uint8_t NO_CODE = 0xFF;  ///< Code of the bytes absent from the indexed keys.
+
+    std::vector<Table> tables;  ///< A table per form.
+};
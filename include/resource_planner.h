@@ -0,0 +1,142 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "k_mismatch_search.h"
+
+//
+// Resource estimates of a search run with one engine.
+//
+struct EnginePlan
+{
+    std::string engine;  ///< Name of the engine (mcs, segment, naive, fft, fm, seed).
+    bool available = true;  ///< Whether the engine can run on the queries.
+    std::string note;  ///< Reason the engine is unavailable, or a remark on the estimate.
+    size_t forms = 0;  ///< Forms indexed over the text.
+    double indexKeys = 0.0;  ///< Expected distinct keys of the index.
+    double indexPostings = 0.0;  ///< Text positions stored in the index.
+    double indexBytes = 0.0;  ///< Expected memory of the index.
+    double peakBytes = 0.0;  ///< Expected peak resident memory of the run, excluding the results.
+    double candidatesPerQuery = 0.0;  ///< Expected verified candidates per query.
+    double seconds = 0.0;  ///< Approximate time of the index build and the search.
+    double buildSeconds = 0.0;  ///< Part of the time shared by all the queries: index build, or text scan.
+};
+
+//
+// Engine picked for the queries of one length by the automatic engine selection.
+//
+struct QueryGroupPlan
+{
+    size_t queryLength = 0;  ///< Length of the queries of the group.
+    std::vector<size_t> queryIndices;  ///< Indices of the queries of the group.
+    std::string engine;  ///< The engine searching the group.
+    double seconds = 0.0;  ///< Approximate time of the group with the engine, without the shared part.
+};
+
+//
+// Engines of a run picked by the automatic engine selection, see ResourcePlanner::selectEngines.
+//
+struct EngineSelection
+{
+    std::vector<QueryGroupPlan> groups;  ///< The engine of every query group, by query length.
+    std::map<std::string, double> engineSeconds;  ///< Approximate time of every picked engine, its shared part included.
+    std::vector<EnginePlan> plans;  ///< The plans of the considered engines over all the queries.
+};
+
+//
+// The ResourcePlanner class predicts the memory and time of a search run before the index is built.
+// It estimates the index from the text size and the key distribution of every form on a text sample,
+// and the time from costs per index posting, lookup and verification measured on the sample.
+//
+class ResourcePlanner
+{
+public:
+    /**
+     * Samples the text and calibrates the cost model.
+     *
+     * @param search The search to plan, with its text, queries and the MCS of the mcs engine.
+     * @param misMatches Number of allowed mismatches.
+     * @param segments Number of segments per query of the segment engine.
+     * @param sampleSize Maximal size of the text sample.
+     */
+    ResourcePlanner(const KMismatchSearch& search, size_t misMatches, size_t segments, size_t sampleSize = 1 << 20);
+
+    /**
+     * Estimates the resources of a run with an engine.
+     *
+     * @param engine Name of the engine: mcs, segment, naive, fft, fm or seed.
+     * @return The estimates of the engine.
+     */
+    EnginePlan planEngine(const std::string& engine) const;
+
+    /**
+     * Estimates the resources of a run with an engine over some of the queries.
+     *
+     * @param engine Name of the engine: mcs, segment, naive, fft, fm or seed.
+     * @param queries The queries, with the MCS of the search for the mcs engine.
+     * @return The estimates of the engine.
+     */
+    EnginePlan planEngine(const std::string& engine, const std::vector<std::string>& queries) const;
+
+    /**
+     * Picks the engine of every query length group that minimizes the estimated time of the run. The shared part
+     * of an engine, such as its index build, is counted once for all the groups it searches, so every subset of
+     * the engines is tried with every group taking its fastest engine in the subset.
+     *
+     * @param engines The engines to choose from, among mcs, naive, fft, fm and seed.
+     * @param memCapBytes Engines expected to use more memory are left out, 0 for no cap.
+     * @return The selection, without groups if no engine is available within the cap.
+     */
+    EngineSelection selectEngines(const std::vector<std::string>& engines, size_t memCapBytes) const;
+
+    /// Estimates the resources of every engine.
+    std::vector<EnginePlan> planAll() const;
+
+    /**
+     * Formats plans as a table.
+     *
+     * @param plans The plans to format.
+     * @param memCapBytes Runs expected to use more memory are marked, 0 for no cap.
+     * @return The table, a line per engine.
+     */
+    std::string formatPlans(const std::vector<EnginePlan>& plans, size_t memCapBytes) const;
+
+private:
+    /**
+     * Estimates the index of a set of forms over the full text.
+     * Distinct keys of a form are extrapolated from the sample, assuming the keys are drawn from a
+     * key space that yields the observed number of distinct keys on the sample.
+     *
+     * @param forms The indexed forms.
+     * @param plan The plan the index estimates are written to.
+     */
+    void estimateIndex(const std::vector<Form>& forms, EnginePlan& plan) const;
+
+    /// Measures the costs per index posting, lookup and verification on the sample.
+    void calibrate();
+
+    /// Memory of the text, the queries and the positions vector of the parallel loops.
+    double baseBytes() const;
+
+    const KMismatchSearch& search;  ///< The planned search.
+    size_t misMatches;  ///< Number of allowed mismatches.
+    size_t segments;  ///< Number of segments per query of the segment engine.
+    std::string sample;  ///< The text sample.
+    size_t threads;  ///< Number of hardware threads.
+    double nsPerPosting = 0.0;  ///< Index build time per posting (wall time).
+    double nsPerLookup = 0.0;  ///< Time of an index lookup on one thread.
+    double nsPerVerification = 0.0;  ///< Time of a candidate verification from the index postings on one thread.
+    double nsPerScanVerification = 0.0;  ///< Time of a verification on consecutive text positions on one thread.
+    double nsPerButterfly = 0.0;  ///< Time of a transform of the FFT search per value and level on one thread.
+    double nsPerProduct = 0.0;  ///< Time of a pointwise product of transforms per value on one thread.
+    double nsPerFmSymbol = 0.0;  ///< FM-index build time per text symbol (wall time).
+    double nsPerFmStep = 0.0;  ///< Time of a backward search step of the FM-index search on one thread.
+    double fmStepsPerQuery = 0.0;  ///< Backward search steps per query on the calibration text.
+    double nsPerSeedSymbol = 0.0;  ///< Time of the Aho-Corasick scan of the seed search per text symbol on one thread.
+    double nsPerSeedCandidate = 0.0;  ///< Time of the collection and verification of a seed candidate on one thread.
+
+    static constexpr size_t SSO_CAPACITY = 15;  ///< Longest string stored inside the string object.
+    static constexpr size_t CALIBRATION_SIZE = 1 << 16;  ///< Maximal text size used for calibration.
+    static constexpr size_t CALIBRATION_TRANSFORM_SIZE = 1 << 14;  ///< Transform size used for calibration.
+    static constexpr size_t MAX_SELECTED_ENGINES = 8;  ///< Most engines the automatic selection chooses from.
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+//
+// The ScratchArena class gives a task of a parallel loop a monotonic allocator for its temporaries.
+// Every thread owns a monotonic buffer on top of an unsynchronized pool, both kept for the life of the thread.
+// Allocations of a task only bump a pointer, and when the outermost arena of the thread goes out of scope the
+// buffer is released into the pool, so tasks in steady state neither call malloc nor contend on its locks.
+// Arenas may nest on a thread, e.g. when a nested parallel loop runs inner tasks on a waiting thread,
+// in which case the memory is released by the outermost one.
+//
+class ScratchArena
+{
+public:
+    /// Enters the arena of the calling thread.
+    ScratchArena();
+
+    /// Leaves the arena, releasing its memory if it is the outermost arena of the thread.
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    /// Returns the memory resource to allocate the task temporaries from.
+    std::pmr::memory_resource* resource() const;
+
+private:
+    /// The buffers owned by one thread.
+    struct ThreadResources;
+
+    /// Returns the buffers of the calling thread, creating them on first use.
+    static ThreadResources& local();
+
+    ThreadResources& resources;  ///< The buffers of the thread that entered the arena.
+};
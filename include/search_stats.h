@@ -0,0 +1,162 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "mcs.h"
+
+//
+// Search statistics: stage timers and hot path counters of the MCS construction, the index build and the search.
+// Counters are accumulated in per-thread blocks, so the hot loops never contend, and are aggregated on output.
+// Statistics are collected only when enabled at runtime, and the KMISMATCH_STATS macros compile to nothing
+// unless KMISMATCH_ENABLE_STATS is defined, which removes them completely from production builds.
+//
+
+#ifdef KMISMATCH_ENABLE_STATS
+#define KMISMATCH_STATS(...) do { if (SearchStats::isEnabled()) { __VA_ARGS__; } } while (0)
+#define KMISMATCH_STATS_STAGE(stage) StageTimer stageTimer(stage)
+#define KMISMATCH_STATS_LAP_TIMER(name) LapTimer name
+#define KMISMATCH_STATS_LAP(name, stage) name.lap(stage)
+#else
+#define KMISMATCH_STATS(...) do {} while (0)
+#define KMISMATCH_STATS_STAGE(stage) do {} while (0)
+#define KMISMATCH_STATS_LAP_TIMER(name) do {} while (0)
+#define KMISMATCH_STATS_LAP(name, stage) do {} while (0)
+#endif
+
+/// Counters accumulated by the search, summed over all threads.
+enum class StatsCounter
+{
+    McsCombinations,      ///< Combinations the MCS constructions had to cover.
+    McsGreedyIterations,  ///< Forms picked by the greedy covers.
+    McsContainsChecks,    ///< Combination::contains calls of the greedy covers.
+    Queries,              ///< Searched queries.
+    DuplicateQueries,     ///< Queries answered by an identical query searched instead.
+    Lookups,              ///< Index lookups of query keys.
+    SharedLookups,        ///< Lookups of query keys answered by the lookup of an equal key of the same batch.
+    Candidates,           ///< Text positions returned by the lookups.
+    Verifications,        ///< CheckQueryOnPosition calls.
+    Hits,                 ///< Successful verifications.
+    Count
+};
+
+/// Values set once per run rather than accumulated.
+enum class StatsGauge
+{
+    McsForms,       ///< Forms of the MCS used for the index.
+    IndexKeys,      ///< Distinct keys in the index.
+    IndexPostings,  ///< Text positions stored in the index.
+    Count
+};
+
+/// Timed stages. Coarse stages are measured as wall time, per-candidate stages as time summed over threads.
+enum class StatsStage
+{
+    McsBuild,      ///< MCS construction (wall time).
+    IndexBuild,    ///< Index construction (wall time).
+    Search,        ///< Lookups and verifications of all queries (wall time).
+    Lookup,        ///< Index lookups (thread time).
+    Verification,  ///< Candidate verifications (thread time).
+    Count
+};
+
+//
+// The SearchStats class holds the process wide statistics.
+//
+class SearchStats
+{
+public:
+    /// Per form counters of the search.
+    struct FormCounters
+    {
+        uint64_t candidates = 0;     ///< Text positions returned by the lookups of the form.
+        uint64_t verifications = 0;  ///< Verifications of the candidates of the form.
+        uint64_t hits = 0;           ///< Successful verifications of the candidates of the form.
+    };
+
+    /// Returns true if statistics are collected.
+    static bool isEnabled();
+
+    /// Enables or disables the statistics collection.
+    static void setEnabled(bool enable);
+
+    /// Adds a value to a counter of the calling thread.
+    static void add(StatsCounter counter, uint64_t value);
+
+    /// Sets a gauge.
+    static void set(StatsGauge gauge, uint64_t value);
+
+    /// Adds nanoseconds to a stage of the calling thread.
+    static void addStageTime(StatsStage stage, uint64_t nanoseconds);
+
+    /// Adds the counters of a form to the calling thread.
+    static void addFormCounters(const Form& form, const FormCounters& counters);
+
+    /// Clears all statistics.
+    static void reset();
+
+    /**
+     * Aggregates the statistics of all threads.
+     * Must not be called while a search is running.
+     * @return The statistics as a JSON object.
+     */
+    static std::string toJson();
+
+private:
+    /// Statistics block owned by one thread.
+    struct ThreadStats
+    {
+        std::array<uint64_t, static_cast<size_t>(StatsCounter::Count)> counters{};
+        std::array<uint64_t, static_cast<size_t>(StatsStage::Count)> stageNanoseconds{};
+        std::map<Form, FormCounters> forms;
+    };
+
+    /// Returns the statistics block of the calling thread, registering it on first use.
+    static ThreadStats& local();
+
+    static std::atomic<bool> enabled;  ///< Whether statistics are collected.
+    static std::mutex registryMutex;  ///< Guards the registration of thread blocks.
+    static std::vector<std::unique_ptr<ThreadStats>> registry;  ///< The blocks of all threads.
+    static std::array<std::atomic<uint64_t>, static_cast<size_t>(StatsGauge::Count)> gauges;  ///< The gauges.
+};
+
+//
+// The StageTimer class adds the lifetime of a scope to a stage.
+//
+class StageTimer
+{
+public:
+    /// Starts timing a stage.
+    explicit StageTimer(StatsStage stage);
+
+    /// Adds the elapsed time to the stage.
+    ~StageTimer();
+
+private:
+    StatsStage stage;  ///< The timed stage.
+    bool active;  ///< Whether statistics were enabled when the timer started.
+    std::chrono::steady_clock::time_point start;  ///< The start time.
+};
+
+//
+// The LapTimer class splits the time of a loop between stages, every lap adds the time since the previous lap.
+//
+class LapTimer
+{
+public:
+    /// Starts the first lap.
+    LapTimer();
+
+    /// Adds the time since the previous lap to a stage and starts the next lap.
+    void lap(StatsStage stage);
+
+private:
+    bool active;  ///< Whether statistics were enabled when the timer started.
+    std::chrono::steady_clock::time_point last;  ///< The start time of the current lap.
+};
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// Search tracing: scoped spans of the MCS construction, the index build and the search, recorded into
+// per-thread ring buffers and written in the Chrome trace event format, which trace viewers such as
+// Perfetto or chrome://tracing open as a timeline per thread.
+// Spans are recorded only when enabled at runtime, and the KMISMATCH_TRACE macros compile to nothing
+// unless KMISMATCH_ENABLE_TRACE is defined.
+//
+
+#ifdef KMISMATCH_ENABLE_TRACE
+#define KMISMATCH_TRACE_SPAN(variable, ...) TraceSpan variable(__VA_ARGS__)
+#else
+#define KMISMATCH_TRACE_SPAN(variable, ...) do {} while (0)
+#endif
+
+//
+// The SearchTrace class holds the process wide trace buffers.
+//
+class SearchTrace
+{
+public:
+    /// Value of a span argument that is not recorded.
+    static constexpr int64_t NO_ARG = -1;
+
+    /// Lock waits shorter than this are not recorded, as uncontended locks take a few nanoseconds.
+    static constexpr int64_t LOCK_WAIT_MIN_NS = 1000;
+
+    /// Number of spans kept per thread, older spans are overwritten.
+    static constexpr size_t RING_CAPACITY = 1 << 16;
+
+    /// A completed span.
+    struct Event
+    {
+        const char* name;  ///< Name of the span, a string literal.
+        const char* category;  ///< Category of the span (mcs, index, search, lock), a string literal.
+        int64_t startNs;  ///< Start time since the trace epoch.
+        int64_t durationNs;  ///< Duration of the span.
+        int64_t arg;  ///< Span argument (query index, batch, remaining combinations) or NO_ARG.
+    };
+
+    /// Returns true if spans are recorded.
+    static bool isEnabled();
+
+    /// Enables or disables the recording of spans.
+    static void setEnabled(bool enable);
+
+    /// Returns the nanoseconds elapsed since the trace epoch.
+    static int64_t now();
+
+    /// Records a completed span in the ring buffer of the calling thread.
+    static void record(const Event& event);
+
+    /// Clears the buffers of all threads.
+    static void reset();
+
+    /**
+     * Writes the recorded spans of all threads in the Chrome trace event format.
+     * Must not be called while a search is running.
+     *
+     * @param fileName The name of the file to write the trace to.
+     */
+    static void writeChromeTrace(const std::string& fileName);
+
+private:
+    /// Ring buffer owned by one thread.
+    struct ThreadBuffer
+    {
+        size_t threadIndex = 0;  ///< Sequential index of the thread, used as trace thread ID.
+        std::vector<Event> events;  ///< The ring of spans.
+        size_t next = 0;  ///< Position of the next span in the ring.
+        bool wrapped = false;  ///< Whether older spans were overwritten.
+    };
+
+    /// Returns the buffer of the calling thread, registering it on first use.
+    static ThreadBuffer& local();
+
+    static std::atomic<bool> enabled;  ///< Whether spans are recorded.
+    static std::mutex registryMutex;  ///< Guards the registration of thread buffers.
+    static std::vector<std::unique_ptr<ThreadBuffer>> registry;  ///< The buffers of all threads.
+};
+
+//
+// The TraceSpan class records the lifetime of a scope as a span.
+//
+class TraceSpan
+{
+public:
+    /**
+     * Starts a span.
+     *
+     * @param name Name of the span, a string literal.
+     * @param category Category of the span, a string literal.
+     * @param arg Span argument or SearchTrace::NO_ARG.
+     * @param minDurationNs Spans shorter than this are dropped, used to keep only contended lock waits.
+     */
+    TraceSpan(const char* name, const char* category, int64_t arg = SearchTrace::NO_ARG, int64_t minDurationNs = 0);
+
+    /// Records the span.
+    ~TraceSpan();
+
+private:
+    const char* name;  ///< Name of the span.
+    const char* category;  ///< Category of the span.
+    int64_t arg;  ///< Span argument.
+    int64_t minDurationNs;  ///< Minimal duration of a recorded span.
+    int64_t startNs;  ///< Start time, negative when tracing was disabled at the start.
+};
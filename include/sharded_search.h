@@ -0,0 +1,204 @@
+#pragma once
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "k_mismatch_search.h"
+
+/// A range of the text searched by one worker of a sharded search.
+struct Shard
+{
+    size_t begin = 0;  ///< First text position of the shard.
+    size_t ownedEnd = 0;  ///< One past the last alignment start the shard reports, the begin of the next shard.
+    size_t end = 0;  ///< One past the last text position of the shard, past ownedEnd by the longest query but one.
+
+    bool operator==(const Shard&) const = default;
+};
+
+//
+// The ShardProtocol class reads and writes the messages between the coordinator and the workers of a sharded
+// search. Messages are text lines, so the same protocol runs over pipes between local processes and over any
+// byte stream between hosts:
+//   coordinator to worker: "QUERIES <n>" followed by n lines "<mismatches> <query>", or "END" to stop the worker;
+//   worker to coordinator: "HITS <m>" followed by m lines "<query> <position>", the query being its index in the
+//   batch and the position relative to the shard begin, sorted, or "ERROR <message>" if the batch failed.
+//
+class ShardProtocol
+{
+public:
+    /**
+     * Writes a batch of queries.
+     *
+     * @param os The stream to the worker, flushed after the batch.
+     * @param queries The queries; a query must not hold a line break.
+     * @param misMatchesPerQuery Mismatch threshold of every query.
+     * @param first Index of the first query of the batch.
+     * @param last One past the index of the last query of the batch.
+     */
+    static void writeQueries(std::ostream& os, const std::vector<std::string>& queries,
+        const std::vector<size_t>& misMatchesPerQuery, size_t first, size_t last);
+
+    /**
+     * Reads a batch of queries.
+     *
+     * @param is The stream from the coordinator.
+     * @param queries Set to the queries of the batch.
+     * @param misMatchesPerQuery Set to the mismatch threshold of every query of the batch.
+     * @return False at the end message or the end of the stream.
+     */
+    static bool readQueries(std::istream& is, std::vector<std::string>& queries, std::vector<size_t>& misMatchesPerQuery);
+
+    /// Writes the end message, stopping the worker.
+    static void writeEnd(std::ostream& os);
+
+    /**
+     * Writes the hits of a batch.
+     *
+     * @param os The stream to the coordinator, flushed after the hits.
+     * @param hits The sorted (query, position) pairs.
+     */
+    static void writeHits(std::ostream& os, const std::vector<std::pair<size_t, size_t>>& hits);
+
+    /// Writes the error of a batch, on a single line.
+    static void writeError(std::ostream& os, const std::string& message);
+
+    /**
+     * Reads the hits of a batch.
+     *
+     * @param is The stream from the worker.
+     * @return The (query, position) pairs.
+     * @throws std::runtime_error with the message of an error reply, or if the stream ends or is malformed.
+     */
+    static std::vector<std::pair<size_t, size_t>> readHits(std::istream& is);
+
+    /// Formats a shard as begin:ownedEnd:end, the argument of a worker.
+    static std::string formatShard(const Shard& shard);
+
+    /// Parses a shard formatted by formatShard, throwing std::runtime_error if it is malformed.
+    static Shard parseShard(const std::string& str);
+};
+
+//
+// The ShardWorker class searches the batches of queries a coordinator sends for the shard of the text it holds.
+// The index of the shard is kept from a batch to the next one, and the MCS is rebuilt only when a batch brings
+// a query length the MCS does not cover yet.
+//
+class ShardWorker
+{
+public:
+    /**
+     * Creates a worker.
+     *
+     * @param search The search, with the text of the shard and its wildcards.
+     * @param shard The shard, only the alignments starting before its ownedEnd being reported.
+     * @param engine Name of the engine: mcs, naive, fft, fm or seed.
+     * @param misMatches Most mismatches of any query, the MCS being built for them.
+     */
+    ShardWorker(KMismatchSearch& search, const Shard& shard, const std::string& engine, size_t misMatches);
+
+    /**
+     * Reads the text of a shard from the text file.
+     *
+     * @param fileName Path to the text file.
+     * @param shard The shard.
+     * @return The text from the shard begin to its end.
+     */
+    static std::string loadShardText(const std::string& fileName, const Shard& shard);
+
+    /**
+     * Searches a batch of queries in the shard.
+     *
+     * @param queries The queries of the batch.
+     * @param misMatchesPerQuery Mismatch threshold of every query.
+     * @return The sorted (query, position) pairs, positions relative to the shard begin.
+     */
+    std::vector<std::pair<size_t, size_t>> searchBatch(std::vector<std::string>& queries,
+        const std::vector<size_t>& misMatchesPerQuery);
+
+    /**
+     * Answers batches of queries until the end message or the end of the input. A failed batch is answered
+     * with an error message and the worker goes on with the next one.
+     *
+     * @param is The stream from the coordinator.
+     * @param os The stream to the coordinator.
+     */
+    void serve(std::istream& is, std::ostream& os);
+
+private:
+    KMismatchSearch& search;  ///< The search of the shard text.
+    Shard shard;  ///< The shard.
+    std::string engine;  ///< Name of the engine.
+    size_t misMatches;  ///< Most mismatches of any query.
+    std::set<size_t> mcsLengths;  ///< Query lengths the MCS covers, with the mcs engine.
+};
+
+//
+// The ShardCoordinator class runs a search over worker processes, each holding the index of one shard of the
+// text, so that no process needs the memory of the whole index. The text is cut into ranges overlapping by the
+// longest query but one, so every alignment lies within a shard and is reported by the shard owning its start.
+// Batches of queries are sent to every worker before the hits of any are read, the workers searching them
+// in parallel, and their hits are moved to text positions and merged.
+//
+class ShardCoordinator
+{
+public:
+    static constexpr size_t BATCH_QUERIES = static_cast<size_t>(1) << 12;  ///< Queries sent to the workers per batch.
+
+    /**
+     * Cuts a text into shards of near-equal sizes.
+     *
+     * @param textSize Size of the text.
+     * @param shards Number of shards, at least 1, reduced to the text size when it is larger.
+     * @param overlap Positions a shard reads past the begin of the next one, the longest query length but one.
+     * @return The shards, in text order.
+     */
+    static std::vector<Shard> partition(size_t textSize, size_t shards, size_t overlap);
+
+    /**
+     * Starts a worker process per shard, talking to it through pipes to its standard input and output.
+     * Worker processes are not supported on Windows.
+     *
+     * @param workerCommand The worker program, looked up in PATH when it holds no slash, and its arguments, to which
+     *                      "--shard <shard>" is appended.
+     * @throws std::runtime_error if a worker can not be started.
+     * @param shards The shards.
+     */
+    ShardCoordinator(const std::vector<std::string>& workerCommand, const std::vector<Shard>& shards);
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+    /// Stops the workers and waits for them to exit.
+    ~ShardCoordinator();
+
+    /**
+     * Searches the queries in every shard.
+     *
+     * @param queries The queries.
+     * @param misMatchesPerQuery Mismatch threshold of every query.
+     * @return The text positions of every query.
+     */
+    std::map<std::string, std::set<size_t>> search(const std::vector<std::string>& queries,
+        const std::vector<size_t>& misMatchesPerQuery);
+
+private:
+    struct Worker;
+
+    /**
+     * Starts the worker process of a shard.
+     *
+     * @param workerCommand Path to the worker program and its arguments.
+     * @param shard The shard.
+     */
+    void startWorker(const std::vector<std::string>& workerCommand, const Shard& shard);
+
+    /// Sends the end message to every worker, closes their pipes and waits for them to exit.
+    void stopWorkers();
+
+    std::vector<Shard> shards;  ///< The shard of every worker.
+    std::vector<std::unique_ptr<Worker>> workers;  ///< The worker processes.
+};
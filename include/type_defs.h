@@ -59,6 +59,33 @@ namespace kMismatchIntegerType {
     const size_t UINT_TYPE_SIZE = 64;
 }
 
+// Bits to flip to complement a nucleotide, indexed by its low nibble: A (1) and T (4) differ by 0x15,
+// C (3) and G (7) by 0x04, in either case, and N (14) is its own complement.
+inline constexpr uint8_t COMPLEMENT_FLIPS[16] = { 0, 0x15, 0, 0x04, 0x15, 0, 0, 0x04, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/**
+ * Returns the complement of a nucleotide symbol, computed like the vector code does with a nibble lookup.
+ * @param base A nucleotide symbol, see isNucleotide; other symbols get an unspecified symbol.
+ * @return The complementary symbol, in the same case.
+ */
+inline char complementBase(char base) {
+    return static_cast<char>(base ^ COMPLEMENT_FLIPS[base & 0x0F]);
+}
+
+/**
+ * Returns true for the nucleotide symbols A, C, G, T and N, in either case.
+ * @param symbol The symbol to check.
+ * @return True if the symbol has a complement.
+ */
+inline bool isNucleotide(char symbol) {
+    switch (symbol | 0x20) {
+    case 'a': case 'c': case 'g': case 't': case 'n':
+        return true;
+    default:
+        return false;
+    }
+}
+
 /**
  * Template class representing a base sequence of binary integers.
  * This class provides basic functionality for handling binary integer sequences, including
@@ -107,6 +134,11 @@ public:
         return sequenceInt < other.sequenceInt;
     }
 
+    /// Equality operator, true for the same binary sequence.
+    friend bool operator==(const Derived& a, const Derived& b) {
+        return a.sequenceInt == b.sequenceInt;
+    }
+
     /// Returns the size of the binary sequence.
     size_t getSize() const
     {
@@ -0,0 +1,96 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//
+// Verification kernels count the mismatches of a query against the text at a position.
+// Besides the generic kernel, a table of kernels is generated at compile time for common read lengths and
+// small mismatch thresholds: their SIMD compares are fully unrolled, the last partial chunk is an overlapping
+// compare instead of a scalar loop, and the mismatch threshold of the early exits is a constant.
+//
+
+/**
+ * A verification kernel. The caller checks that the query fits in the text at the position.
+ *
+ * @param textPtr Pointer to the text at the verified position.
+ * @param queryPtr Pointer to the query.
+ * @param queryLen Length of the query, ignored by specialized kernels.
+ * @param misMatches Maximum number of mismatches allowed, ignored by specialized kernels.
+ * @return True if the query matches the text with at most misMatches mismatches.
+ */
+using VerificationKernel = bool (*)(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches);
+
+/// The generic kernel, for any query length and mismatch threshold.
+bool verifyGeneric(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches);
+
+/**
+ * Returns the kernel for a query shape, picked once per query or query group.
+ *
+ * @param queryLen Length of the query.
+ * @param misMatches Maximum number of mismatches allowed.
+ * @return The specialized kernel of the shape if there is one, otherwise the generic kernel.
+ */
+VerificationKernel selectVerificationKernel(size_t queryLen, size_t misMatches);
+
+/// Returns true if a specialized kernel exists for a query shape on this build and CPU.
+bool hasSpecializedKernel(size_t queryLen, size_t misMatches);
+
+/**
+ * Kernel that checks the reverse complement of a nucleotide query, read from the query itself:
+ * text symbol i is compared with the complement of query symbol queryLen - 1 - i.
+ * Chunks of the query are reversed and complemented in registers.
+ */
+bool verifyReverseComplement(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches);
+
+//
+// The Wildcards class is a set of don't-care symbols, such as N in sequencing data or '-' in alignments.
+// A wildcard in the text or in the query matches any symbol, so it uses no mismatch budget.
+//
+class Wildcards
+{
+public:
+    /// Creates an empty set, every symbol being compared.
+    Wildcards() = default;
+
+    /**
+     * Creates a set of wildcards.
+     *
+     * @param symbols The wildcard symbols.
+     */
+    explicit Wildcards(const std::string& symbols);
+
+    /// Returns true if no symbol is a wildcard.
+    bool empty() const;
+
+    /// Returns the wildcard symbols, each once, in the order given.
+    const std::string& getSymbols() const;
+
+    /// Returns true if a symbol is a wildcard.
+    bool contains(char symbol) const
+    {
+        return this->table[static_cast<unsigned char>(symbol)];
+    }
+
+    /// Returns a bit per byte of a 32-byte chunk, set at the wildcards.
+    uint32_t mask32(const char* chunk) const;
+
+private:
+    std::string symbols;  ///< The wildcard symbols.
+    std::array<bool, 256> table{};  ///< Whether every byte is a wildcard.
+};
+
+/**
+ * Checks a query at a text position where wildcards of the text and of the query match any symbol.
+ * The wildcard bits of both chunks mask out the differences of the SIMD compare.
+ *
+ * @param textPtr Pointer to the text at the verified position.
+ * @param queryPtr Pointer to the query.
+ * @param queryLen Length of the query.
+ * @param misMatches Maximum number of mismatches allowed.
+ * @param wildcards The wildcard symbols.
+ * @return True if the query matches the text with at most misMatches mismatches.
+ */
+bool verifyWithWildcards(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches,
+    const Wildcards& wildcards);
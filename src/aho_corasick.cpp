@@ -0,0 +1,103 @@
+#include "aho_corasick.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+AhoCorasick::AhoCorasick(const std::vector<std::string>& patterns)
+{
+    // Codes of the pattern symbols, 0 being every other byte
+    this->symbols = 1;
+    for (auto& pattern : patterns)
+    {
+        if (pattern.empty())
+            throw std::runtime_error("Aho-Corasick patterns must not be empty!");
+        for (unsigned char symbol : pattern)
+            if (!this->codes[symbol])
+                this->codes[symbol] = static_cast<uint8_t>(this->symbols++);
+        this->longestPattern = std::max(this->longestPattern, pattern.size());
+    }
+
+    // Trie of the patterns, a missing child being 0 since the root is no child
+    size_t patternSymbols = 0;
+    for (auto& pattern : patterns)
+        patternSymbols += pattern.size();
+    if (patternSymbols >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Too many pattern symbols for the Aho-Corasick automaton!");
+    this->transitions.assign(this->symbols, 0);
+    std::vector<uint32_t> patternStates(patterns.size());
+    size_t states = 1;
+    for (size_t p = 0; p < patterns.size(); p++)
+    {
+        uint32_t state = 0;
+        for (unsigned char symbol : patterns[p])
+        {
+            uint32_t& child = this->transitions[state * this->symbols + this->codes[symbol]];
+            if (!child)
+            {
+                child = static_cast<uint32_t>(states++);
+                this->transitions.resize(states * this->symbols, 0);
+            }
+            state = this->transitions[state * this->symbols + this->codes[symbol]];
+        }
+        patternStates[p] = state;
+    }
+
+    // Patterns ending at every state
+    this->outputBegin.assign(states + 1, 0);
+    for (uint32_t state : patternStates)
+        this->outputBegin[state + 1]++;
+    for (size_t state = 0; state < states; state++)
+        this->outputBegin[state + 1] += this->outputBegin[state];
+    this->outputs.resize(patterns.size());
+    std::vector<uint32_t> filled(this->outputBegin.begin(), this->outputBegin.end() - 1);
+    for (size_t p = 0; p < patterns.size(); p++)
+        this->outputs[filled[patternStates[p]]++] = static_cast<uint32_t>(p);
+
+    // Failure links in breadth-first order, completing the missing transitions with the ones of the failure state.
+    // The other bytes have no child anywhere, so they lead back to the root
+    std::vector<uint32_t> failures(states, 0);
+    this->outputLinks.assign(states, 0);
+    std::vector<uint32_t> queue;
+    queue.reserve(states);
+    for (size_t code = 0; code < this->symbols; code++)
+        if (this->transitions[code])
+            queue.push_back(this->transitions[code]);
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        uint32_t state = queue[head];
+        uint32_t failure = failures[state];
+        this->outputLinks[state] = this->outputBegin[failure] != this->outputBegin[failure + 1] ? failure : this->outputLinks[failure];
+        for (size_t code = 0; code < this->symbols; code++)
+        {
+            uint32_t& child = this->transitions[state * this->symbols + code];
+            if (child)
+            {
+                failures[child] = this->transitions[failure * this->symbols + code];
+                queue.push_back(child);
+            }
+            else
+                child = this->transitions[failure * this->symbols + code];
+        }
+    }
+}
+
+size_t AhoCorasick::getStates() const
+{
+    return this->outputLinks.size();
+}
+
+size_t AhoCorasick::getLongestPattern() const
+{
+    return this->longestPattern;
+}
+
+size_t AhoCorasick::memoryBytes() const
+{
+    return (this->transitions.size() + this->outputLinks.size() + this->outputBegin.size() + this->outputs.size())
+        * sizeof(uint32_t);
+}
+
+size_t AhoCorasick::estimateBytes(size_t patternSymbols, size_t symbols)
+{
+    return (patternSymbols + 1) * (symbols + 1 + 3) * sizeof(uint32_t);
+}
@@ -0,0 +1,148 @@
+#include "corpus.h"
+#include <algorithm>
+#include <execution>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * Reads every file in parallel and converts its content.
+ *
+ * @param fileNames Paths to the files.
+ * @param read Converts the stream of a file and its path, and may throw.
+ * @return The converted content of every file.
+ */
+template <typename Read>
+static auto readFilesInParallel(const std::vector<std::string>& fileNames, Read&& read)
+{
+    using Content = decltype(read(std::declval<std::ifstream&>(), std::declval<const std::string&>()));
+    std::vector<Content> contents(fileNames.size());
+    std::vector<std::string> errors(fileNames.size());
+    std::vector<size_t> files(fileNames.size());
+    std::iota(files.begin(), files.end(), 0);
+
+    // An exception escaping a parallel algorithm terminates the program, so errors are rethrown after the loop
+    std::for_each(std::execution::par, files.begin(), files.end(),
+        [&](size_t file)
+        {
+            try
+            {
+                std::ifstream stream(fileNames[file]);
+                if (!stream)
+                    throw std::runtime_error("Unable to open text file: " + fileNames[file]);
+                contents[file] = read(stream, fileNames[file]);
+            }
+            catch (const std::exception& e)
+            {
+                errors[file] = e.what();
+            }
+        });
+    for (auto& error : errors)
+        if (!error.empty())
+            throw std::runtime_error(error);
+    return contents;
+}
+
+Corpus Corpus::loadFromFiles(const std::vector<std::string>& fileNames)
+{
+    auto texts = readFilesInParallel(fileNames, [](std::ifstream& stream, const std::string&)
+        {
+            return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        });
+
+    Corpus corpus;
+    size_t textSize = 0;
+    for (auto& documentText : texts)
+        textSize += documentText.size();
+    corpus.text.reserve(textSize);
+    for (size_t file = 0; file < fileNames.size(); file++)
+        corpus.addDocument(fileNames[file], texts[file]);
+    return corpus;
+}
+
+Corpus Corpus::loadFromFasta(const std::vector<std::string>& fileNames)
+{
+    auto records = readFilesInParallel(fileNames, [](std::ifstream& stream, const std::string& fileName)
+        {
+            std::vector<std::pair<std::string, std::string>> fileRecords;
+            std::string line;
+            while (std::getline(stream, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (line.empty() || line.front() == ';')
+                    continue;
+                if (line.front() == '>')
+                {
+                    size_t nameEnd = line.find_first_of(" \t", 1);
+                    fileRecords.emplace_back(line.substr(1, nameEnd == std::string::npos ? nameEnd : nameEnd - 1), "");
+                    continue;
+                }
+                if (fileRecords.empty())
+                    throw std::runtime_error("FASTA file has a sequence before its first header: " + fileName);
+                fileRecords.back().second += line;
+            }
+            return fileRecords;
+        });
+
+    Corpus corpus;
+    size_t textSize = 0;
+    for (auto& fileRecords : records)
+        for (auto& [name, sequence] : fileRecords)
+            textSize += sequence.size();
+    corpus.text.reserve(textSize);
+    for (auto& fileRecords : records)
+        for (auto& [name, sequence] : fileRecords)
+            corpus.addDocument(name, sequence);
+    return corpus;
+}
+
+void Corpus::addDocument(const std::string& name, const std::string& documentText)
+{
+    this->names.push_back(name);
+    this->starts.push_back(this->text.size());
+    this->text += documentText;
+}
+
+size_t Corpus::size() const
+{
+    return this->names.size();
+}
+
+const std::vector<std::string>& Corpus::getNames() const
+{
+    return this->names;
+}
+
+const std::string& Corpus::getText() const
+{
+    return this->text;
+}
+
+const std::vector<size_t>& Corpus::getStarts() const
+{
+    return this->starts;
+}
+
+DocumentPosition Corpus::locate(size_t position) const
+{
+    return locate(this->starts, position);
+}
+
+DocumentPosition Corpus::locate(const std::vector<size_t>& starts, size_t position)
+{
+    // The last document starting at or before the position, empty documents sharing their start with the next one
+    auto next = std::upper_bound(starts.begin(), starts.end(), position);
+    if (next == starts.begin())
+        return { 0, position };
+    size_t document = static_cast<size_t>(next - starts.begin()) - 1;
+    return { document, position - starts[document] };
+}
+
+bool Corpus::withinDocument(const std::vector<size_t>& starts, size_t position, size_t length)
+{
+    auto next = std::upper_bound(starts.begin(), starts.end(), position);
+    return next == starts.end() || position + length <= *next;
+}
@@ -0,0 +1,391 @@
+#include "fm_index.h"
+#include <algorithm>
+#include <execution>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Rows per rank block, the bits of a word.
+static constexpr size_t BLOCK_ROWS = 64;
+
+static inline size_t blockCount(size_t rows)
+{
+    return rows / BLOCK_ROWS + 1;
+}
+
+FmIndex::~FmIndex()
+{
+#ifndef _WIN32
+    if (this->mapping)
+        munmap(this->mapping, this->mappingBytes);
+#endif
+}
+
+size_t FmIndex::layoutWords(size_t textSize, size_t symbols, size_t samples)
+{
+    static_assert(sizeof(Header) % sizeof(uint64_t) == 0, "The header must keep the sections aligned");
+    size_t blocks = blockCount(textSize + 1);
+    return sizeof(Header) / sizeof(uint64_t)
+        + (symbols + 1)                     // cumulative
+        + (blocks * symbols + 1) / 2        // rankCounts
+        + blocks * symbols                  // rankBits
+        + (blocks + 1) / 2                  // sampledCounts
+        + blocks                            // sampledBits
+        + samples;                          // samples
+}
+
+void FmIndex::bindSections(const uint64_t* buffer, size_t words)
+{
+    this->header = reinterpret_cast<const Header*>(buffer);
+    this->words = words;
+    this->rows = this->header->textSize + 1;
+    this->symbols = this->header->symbols;
+
+    size_t blocks = blockCount(this->rows);
+    const uint64_t* section = buffer + sizeof(Header) / sizeof(uint64_t);
+    this->cumulative = section;
+    section += this->symbols + 1;
+    this->rankCounts = reinterpret_cast<const uint32_t*>(section);
+    section += (blocks * this->symbols + 1) / 2;
+    this->rankBits = section;
+    section += blocks * this->symbols;
+    this->sampledCounts = reinterpret_cast<const uint32_t*>(section);
+    section += (blocks + 1) / 2;
+    this->sampledBits = section;
+    section += blocks;
+    this->samples = section;
+}
+
+uint64_t FmIndex::hashText(const std::string& text)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char symbol : text)
+        hash = (hash ^ symbol) * 0x100000001b3ULL;
+    return hash;
+}
+
+size_t FmIndex::estimateBytes(size_t textSize, size_t symbols, size_t sampleRate)
+{
+    return layoutWords(textSize, symbols + 1, textSize / std::max<size_t>(sampleRate, 1) + 1) * sizeof(uint64_t);
+}
+
+size_t FmIndex::estimateBuildBytes(size_t textSize)
+{
+    // The (key, suffix) pairs sorted by prefix doubling, the ranks and the group ids of the suffixes
+    return (textSize + 1) * (sizeof(std::pair<uint64_t, uint32_t>) + 2 * sizeof(uint32_t));
+}
+
+std::shared_ptr<const FmIndex> FmIndex::build(const std::string& text, size_t sampleRate)
+{
+    if (text.size() >= std::numeric_limits<uint32_t>::max() - 1)
+        throw std::runtime_error("Text is too long for the FM-index!");
+    if (sampleRate == 0)
+        throw std::runtime_error("Suffix array sample rate must be positive!");
+
+    // Codes of the symbols in byte order, 0 being the end of text
+    std::vector<size_t> symbolCounts(256, 0);
+    for (unsigned char symbol : text)
+        symbolCounts[symbol]++;
+    Header header = {};
+    std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+    std::fill(std::begin(header.codes), std::end(header.codes), NO_CODE);
+    header.symbols = 1;
+    for (size_t symbol = 0; symbol < 256; symbol++)
+        if (symbolCounts[symbol])
+            header.codes[symbol] = static_cast<uint8_t>(header.symbols++);
+    if (header.symbols > NO_CODE)
+        throw std::runtime_error("Text has too many distinct symbols for the FM-index!");
+    header.version = VERSION;
+    header.textSize = text.size();
+    header.textHash = hashText(text);
+    header.sampleRate = sampleRate;
+    size_t rows = text.size() + 1;
+    header.samples = (rows - 1) / sampleRate + 1;
+
+    // Suffix array by prefix doubling: the suffixes are sorted by the ranks of their first h symbols and of the
+    // h symbols that follow, until all ranks are distinct, which the unique end of text guarantees
+    std::vector<std::pair<uint64_t, uint32_t>> order(rows);
+    std::vector<uint32_t> ranks(rows);
+    std::vector<uint32_t> groups(rows);
+    for (size_t i = 0; i < text.size(); i++)
+        ranks[i] = header.codes[static_cast<unsigned char>(text[i])];
+    ranks[text.size()] = 0;
+    for (size_t h = 1;; h <<= 1)
+    {
+        std::for_each(std::execution::par, order.begin(), order.end(),
+            [&](std::pair<uint64_t, uint32_t>& entry)
+            {
+                size_t i = &entry - order.data();
+                uint64_t next = i + h < rows ? static_cast<uint64_t>(ranks[i + h]) + 1 : 0;
+                entry = { (static_cast<uint64_t>(ranks[i]) << 32) | next, static_cast<uint32_t>(i) };
+            });
+        std::sort(std::execution::par, order.begin(), order.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::transform(std::execution::par, order.begin() + 1, order.end(), order.begin(), groups.begin() + 1,
+            [](const auto& entry, const auto& previous) { return static_cast<uint32_t>(entry.first != previous.first); });
+        groups[0] = 0;
+        std::inclusive_scan(std::execution::par, groups.begin(), groups.end(), groups.begin());
+        std::for_each(std::execution::par, order.begin(), order.end(),
+            [&](const std::pair<uint64_t, uint32_t>& entry) { ranks[entry.second] = groups[&entry - order.data()]; });
+        if (groups.back() == rows - 1)
+            break;
+    }
+    ranks = std::vector<uint32_t>();
+    groups = std::vector<uint32_t>();
+
+    std::shared_ptr<FmIndex> index(new FmIndex());
+    index->storage.assign(layoutWords(text.size(), header.symbols, header.samples), 0);
+    *reinterpret_cast<Header*>(index->storage.data()) = header;
+    index->bindSections(index->storage.data(), index->storage.size());
+
+    size_t symbols = header.symbols;
+    auto* cumulative = const_cast<uint64_t*>(index->cumulative);
+    auto* rankCounts = const_cast<uint32_t*>(index->rankCounts);
+    auto* rankBits = const_cast<uint64_t*>(index->rankBits);
+    auto* sampledCounts = const_cast<uint32_t*>(index->sampledCounts);
+    auto* sampledBits = const_cast<uint64_t*>(index->sampledBits);
+    auto* samples = const_cast<uint64_t*>(index->samples);
+
+    cumulative[0] = 0;
+    cumulative[1] = 1;
+    for (size_t symbol = 0, code = 1; symbol < 256; symbol++)
+        if (symbolCounts[symbol])
+        {
+            cumulative[code + 1] = cumulative[code] + symbolCounts[symbol];
+            code++;
+        }
+
+    // Bits of the transform and of the sampled rows, every block of rows in parallel
+    size_t blocks = blockCount(rows);
+    std::vector<size_t> blockIds(blocks);
+    std::iota(blockIds.begin(), blockIds.end(), 0);
+    std::for_each(std::execution::par, blockIds.begin(), blockIds.end(),
+        [&](size_t block)
+        {
+            for (size_t row = block * BLOCK_ROWS; row < std::min(rows, (block + 1) * BLOCK_ROWS); row++)
+            {
+                uint32_t suffix = order[row].second;
+                size_t code = suffix ? header.codes[static_cast<unsigned char>(text[suffix - 1])] : 0;
+                uint64_t bit = static_cast<uint64_t>(1) << (row % BLOCK_ROWS);
+                rankBits[block * symbols + code] |= bit;
+                if (suffix % sampleRate == 0)
+                    sampledBits[block] |= bit;
+            }
+        });
+
+    // Counts before every block, then the samples of every block at their offsets
+    std::vector<uint32_t> counts(symbols, 0);
+    uint32_t sampledCount = 0;
+    for (size_t block = 0; block < blocks; block++)
+    {
+        for (size_t code = 0; code < symbols; code++)
+        {
+            rankCounts[block * symbols + code] = counts[code];
+            counts[code] += static_cast<uint32_t>(popcount(rankBits[block * symbols + code]));
+        }
+        sampledCounts[block] = sampledCount;
+        sampledCount += static_cast<uint32_t>(popcount(sampledBits[block]));
+    }
+    std::for_each(std::execution::par, blockIds.begin(), blockIds.end(),
+        [&](size_t block)
+        {
+            size_t sample = sampledCounts[block];
+            for (size_t row = block * BLOCK_ROWS; row < std::min(rows, (block + 1) * BLOCK_ROWS); row++)
+                if (order[row].second % sampleRate == 0)
+                    samples[sample++] = order[row].second;
+        });
+
+    return index;
+}
+
+std::shared_ptr<const FmIndex> FmIndex::load(const std::string& fileName)
+{
+    std::shared_ptr<FmIndex> index(new FmIndex());
+    const uint64_t* buffer = nullptr;
+    size_t bytes = 0;
+#ifdef _WIN32
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Unable to open file: " + fileName);
+    std::vector<char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    bytes = content.size();
+    index->storage.assign((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    std::copy(content.begin(), content.end(), reinterpret_cast<char*>(index->storage.data()));
+    buffer = index->storage.data();
+#else
+    int descriptor = open(fileName.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        throw std::runtime_error("Unable to open file: " + fileName);
+    struct stat status;
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        throw std::runtime_error("Unable to read file: " + fileName);
+    }
+    bytes = static_cast<size_t>(status.st_size);
+    void* mapping = bytes ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Wrong FM-index file: " + fileName);
+    index->mapping = mapping;
+    index->mappingBytes = bytes;
+    buffer = static_cast<const uint64_t*>(mapping);
+#endif
+
+    if (bytes < sizeof(Header))
+        throw std::runtime_error("Wrong FM-index file: " + fileName);
+    const Header* header = reinterpret_cast<const Header*>(buffer);
+    if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header->magic) || header->version != VERSION)
+        throw std::runtime_error("Wrong FM-index file: " + fileName);
+    if (header->symbols == 0 || header->symbols > NO_CODE || header->sampleRate == 0
+        || header->samples != header->textSize / header->sampleRate + 1
+        || bytes != layoutWords(header->textSize, header->symbols, header->samples) * sizeof(uint64_t))
+        throw std::runtime_error("Wrong FM-index file content: " + fileName);
+
+    index->bindSections(buffer, bytes / sizeof(uint64_t));
+    return index;
+}
+
+void FmIndex::save(const std::string& fileName) const
+{
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file: " + fileName);
+    }
+    file.write(reinterpret_cast<const char*>(this->header), this->words * sizeof(uint64_t));
+    if (!file)
+        throw std::runtime_error("Unable to write file: " + fileName);
+}
+
+size_t FmIndex::getTextSize() const
+{
+    return this->header->textSize;
+}
+
+uint64_t FmIndex::getTextHash() const
+{
+    return this->header->textHash;
+}
+
+size_t FmIndex::memoryBytes() const
+{
+    return this->words * sizeof(uint64_t);
+}
+
+size_t FmIndex::codeAt(size_t row) const
+{
+    const uint64_t* bits = this->rankBits + (row / BLOCK_ROWS) * this->symbols;
+    for (size_t code = 0; code < this->symbols; code++)
+        if ((bits[code] >> (row % BLOCK_ROWS)) & 1)
+            return code;
+    return 0;
+}
+
+size_t FmIndex::locate(size_t row) const
+{
+    // LF-mapping steps back one text position at a time, until a row whose suffix is sampled
+    size_t steps = 0;
+    while (!((this->sampledBits[row / BLOCK_ROWS] >> (row % BLOCK_ROWS)) & 1))
+    {
+        size_t code = codeAt(row);
+        row = this->cumulative[code] + rank(code, row);
+        steps++;
+    }
+    uint64_t below = (static_cast<uint64_t>(1) << (row % BLOCK_ROWS)) - 1;
+    size_t sample = this->sampledCounts[row / BLOCK_ROWS] + popcount(this->sampledBits[row / BLOCK_ROWS] & below);
+    return this->samples[sample] + steps;
+}
+
+size_t FmIndex::search(const std::string& query, size_t misMatches, std::pmr::vector<size_t>& positions,
+    std::pmr::memory_resource* resource) const
+{
+    size_t length = query.size();
+    if (length == 0 || length > this->header->textSize)
+        return 0;
+
+    std::pmr::vector<uint8_t> codes(length, resource);
+    for (size_t i = 0; i < length; i++)
+        codes[i] = this->header->codes[static_cast<unsigned char>(query[i])];
+
+    // Lower bound of the mismatches of every query prefix. Scanning from the right, the query is cut into
+    // chunks that do not occur in the text, and every alignment has a mismatch in each of them, so the
+    // prefix query[0..i] has at least as many mismatches as the chunks ending at or before i.
+    std::pmr::vector<uint32_t> lowerBound(length + 1, 0, resource);
+    size_t steps = 0;
+    for (size_t i = length, lo = 0, hi = this->rows, chunkEnd = length; i-- > 0;)
+    {
+        uint8_t code = codes[i];
+        if (code != NO_CODE)
+        {
+            lo = this->cumulative[code] + rank(code, lo);
+            hi = this->cumulative[code] + rank(code, hi);
+            steps++;
+        }
+        if (code == NO_CODE || lo >= hi)
+        {
+            lowerBound[chunkEnd]++;
+            lo = 0;
+            hi = this->rows;
+            chunkEnd = i;
+        }
+    }
+    // lowerBound[i + 1] counts the chunks ending at i, the bound of the prefix of i symbols is their prefix sum
+    std::inclusive_scan(lowerBound.begin(), lowerBound.end(), lowerBound.begin());
+
+    // Depth-first backtracking from the end of the query, each frame being the rows of a matched suffix
+    struct Frame
+    {
+        size_t prefix;  // Symbols of the query left to match
+        size_t lo;
+        size_t hi;
+        size_t misMatches;
+    };
+    std::pmr::vector<Frame> stack(resource);
+    std::pmr::vector<std::pair<size_t, size_t>> ranges(resource);
+    if (lowerBound[length] <= misMatches)
+        stack.push_back({ length, 0, this->rows, 0 });
+    while (!stack.empty())
+    {
+        Frame frame = stack.back();
+        stack.pop_back();
+        size_t i = frame.prefix - 1;
+        uint8_t queryCode = codes[i];
+        // Without mismatches left, only the query symbol extends the match
+        size_t first = frame.misMatches == misMatches ? queryCode : 1;
+        size_t last = frame.misMatches == misMatches ? queryCode : this->symbols - 1;
+        if (first == NO_CODE)
+            continue;
+        for (size_t code = first; code <= last; code++)
+        {
+            size_t mismatched = frame.misMatches + (code != queryCode);
+            if (mismatched + lowerBound[i] > misMatches)
+                continue;
+            size_t lo = this->cumulative[code] + rank(code, frame.lo);
+            size_t hi = this->cumulative[code] + rank(code, frame.hi);
+            steps++;
+            if (lo >= hi)
+                continue;
+            if (i == 0)
+                ranges.emplace_back(lo, hi);
+            else
+                stack.push_back({ i, lo, hi, mismatched });
+        }
+    }
+
+    for (auto& [lo, hi] : ranges)
+        for (size_t row = lo; row < hi; row++)
+            positions.push_back(locate(row));
+    return steps;
+}
@@ -1,19 +1,24 @@
 #include "k_mismatch_search.h"
+#include "search_stats.h"
+#include "search_trace.h"
+#include "scratch_arena.h"
+#include "number_theoretic_transform.h"
+#include <bit>
+#include <string_view>
+#include <thread>
 
 KMismatchSearch::KMismatchSearch()
 {
     this->text = std::string();
     this->queries = std::vector<std::string>();
     this->mcs = MCS();
-    this->cache = std::map<std::string, std::set<size_t>>();
 }
 
 KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile, int misMatches)
 {
     this->text = loadTextFromFile(textFile);
     this->queries = loadQueriesFromFile(queriesFile);
-    this->mcs = MCS::buildMCSNaiveMultithreaded(queries, misMatches);
-    this->cache = std::map<std::string, std::set<size_t>>();
+    buildLengthBucketsMcs(misMatches);
 }
 
 KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile, std::string mcsFile)
@@ -21,7 +26,6 @@ KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile,
     this->text = loadTextFromFile(textFile);
     this->queries = loadQueriesFromFile(queriesFile);
     this->mcs = MCS::loadFromFile(mcsFile);
-    this->cache = std::map<std::string, std::set<size_t>>();
 }
 
 KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile, std::string mcsFile, std::string cacheFile)
@@ -29,7 +33,8 @@ KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile,
     this->text = loadTextFromFile(textFile);
     this->queries = loadQueriesFromFile(queriesFile);
     this->mcs = MCS::loadFromFile(mcsFile);
-    this->cache = loadCacheFromFile(cacheFile);
+    auto cache = loadCacheFromFile(cacheFile);
+    setCache(cache);
 }
 
 
@@ -37,6 +42,9 @@ KMismatchSearch::KMismatchSearch(std::string textFile, std::string queriesFile,
 void KMismatchSearch::setText(std::string& textToSet)
 {
     this->text = textToSet;
+    this->documentStarts.clear();
+    this->index = PostingIndex();
+    this->fmIndex.reset();
 }
 
 const std::string& KMismatchSearch::getText() const
@@ -44,6 +52,24 @@ const std::string& KMismatchSearch::getText() const
     return text;
 }
 
+void KMismatchSearch::setCorpus(const Corpus& corpus)
+{
+    this->text = corpus.getText();
+    this->documentStarts = corpus.getStarts();
+    this->index = PostingIndex();
+    this->fmIndex.reset();
+}
+
+const std::vector<size_t>& KMismatchSearch::getDocumentStarts() const
+{
+    return documentStarts;
+}
+
+DocumentPosition KMismatchSearch::locate(size_t position) const
+{
+    return Corpus::locate(documentStarts, position);
+}
+
 void KMismatchSearch::setQueries(std::vector<std::string>& queriesToSet)
 {
     this->queries = queriesToSet;
@@ -54,9 +80,12 @@ const std::vector<std::string>& KMismatchSearch::getQueries() const
     return queries;
 }
 
-void KMismatchSearch::setMcs(MCS& mcsToSet)
+void KMismatchSearch::setMcs(MCS& mcsToSet, size_t builtForMismatches)
 {
     this->mcs = mcsToSet;
+    this->mcsMismatches = builtForMismatches;
+    this->lengthMcs.clear();
+    this->index = PostingIndex();
 }
 
  const MCS& KMismatchSearch::getMcs() const
@@ -66,12 +95,122 @@ void KMismatchSearch::setMcs(MCS& mcsToSet)
 
 void KMismatchSearch::setCache(std::map<std::string, std::set<size_t>>& cacheToSet)
 {
-    this->cache = cacheToSet;
+    // An empty cache leaves the index to be built by the next search
+    this->index = cacheToSet.empty() ? PostingIndex() : PostingIndex::fromMap(cacheToSet, mcs.getMcsForms());
 }
 
-const std::map<std::string, std::set<size_t>>& KMismatchSearch::getCache() const
+std::map<std::string, std::set<size_t>> KMismatchSearch::getCache() const
 {
-    return cache;
+    return index.toMap();
+}
+
+const PostingIndex& KMismatchSearch::getIndex() const
+{
+    return index;
+}
+
+void KMismatchSearch::buildLengthBucketsMcs(size_t misMatches)
+{
+    std::set<size_t> lengths;
+    for (auto& query : queries)
+        lengths.insert(query.size());
+
+    // Shorter buckets first, so that their forms, which fit in any longer query, join the pool early
+    std::vector<Form> pool;
+    this->lengthMcs.clear();
+    for (size_t length : lengths)
+        this->lengthMcs[length] = length < misMatches + 2 ? MCS() : MCS::buildMCSFromPool(length, misMatches, pool);
+
+    this->mcs = MCS(pool);
+    this->mcsMismatches = misMatches;
+    this->index = PostingIndex();
+}
+
+void KMismatchSearch::buildSelectivityAwareLengthBucketsMcs(size_t misMatches, size_t textSampleSize)
+{
+    std::map<size_t, std::vector<std::string>> lengthQueries;
+    for (auto& query : queries)
+        lengthQueries[query.size()].push_back(query);
+
+    std::string textSample = getTextSample(textSampleSize);
+    std::vector<Form> pool;
+    this->lengthMcs.clear();
+    for (auto& [length, bucketQueries] : lengthQueries)
+    {
+        MCS& bucketMcs = this->lengthMcs[length];
+        if (length < misMatches + 2)
+            continue;
+        bucketMcs = MCS::buildMCSSelectivityAware(bucketQueries, misMatches, textSample, text.size());
+        for (auto& form : bucketMcs.getMcsForms())
+            if (std::ranges::find(pool, form) == pool.end())
+                pool.push_back(form);
+    }
+
+    this->mcs = MCS(pool);
+    this->mcsMismatches = misMatches;
+    this->index = PostingIndex();
+}
+
+void KMismatchSearch::optimizeMcs(size_t misMatches, std::chrono::milliseconds timeLimit)
+{
+    if (!this->lengthMcs.empty())
+    {
+        size_t buckets = std::ranges::count_if(this->lengthMcs, [](auto& bucket) { return !bucket.second.getMcsForms().empty(); });
+        std::vector<Form> pool;
+        for (auto& [length, bucketMcs] : this->lengthMcs)
+        {
+            if (bucketMcs.getMcsForms().empty())
+                continue;
+            bucketMcs = MCS::optimize(bucketMcs, length, misMatches, timeLimit / buckets);
+            for (auto& form : bucketMcs.getMcsForms())
+                if (std::ranges::find(pool, form) == pool.end())
+                    pool.push_back(form);
+        }
+        this->mcs = MCS(pool);
+    }
+    else
+    {
+        // A cover of a length holds a cover of every window of a longer query, so the shortest length serves all
+        size_t length = 0;
+        for (auto& query : queries)
+            if (query.size() >= misMatches + 2 && (length == 0 || query.size() < length))
+                length = query.size();
+        if (length == 0)
+            return;
+        this->mcs = MCS::optimize(this->mcs, length, misMatches, timeLimit);
+    }
+    this->mcsMismatches = misMatches;
+    this->index = PostingIndex();
+}
+
+const std::map<size_t, MCS>& KMismatchSearch::getLengthMcs() const
+{
+    return lengthMcs;
+}
+
+void KMismatchSearch::setWildcards(const std::string& symbols)
+{
+    this->wildcards = Wildcards(symbols);
+}
+
+const Wildcards& KMismatchSearch::getWildcards() const
+{
+    return wildcards;
+}
+
+void KMismatchSearch::setSearchLimits(const SearchLimits& limits)
+{
+    this->searchLimits = limits;
+}
+
+const SearchLimits& KMismatchSearch::getSearchLimits() const
+{
+    return searchLimits;
+}
+
+const std::vector<QueryStatus>& KMismatchSearch::getLastQueryStatuses() const
+{
+    return lastQueryStatuses;
 }
 
 std::map<std::string, std::set<size_t>> KMismatchSearch::loadCacheFromFile(std::string& fileName) const
@@ -102,7 +241,7 @@ void KMismatchSearch::saveCacheToFile(std::string fileName)
     if (!file) {
         throw std::runtime_error("Unable to open file: " + fileName);
     }
-    for (auto& [key, values] : this->cache)
+    for (auto& [key, values] : getCache())
     {
         file << key << ';';
         for (size_t pos : values)
@@ -135,54 +274,672 @@ std::vector<std::string> KMismatchSearch::loadQueriesFromFile(std::string& filen
     return queries;
 }
 
+void KMismatchSearch::buildIndex()
+{
+    if (this->index.empty())
+    {
+        KMISMATCH_STATS_STAGE(StatsStage::IndexBuild);
+        KMISMATCH_TRACE_SPAN(indexSpan, "index_build", "index", static_cast<int64_t>(text.size()));
+        this->index = PostingIndex::build(text, mcs.getMcsForms(), documentStarts);
+    }
+
+    KMISMATCH_STATS(
+        SearchStats::set(StatsGauge::McsForms, mcs.getMcsForms().size());
+        SearchStats::set(StatsGauge::IndexKeys, this->index.getKeys());
+        SearchStats::set(StatsGauge::IndexPostings, this->index.getPostings()));
+}
+
 std::map<std::string, std::set<size_t>> KMismatchSearch::mcsSearch(size_t misMatches)
 {
-    std::mutex mtx;
+    return mcsSearch(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::mcsSearch(const std::vector<size_t>& misMatchesPerQuery)
+{
     std::map<std::string, std::set<size_t>> resultMap;
+    mcsSearchQueries(misMatchesPerQuery, false, ResultMode::All, 0,
+        [&](size_t queryIndex, const std::pmr::vector<size_t>& positions, const std::pmr::vector<size_t>&, QueryResult&)
+        {
+            resultMap[queries[queryIndex]].insert(positions.begin(), positions.end());
+        });
+    return resultMap;
+}
+
+std::map<std::string, QueryResult> KMismatchSearch::mcsSearch(size_t misMatches, ResultMode mode, size_t limit)
+{
+    return mcsSearch(std::vector<size_t>(queries.size(), misMatches), mode, limit);
+}
+
+std::map<std::string, QueryResult> KMismatchSearch::mcsSearch(const std::vector<size_t>& misMatchesPerQuery, ResultMode mode, size_t limit)
+{
+    if (mode == ResultMode::All)
+        throw std::runtime_error("The positions of every query are searched without a result mode!");
+    std::map<std::string, QueryResult> resultMap;
+    mcsSearchQueries(misMatchesPerQuery, false, mode, limit,
+        [&](size_t queryIndex, const std::pmr::vector<size_t>&, const std::pmr::vector<size_t>&, QueryResult& result)
+        {
+            // A query listed several times keeps one of its results
+            resultMap[queries[queryIndex]] = std::move(result);
+        });
+    return resultMap;
+}
 
-    if (this->cache.empty())
+std::map<std::string, std::set<std::pair<size_t, Strand>>> KMismatchSearch::mcsSearchBothStrands(size_t misMatches)
+{
+    return mcsSearchBothStrands(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<std::pair<size_t, Strand>>> KMismatchSearch::mcsSearchBothStrands(const std::vector<size_t>& misMatchesPerQuery)
+{
+    std::map<std::string, std::set<std::pair<size_t, Strand>>> resultMap;
+    mcsSearchQueries(misMatchesPerQuery, true, ResultMode::All, 0,
+        [&](size_t queryIndex, const std::pmr::vector<size_t>& forward, const std::pmr::vector<size_t>& reverse, QueryResult&)
+        {
+            auto& positions = resultMap[queries[queryIndex]];
+            for (size_t pos : forward)
+                positions.emplace(pos, Strand::Forward);
+            for (size_t pos : reverse)
+                positions.emplace(pos, Strand::Reverse);
+        });
+    return resultMap;
+}
+
+// Search state of a query of a probe batch, see KMismatchSearch::mcsSearchQueries.
+struct McsBatchQuery
+{
+    explicit McsBatchQuery(std::pmr::memory_resource* resource)
+        : positions(resource), reversePositions(resource), formCounters(resource)
+    {
+    }
+
+    size_t index = 0;  ///< Index of the query.
+    size_t misMatches = 0;  ///< Mismatch threshold of the query.
+    size_t threshold = 0;  ///< Mismatch threshold of the verifications, lowered by ResultMode::Best.
+    VerificationKernel kernel = nullptr;  ///< Verification kernel of the query.
+    const std::vector<Form>* forms = nullptr;  ///< Forms searched for the query.
+    size_t candidates = 0;  ///< Candidates verified.
+    size_t hits = 0;  ///< Successful verifications.
+    bool done = false;  ///< Whether the answer of the query is determined.
+    bool truncated = false;  ///< Whether the limits stopped the query.
+    bool scan = false;  ///< Whether every text position is checked instead of the index candidates.
+    std::pmr::vector<size_t> positions;  ///< Positions found with ResultMode::All.
+    std::pmr::vector<size_t> reversePositions;  ///< Positions of the reverse complement found with ResultMode::All.
+    std::pmr::vector<std::pair<size_t, size_t>> formCounters;  ///< Candidates and hits of every form.
+    QueryResult result;  ///< Result out of ResultMode::All.
+};
+
+// An index lookup of the MCS search: the key of a query window, or one of its expansions over the wildcards.
+struct McsProbe
+{
+    size_t keyOffset;  ///< Offset of the key in the keys of the batch.
+    uint32_t keySize;  ///< Size of the key.
+    uint32_t batchQuery;  ///< Index of the query in the batch.
+    uint32_t formIndex;  ///< Index of the form in the forms of the query.
+    uint32_t shift;  ///< Offset of the window in the query, or in its reverse complement, subtracted from the postings.
+    bool reverse;  ///< Whether the key is the one of the reverse complement.
+};
+
+void KMismatchSearch::mcsSearchQueries(const std::vector<size_t>& misMatchesPerQuery, bool bothStrands, ResultMode mode, size_t limit,
+    const QueryHitsHandler& onHits)
+{
+    std::mutex mtx;
+    constexpr size_t NO_WINDOW = std::numeric_limits<size_t>::max();  // Window of the candidates found without the index
+
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+    for (size_t i = 0; i < queries.size(); i++)
     {
-        std::vector<size_t> indices(text.size());
-        std::iota(indices.begin(), indices.end(), 0);
-        std::for_each(std::execution::par, indices.begin(), indices.end(),
-            [&](size_t pos) 
+        if (misMatchesPerQuery[i] > mcsMismatches)
+            throw std::runtime_error("Mismatch number can not be greater than the mismatches the MCS was built for!");
+        if (misMatchesPerQuery[i] > queries[i].size())
+            throw std::runtime_error("Mismatch number can not be greater than query length!");
+    }
+    if (bothStrands && !wildcards.empty())
+        throw std::runtime_error("Wildcards are not supported by the search of both strands!");
+    if ((mode == ResultMode::First || mode == ResultMode::Best) && limit == 0)
+        throw std::runtime_error("The number of hits of the result mode must be positive!");
+
+    buildIndex();
+    this->lastQueryStatuses.assign(queries.size(), QueryStatus::NotStarted);
+    bool timeBounded = searchLimits.cancelled || searchLimits.deadline != std::chrono::steady_clock::time_point::max();
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "mcs_search", "search", static_cast<int64_t>(queries.size()));
+
+    // Identical queries with the same threshold are searched once, the first of them answering for the others.
+    // The searched queries are taken in lexicographic order, so that near-duplicates share the keys of a batch
+    std::vector<size_t> order(queries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(std::execution::par, order.begin(), order.end(), [&](size_t a, size_t b)
+        { return std::tie(queries[a], misMatchesPerQuery[a]) < std::tie(queries[b], misMatchesPerQuery[b]); });
+    std::vector<std::vector<size_t>> duplicates(queries.size());
+    std::vector<size_t> searchedQueries;
+    for (size_t i = 0; i < order.size(); i++)
+        if (i > 0 && queries[order[i]] == queries[searchedQueries.back()] && misMatchesPerQuery[order[i]] == misMatchesPerQuery[searchedQueries.back()])
+            duplicates[searchedQueries.back()].push_back(order[i]);
+        else
+            searchedQueries.push_back(order[i]);
+    KMISMATCH_STATS(SearchStats::add(StatsCounter::DuplicateQueries, queries.size() - searchedQueries.size()));
+
+    // Queries grouped by length bucket, every bucket is searched with its own MCS
+    std::map<size_t, std::vector<size_t>> lengthBuckets;
+    for (size_t i : searchedQueries)
+        lengthBuckets[lengthMcs.empty() ? 0 : queries[i].size()].push_back(i);
+
+    // The forms searched for every (length bucket, query length, mismatches) triple, a subset of the bucket MCS for
+    // thresholds below the mismatches it was built for. The subset covers the combinations of one query length, so
+    // a single MCS shared by queries of several lengths takes one per length. An MCS of unknown mismatches, such as
+    // a loaded one, is searched as it is
+    std::map<std::tuple<size_t, size_t, size_t>, std::vector<Form>> bucketForms;
+    for (auto& [bucketLength, queryIndices] : lengthBuckets)
+        for (size_t i : queryIndices)
+        {
+            auto key = std::make_tuple(bucketLength, queries[i].size(), misMatchesPerQuery[i]);
+            if (bucketForms.contains(key))
+                continue;
+            auto bucketMcs = lengthMcs.find(bucketLength);
+            const MCS& formsMcs = bucketMcs == lengthMcs.end() ? mcs : bucketMcs->second;
+            if (mcsMismatches != UNKNOWN_MISMATCHES && misMatchesPerQuery[i] < mcsMismatches
+                && queries[i].size() >= misMatchesPerQuery[i] + 2)
+                bucketForms[key] = formsMcs.subsetForMismatches(queries[i].size(), misMatchesPerQuery[i]).getMcsForms();
+            else
+                bucketForms[key] = formsMcs.getMcsForms();
+        }
+
+    // Index keys are read from the text, so a query wildcard on a sampled position is expanded over the other text
+    // symbols, and the alignments overlapping a text wildcard, whose keys hold it, are verified directly
+    std::string textSymbols;
+    std::vector<std::pair<size_t, size_t>> textWildcardRuns;
+    if (!wildcards.empty())
+    {
+        std::array<bool, 256> seen{};
+        for (size_t pos = 0; pos < text.size(); pos++)
+            if (!wildcards.contains(text[pos]))
             {
-                std::map<std::string, std::vector<size_t>> localFormMap;
-                for (auto& form : mcs.getMcsForms())
-                    if (pos + form.getSize() <= text.size())
+                if (!seen[static_cast<unsigned char>(text[pos])])
+                    textSymbols.push_back(text[pos]);
+                seen[static_cast<unsigned char>(text[pos])] = true;
+            }
+            else if (!textWildcardRuns.empty() && textWildcardRuns.back().second == pos)
+                textWildcardRuns.back().second++;
+            else
+                textWildcardRuns.emplace_back(pos, pos + 1);
+    }
+
+    std::atomic<size_t> candidatesCount = 0;
+    std::for_each(std::execution::par, lengthBuckets.begin(), lengthBuckets.end(),
+        [&](auto& lengthBucket)
+        {
+            KMISMATCH_TRACE_SPAN(bucketSpan, "length_bucket", "search", static_cast<int64_t>(lengthBucket.first));
+            auto bucketMcs = lengthMcs.find(lengthBucket.first);
+            // Queries too short for an MCS are checked on every text position
+            bool scanText = bucketMcs != lengthMcs.end() && bucketMcs->second.getMcsForms().empty() && lengthBucket.first > 0;
+
+            // Batches of queries whose probes are grouped by key, so that a key probed by several windows is looked
+            // up once and its postings are walked once for all of them, at least four batches per hardware thread
+            size_t batchQueriesCount = std::clamp<size_t>(lengthBucket.second.size() / (4 * std::max(1u, std::thread::hardware_concurrency())),
+                1, PROBE_BATCH_QUERIES);
+            std::vector<std::pair<size_t, size_t>> batches;
+            for (size_t first = 0; first < lengthBucket.second.size(); first += batchQueriesCount)
+                batches.emplace_back(first, std::min(first + batchQueriesCount, lengthBucket.second.size()));
+
+            std::for_each(std::execution::par, batches.begin(), batches.end(),
+                [&](std::pair<size_t, size_t> batch)
+                {
+                    KMISMATCH_TRACE_SPAN(batchSpan, "query_batch", "search", static_cast<int64_t>(lengthBucket.second[batch.first]));
+                    if (timeBounded && searchLimits.reached())
+                        return;
+                    ScratchArena arena;
+                    std::pmr::vector<McsBatchQuery> batchQueries(arena.resource());
+                    batchQueries.reserve(batch.second - batch.first);
+                    for (size_t i = batch.first; i < batch.second; i++)
                     {
-                        std::string cur_str = form.getStringFromPosition(text, pos);
-                        localFormMap[cur_str].push_back(pos);
+                        McsBatchQuery& state = batchQueries.emplace_back(arena.resource());
+                        state.index = lengthBucket.second[i];
+                        state.misMatches = misMatchesPerQuery[state.index];
+                        state.threshold = state.misMatches;
+                        state.kernel = selectVerificationKernel(queries[state.index].size(), state.misMatches);
+                        state.forms = &bucketForms.at({ lengthBucket.first, queries[state.index].size(), state.misMatches });
+                        state.formCounters.resize(state.forms->size());
+                        state.scan = scanText || queries[state.index].empty();
                     }
-                std::lock_guard<std::mutex> lock(mtx);
-                for (auto& [str, value] : localFormMap)
-                {
-                    this->cache[str].insert(value.begin(), value.end());
-                }  
-            });
+                    std::pmr::vector<size_t> mismatchOffsets(arena.resource());
+
+                    // Whether another candidate of a query may be verified, the query stopping at its budget or at the
+                    // limits of the search
+                    auto withinLimits = [&](McsBatchQuery& state)
+                    {
+                        if ((searchLimits.candidateBudget && state.candidates >= searchLimits.candidateBudget)
+                            || (timeBounded && state.candidates % LIMITS_CHECK_INTERVAL == 0 && searchLimits.reached()))
+                            state.truncated = state.done = true;
+                        return !state.truncated;
+                    };
+
+                    // Whether a window before the window qPos of forms[formIndex] finds an alignment with the mismatches
+                    // at mismatchOffsets, none of the sampled positions of a finding window being a mismatch.
+                    // The alignments overlapping a text wildcard are verified directly, before any window
+                    auto foundEarlier = [&](const McsBatchQuery& state, size_t pos, size_t formIndex, size_t qPos)
+                    {
+                        const std::vector<Form>& forms = *state.forms;
+                        size_t querySize = queries[state.index].size();
+                        auto run = std::ranges::upper_bound(textWildcardRuns, pos, {}, &std::pair<size_t, size_t>::second);
+                        if (run != textWildcardRuns.end() && run->first < pos + querySize)
+                            return true;
+                        for (size_t f = 0; f <= formIndex; f++)
+                            for (size_t w = 0; w + forms[f].getSize() <= querySize && (f < formIndex || w < qPos); w++)
+                                if (std::ranges::none_of(mismatchOffsets, [&](size_t offset)
+                                    { return offset >= w && offset < w + forms[f].getSize() && forms[f].samples(offset - w); }))
+                                    return true;
+                        return false;
+                    };
+
+                    // Verifies a candidate of a query and records it in the result mode. Out of ResultMode::All, a
+                    // candidate of the window qPos of forms[formIndex] is recorded by the first window finding it only,
+                    // which does not depend on the order of the probes, so duplicates are skipped without storing the positions
+                    auto verifyCandidate = [&](McsBatchQuery& state, size_t pos, size_t formIndex, size_t qPos)
+                    {
+                        if (!withinLimits(state))
+                            return;
+                        const std::string& query = queries[state.index];
+                        state.candidates++;
+                        if (formIndex != NO_WINDOW)
+                            state.formCounters[formIndex].first++;
+                        if (mode == ResultMode::All)
+                        {
+                            if (verifyOnPosition(state.kernel, query, pos, state.misMatches))
+                            {
+                                state.positions.push_back(pos);
+                                state.hits++;
+                                if (formIndex != NO_WINDOW)
+                                    state.formCounters[formIndex].second++;
+                            }
+                            return;
+                        }
+                        // Specialized kernels have their threshold built in
+                        if (!verifyOnPosition(state.threshold == state.misMatches ? state.kernel : verifyGeneric, query, pos, state.threshold))
+                            return;
+                        mismatchOffsets.clear();
+                        for (size_t i = 0; i < query.size(); i++)
+                            if (text[pos + i] != query[i] && !wildcards.contains(text[pos + i]) && !wildcards.contains(query[i]))
+                                mismatchOffsets.push_back(i);
+                        if (formIndex != NO_WINDOW && foundEarlier(state, pos, formIndex, qPos))
+                            return;
+                        state.hits++;
+                        if (formIndex != NO_WINDOW)
+                            state.formCounters[formIndex].second++;
+                        QueryResult& result = state.result;
+                        switch (mode)
+                        {
+                        case ResultMode::Exists:
+                            result.count = 1;
+                            state.done = true;
+                            break;
+                        case ResultMode::Count:
+                            result.count++;
+                            break;
+                        case ResultMode::First:
+                            result.hits.emplace_back(pos, mismatchOffsets.size());
+                            state.done = result.hits.size() == limit;
+                            break;
+                        default:
+                            // Max-heap of the kept hits by mismatches, the threshold excluding the worst once it is full
+                            result.hits.emplace_back(pos, mismatchOffsets.size());
+                            std::ranges::push_heap(result.hits, {}, &std::pair<size_t, size_t>::second);
+                            if (result.hits.size() > limit)
+                            {
+                                std::ranges::pop_heap(result.hits, {}, &std::pair<size_t, size_t>::second);
+                                result.hits.pop_back();
+                            }
+                            if (result.hits.size() == limit)
+                            {
+                                size_t worst = result.hits.front().second;
+                                state.done = worst == 0;
+                                state.threshold = state.done ? 0 : worst - 1;
+                            }
+                        }
+                    };
+
+                    // Verifies the reverse complement of a query at a candidate
+                    auto verifyReverseCandidate = [&](McsBatchQuery& state, size_t pos, size_t formIndex)
+                    {
+                        if (!withinLimits(state))
+                            return;
+                        state.candidates++;
+                        if (formIndex != NO_WINDOW)
+                            state.formCounters[formIndex].first++;
+                        if (!verifyOnPosition(verifyReverseComplement, queries[state.index], pos, state.misMatches))
+                            return;
+                        state.reversePositions.push_back(pos);
+                        state.hits++;
+                        if (formIndex != NO_WINDOW)
+                            state.formCounters[formIndex].second++;
+                    };
+
+                    // The alignments overlapping a text wildcard, verified directly
+                    for (McsBatchQuery& state : batchQueries)
+                    {
+                        size_t querySize = queries[state.index].size();
+                        size_t next = 0;
+                        for (auto [begin, end] : textWildcardRuns)
+                            for (size_t pos = std::max(next, begin + 1 >= querySize ? begin + 1 - querySize : 0); pos < end && !state.done && !state.scan; pos++)
+                            {
+                                verifyCandidate(state, pos, NO_WINDOW, 0);
+                                next = pos + 1;
+                            }
+                    }
+
+                    // The probes of every window of every query, a query wildcard on a sampled position being expanded
+                    // into a probe per text symbol. The keys are stored one after the other
+                    KMISMATCH_STATS_LAP_TIMER(lapTimer);
+                    std::pmr::string keys(arena.resource());
+                    std::pmr::vector<McsProbe> probes(arena.resource());
+                    std::pmr::vector<size_t> wildcardSlots(arena.resource());
+                    std::string key;
+                    std::string reverseKey;
+                    auto addProbe = [&](const std::string& probeKey, uint32_t batchQuery, size_t formIndex, size_t shift, bool reverse)
+                    {
+                        probes.push_back({ keys.size(), static_cast<uint32_t>(probeKey.size()), batchQuery,
+                            static_cast<uint32_t>(formIndex), static_cast<uint32_t>(shift), reverse });
+                        keys.append(probeKey);
+                    };
+                    for (uint32_t b = 0; b < batchQueries.size(); b++)
+                    {
+                        McsBatchQuery& state = batchQueries[b];
+                        const std::string& query = queries[state.index];
+                        size_t querySize = query.size();
+                        size_t probesStart = probes.size();
+                        size_t keysStart = keys.size();
+                        for (size_t formIndex = 0; formIndex < state.forms->size() && !state.scan && !state.done; formIndex++)
+                        {
+                            const Form& form = (*state.forms)[formIndex];
+                            size_t formSize = form.getSize();
+                            key.assign(formSize, '_');
+                            reverseKey.assign(formSize, '_');
+                            for (size_t qPos = 0; qPos + formSize <= querySize; qPos++)
+                            {
+                                if (bothStrands)
+                                {
+                                    // The reverse complement key is the one of the mirrored window of the reverse complement
+                                    form.fillStrandKeysFromPosition(query, qPos, key.data(), reverseKey.data());
+                                    addProbe(reverseKey, b, formIndex, querySize - qPos - formSize, true);
+                                }
+                                else
+                                    form.fillStringFromPosition(query, qPos, key.data());
+                                wildcardSlots.clear();
+                                for (size_t i = 0; i < formSize && !wildcards.empty(); i++)
+                                    if (form.samples(i) && wildcards.contains(query[qPos + i]))
+                                        wildcardSlots.push_back(i);
+                                if (wildcardSlots.empty())
+                                {
+                                    addProbe(key, b, formIndex, qPos, false);
+                                    continue;
+                                }
+                                size_t expansions = 1;
+                                for (size_t j = 0; j < wildcardSlots.size() && expansions <= MAX_WILDCARD_EXPANSIONS; j++)
+                                    expansions *= textSymbols.size();
+                                if (expansions > MAX_WILDCARD_EXPANSIONS)
+                                {
+                                    state.scan = true;
+                                    break;
+                                }
+                                // Every text symbol on every wildcard slot, the expansion number read in base textSymbols.size()
+                                for (size_t expansion = 0; expansion < expansions; expansion++)
+                                {
+                                    for (size_t j = 0, rest = expansion; j < wildcardSlots.size(); j++, rest /= textSymbols.size())
+                                        key[wildcardSlots[j]] = textSymbols[rest % textSymbols.size()];
+                                    addProbe(key, b, formIndex, qPos, false);
+                                }
+                            }
+                            KMISMATCH_STATS(SearchStats::add(StatsCounter::Lookups, (querySize >= formSize ? querySize - formSize + 1 : 0) * (bothStrands ? 2 : 1)));
+                        }
+                        if (state.scan)
+                        {
+                            probes.resize(probesStart);
+                            keys.resize(keysStart);
+                        }
+                    }
+
+                    // The probes sorted by key, every group of equal keys resolved by one read-only lookup
+                    auto keyOf = [&](const McsProbe& probe) { return std::string_view(keys.data() + probe.keyOffset, probe.keySize); };
+                    std::ranges::sort(probes, {}, keyOf);
+                    std::pmr::vector<std::pair<size_t, std::span<const size_t>>> groups(arena.resource());
+                    for (size_t p = 0; p < probes.size(); p++)
+                        if (p == 0 || keyOf(probes[p]) != keyOf(probes[p - 1]))
+                        {
+                            const Form& form = (*batchQueries[probes[p].batchQuery].forms)[probes[p].formIndex];
+                            const PostingIndex::Table* table = this->index.findTable(form);
+                            groups.emplace_back(p, table ? table->find(keyOf(probes[p])) : std::span<const size_t>());
+                        }
+                    KMISMATCH_STATS(SearchStats::add(StatsCounter::SharedLookups, probes.size() - groups.size()));
+                    KMISMATCH_STATS_LAP(lapTimer, StatsStage::Lookup);
+
+                    // The postings of every group are walked once, every candidate being verified for the probes of the
+                    // group whose query is not done. The first postings of a group a few groups ahead are prefetched
+                    for (size_t g = 0; g < groups.size(); g++)
+                    {
+                        if (g + PROBE_PREFETCH_DISTANCE < groups.size() && !groups[g + PROBE_PREFETCH_DISTANCE].second.empty())
+                            _mm_prefetch(reinterpret_cast<const char*>(groups[g + PROBE_PREFETCH_DISTANCE].second.data()), _MM_HINT_T0);
+                        auto [first, postings] = groups[g];
+                        size_t last = g + 1 < groups.size() ? groups[g + 1].first : probes.size();
+                        bool active = true;
+                        for (auto pos = postings.begin(); pos != postings.end() && active; ++pos)
+                        {
+                            active = false;
+                            for (size_t p = first; p < last; p++)
+                            {
+                                const McsProbe& probe = probes[p];
+                                McsBatchQuery& state = batchQueries[probe.batchQuery];
+                                if (state.done)
+                                    continue;
+                                active = true;
+                                if (probe.reverse)
+                                    verifyReverseCandidate(state, *pos - probe.shift, probe.formIndex);
+                                else
+                                    verifyCandidate(state, *pos - probe.shift, probe.formIndex, probe.shift);
+                            }
+                        }
+                    }
+                    KMISMATCH_STATS_LAP(lapTimer, StatsStage::Verification);
+
+                    for (McsBatchQuery& state : batchQueries)
+                    {
+                        // Empty queries, queries too short for an MCS or with too many wildcard expansions, are checked on every text position
+                        if (state.scan && !state.truncated)
+                        {
+                            state.positions.clear();
+                            state.result = QueryResult();
+                            state.threshold = state.misMatches;
+                            state.done = false;
+                            for (size_t pos = 0; pos < text.size() && !state.done; pos++)
+                            {
+                                verifyCandidate(state, pos, NO_WINDOW, 0);
+                                if (bothStrands && !state.truncated
+                                    && verifyOnPosition(verifyReverseComplement, queries[state.index], pos, state.misMatches))
+                                {
+                                    state.reversePositions.push_back(pos);
+                                    state.hits++;
+                                }
+                            }
+                        }
+
+                        QueryResult& result = state.result;
+                        if (mode == ResultMode::First)
+                            std::ranges::sort(result.hits);
+                        else if (mode == ResultMode::Best)
+                            std::ranges::sort(result.hits, {}, [](auto& hit) { return std::make_pair(hit.second, hit.first); });
+                        if (mode == ResultMode::First || mode == ResultMode::Best)
+                            result.count = result.hits.size();
+                        KMISMATCH_STATS(
+                            for (size_t formIndex = 0; formIndex < state.forms->size(); formIndex++)
+                            {
+                                auto [formCandidates, formHits] = state.formCounters[formIndex];
+                                SearchStats::addFormCounters((*state.forms)[formIndex], { formCandidates, formCandidates, formHits });
+                            }
+                            SearchStats::add(StatsCounter::Queries, 1);
+                            SearchStats::add(StatsCounter::Candidates, state.candidates);
+                            SearchStats::add(StatsCounter::Verifications, state.candidates);
+                            SearchStats::add(StatsCounter::Hits, state.hits));
+                        candidatesCount += state.candidates;
+                        QueryStatus status = state.truncated ? QueryStatus::Truncated : QueryStatus::Complete;
+                        this->lastQueryStatuses[state.index] = status;
+                        for (size_t duplicate : duplicates[state.index])
+                            this->lastQueryStatuses[duplicate] = status;
+                        if (state.positions.empty() && state.reversePositions.empty() && result.count == 0)
+                            continue;
+                        std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+                        {
+                            KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(state.index), SearchTrace::LOCK_WAIT_MIN_NS);
+                            lock.lock();
+                        }
+                        // The duplicates get copies of the result, which the handler may take
+                        for (size_t duplicate : duplicates[state.index])
+                        {
+                            QueryResult duplicateResult = result;
+                            onHits(duplicate, state.positions, state.reversePositions, duplicateResult);
+                        }
+                        onHits(state.index, state.positions, state.reversePositions, result);
+                    }
+                });
+        });
+    this->lastCandidatesCount = candidatesCount;
+}
+
+std::vector<std::pair<size_t, size_t>> KMismatchSearch::splitQuery(size_t queryLength, size_t segments)
+{
+    std::vector<std::pair<size_t, size_t>> querySegments;
+    size_t offset = 0;
+    for (size_t i = 0; i < segments; ++i)
+    {
+        // The first queryLength % segments segments are longer by one
+        size_t segmentLength = queryLength / segments + (i < queryLength % segments ? 1 : 0);
+        querySegments.emplace_back(offset, segmentLength);
+        offset += segmentLength;
     }
+    return querySegments;
+}
+
+MCS KMismatchSearch::segmentMcs(const std::vector<std::string>& queries, size_t misMatches, size_t segments)
+{
+    segments = std::max(segments, misMatches + 1);
+
+    size_t formWeight = MAX_SEGMENT_MCS_LENGTH;
+    for (auto& query : queries)
+        formWeight = std::min(formWeight, query.size() / segments);
+    if (formWeight == 0)
+        throw std::runtime_error("Queries are too short to be split into " + std::to_string(segments) + " segments!");
+
+    return MCS({ Form((static_cast<kMismatchIntegerType::uint_type>(1) << formWeight) - 1) });
+}
+
+void KMismatchSearch::buildSegmentMcs(size_t misMatches, size_t segments)
+{
+    this->mcs = segmentMcs(queries, misMatches, segments);
+    this->mcsMismatches = UNKNOWN_MISMATCHES;
+    this->lengthMcs.clear();
+    this->index = PostingIndex();
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::segmentSearch(size_t misMatches, size_t segments)
+{
+    std::mutex mtx;
+    std::map<std::string, std::set<size_t>> resultMap;
+    segments = std::max(segments, misMatches + 1);
+    if (!wildcards.empty())
+        throw std::runtime_error("Wildcards are only supported by the MCS and naive searches!");
+
+    // The segment without mismatches is only found by a contiguous form no longer than the shortest segment
+    size_t shortestSegment = std::numeric_limits<size_t>::max();
+    for (auto& query : queries)
+        shortestSegment = std::min(shortestSegment, query.size() / segments);
+    auto& forms = mcs.getMcsForms();
+    if (std::none_of(forms.begin(), forms.end(), [&](const Form& form)
+        {
+            if (form.getSize() == 0 || form.getSize() > shortestSegment)
+                return false;
+            for (size_t i = 0; i < form.getSize(); i++)
+                if (!form.samples(i))
+                    return false;
+            return true;
+        }))
+        throw std::runtime_error("The MCS has no contiguous form of at most " + std::to_string(shortestSegment)
+            + " positions, the length of the shortest query segment!");
+
+    buildIndex();
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "segment_search", "search", static_cast<int64_t>(queries.size()));
 
+    std::atomic<size_t> candidatesCount = 0;
     std::for_each(std::execution::par, queries.begin(), queries.end(),
-        [&](std::string& query)
+        [&](const std::string& query)
         {
-            size_t querySize = query.size();
-            std::map<std::string, std::vector<size_t>> localResultMap;
-            for (auto& form : mcs.getMcsForms())
+            KMISMATCH_TRACE_SPAN(querySpan, "query", "search", static_cast<int64_t>(&query - queries.data()));
+            // Start positions of the full query implied by the segment hits
+            ScratchArena arena;
+            std::pmr::vector<size_t> candidates(arena.resource());
+            for (auto& [offset, segmentLength] : splitQuery(query.size(), segments))
+                for (auto& form : mcs.getMcsForms())
+                {
+                    const PostingIndex::Table* table = this->index.findTable(form);
+                    if (!table)
+                        throw std::runtime_error("The index does not hold the forms of the MCS!");
+                    for (size_t qPos = offset; qPos + form.getSize() <= offset + segmentLength; qPos++)
+                    {
+                        KMISMATCH_STATS(SearchStats::add(StatsCounter::Lookups, 1));
+                        for (size_t pos : table->find(form.getStringFromPosition(query, qPos)))
+                            if (pos >= qPos)
+                                candidates.push_back(pos - qPos);
+                    }
+                }
+
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            candidatesCount += candidates.size();
+
+            std::pmr::vector<size_t> positions(arena.resource());
+            VerificationKernel kernel = selectVerificationKernel(query.size(), misMatches);
+            for (size_t candidate : candidates)
+                if (verifyOnPosition(kernel, query, candidate, misMatches))
+                    positions.push_back(candidate);
+            KMISMATCH_STATS(
+                SearchStats::add(StatsCounter::Queries, 1);
+                SearchStats::add(StatsCounter::Candidates, candidates.size());
+                SearchStats::add(StatsCounter::Verifications, candidates.size());
+                SearchStats::add(StatsCounter::Hits, positions.size()));
+
+            if (positions.empty())
+                return;
+            std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
             {
-                size_t formSize = form.getSize();
-                for (size_t qPos = 0; qPos + formSize <= querySize; qPos++)
-                    for (size_t pos : this->cache[form.getStringFromPosition(query, qPos)])
-                        if (CheckQueryOnPosition(query, pos - qPos, misMatches))
-                            localResultMap[query].push_back(pos - qPos);
+                KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(&query - queries.data()), SearchTrace::LOCK_WAIT_MIN_NS);
+                lock.lock();
             }
-            std::lock_guard<std::mutex> lock(mtx);
-            for (auto& [str, value] : localResultMap)
-                resultMap[str].insert(value.begin(), value.end());
+            resultMap[query].insert(positions.begin(), positions.end());
         });
+    this->lastCandidatesCount = candidatesCount;
 
     return resultMap;
 }
 
+std::string KMismatchSearch::getTextSample(size_t sampleSize) const
+{
+    if (text.size() <= sampleSize)
+        return text;
+
+    // Take evenly spaced blocks so that local low-complexity regions are represented proportionally
+    const size_t blocks = 64;
+    size_t blockSize = std::max<size_t>(sampleSize / blocks, 1);
+    size_t stride = text.size() / blocks;
+    std::string sample;
+    sample.reserve(sampleSize);
+    for (size_t start = 0; start + blockSize <= text.size() && sample.size() + blockSize <= sampleSize; start += stride)
+        sample.append(text, start, blockSize);
+    return sample;
+}
+
+size_t KMismatchSearch::getLastCandidatesCount() const
+{
+    return lastCandidatesCount;
+}
+
 
 bool KMismatchSearch::CheckQueryOnPosition(const std::string& query, int64_t position, size_t misMatches) const
 {
@@ -197,61 +954,418 @@ bool KMismatchSearch::CheckQueryOnPosition(const std::string& query, int64_t pos
     if (position < 0 || position + queryLen > text.size())
         return false;
 
+    // The rare matches are checked against the document boundaries, not every candidate
+    if (!wildcards.empty())
+        return verifyWithWildcards(text.data() + position, query.data(), queryLen, misMatches, wildcards)
+            && Corpus::withinDocument(documentStarts, position, queryLen);
+    return verifyGeneric(text.data() + position, query.data(), queryLen, misMatches)
+        && Corpus::withinDocument(documentStarts, position, queryLen);
+}
 
-    const char* textPtr = text.data() + position;
-    const char* queryPtr = query.data();
-
-    size_t i = 0;
-
-     //Use AVX2 to compare 32 bytes (characters) at a time
-     while (AVX2Support && i + 32 <= queryLen)
-     {
-         __m256i textChunk = _mm256_loadu_si256((__m256i*)(textPtr + i));
-         __m256i queryChunk = _mm256_loadu_si256((__m256i*)(queryPtr + i));
-         __m256i diff = _mm256_xor_si256(textChunk, queryChunk);
-
-         if (!_mm256_testz_si256(diff, diff))
-         {
-             size_t mask = _mm256_movemask_epi8(diff);
-             size_t numMismatches = popcount(mask);
-
-             if (numMismatches > misMatches)
-                 return false;
-
-             misMatches -= numMismatches;
-         }
-
-         i += 32;
-     }
-
-    // Handle any remaining characters
-    for (; i < queryLen; ++i)
-        if (queryPtr[i] != textPtr[i])
-            if (misMatches-- == 0)
-                return false;
-
-    return true;
+bool KMismatchSearch::verifyOnPosition(VerificationKernel kernel, const std::string& query, int64_t position, size_t misMatches) const
+{
+    if (position < 0 || position + query.size() > text.size())
+        return false;
+    if (!wildcards.empty())
+        return verifyWithWildcards(text.data() + position, query.data(), query.size(), misMatches, wildcards)
+            && Corpus::withinDocument(documentStarts, position, query.size());
+    return kernel(text.data() + position, query.data(), query.size(), misMatches)
+        && Corpus::withinDocument(documentStarts, position, query.size());
 }
 
 std::map<std::string, std::set<size_t>> KMismatchSearch::naiveSearch(size_t misMatches)
+{
+    return naiveSearch(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::naiveSearch(const std::vector<size_t>& misMatchesPerQuery)
 {
     std::map<std::string, std::set<size_t>> resultMap;
     std::mutex mtx;
     std::vector<size_t> indices(text.size());
     std::iota(indices.begin(), indices.end(), 0);
 
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+
+    // The verification kernel of every query, picked once for the whole scan
+    std::vector<VerificationKernel> kernels;
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        if (misMatchesPerQuery[q] > queries[q].size())
+            throw std::runtime_error("Mismatch number can not be greater than query length!");
+        kernels.push_back(selectVerificationKernel(queries[q].size(), misMatchesPerQuery[q]));
+    }
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "naive_search", "search", static_cast<int64_t>(queries.size()));
+
+    // Once the limits are reached, the remaining positions are skipped and every query is truncated
+    bool timeBounded = searchLimits.cancelled || searchLimits.deadline != std::chrono::steady_clock::time_point::max();
+    std::atomic<bool> stopped = false;
     std::for_each(std::execution::par, indices.begin(), indices.end(),
         [&](size_t i) {
-            for (const auto& query : this->queries)
-                if (CheckQueryOnPosition(query, i, misMatches)) 
-                {
-                    // Lock before modifying shared data
-                    std::lock_guard<std::mutex> lock(mtx);
-                    resultMap[query].insert(i);
-                }
+            if (stopped.load(std::memory_order_relaxed))
+                return;
+            if (timeBounded && i % LIMITS_CHECK_INTERVAL == 0 && searchLimits.reached())
+            {
+                stopped = true;
+                return;
+            }
+            ScratchArena arena;
+            std::pmr::vector<size_t> matchedQueries(arena.resource());
+            for (size_t q = 0; q < this->queries.size(); q++)
+                if (verifyOnPosition(kernels[q], this->queries[q], i, misMatchesPerQuery[q]))
+                    matchedQueries.push_back(q);
+            if (matchedQueries.empty())
+                return;
+
+            // Lock once per position before modifying shared data
+            std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+            {
+                KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(i), SearchTrace::LOCK_WAIT_MIN_NS);
+                lock.lock();
+            }
+            for (size_t q : matchedQueries)
+                resultMap[this->queries[q]].insert(i);
         }
     );
+    KMISMATCH_STATS(
+        size_t hits = 0;
+        for (auto& [query, positions] : resultMap)
+            hits += positions.size();
+        SearchStats::add(StatsCounter::Queries, queries.size());
+        SearchStats::add(StatsCounter::Verifications, text.size() * queries.size());
+        SearchStats::add(StatsCounter::Hits, hits));
+    this->lastQueryStatuses.assign(queries.size(), stopped ? QueryStatus::Truncated : QueryStatus::Complete);
     
     return resultMap;
 }
 
+
+size_t KMismatchSearch::fftBlockSize(size_t longestQuery, size_t textSize)
+{
+    size_t blockSize = std::max(MIN_FFT_BLOCK_SIZE, std::bit_ceil(FFT_BLOCK_QUERY_RATIO * std::max<size_t>(longestQuery, 1)));
+    blockSize = std::min(blockSize, std::max(std::bit_ceil(std::max<size_t>(textSize, 1)), std::bit_ceil(longestQuery)));
+    if (blockSize > NumberTheoreticTransform::MAX_SIZE)
+        throw std::runtime_error("Queries are too long for the FFT search!");
+    return blockSize;
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::fftSearch(size_t misMatches)
+{
+    return fftSearch(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::fftSearch(const std::vector<size_t>& misMatchesPerQuery)
+{
+    std::map<std::string, std::set<size_t>> resultMap;
+    std::mutex mtx;
+
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+    if (!wildcards.empty())
+        throw std::runtime_error("Wildcards are only supported by the MCS and naive searches!");
+
+    // Queries that fit in the text, and the symbols they use
+    std::vector<size_t> searchedQueries;
+    std::string alphabet;
+    size_t longestQuery = 0;
+    size_t shortestQuery = text.size();
+    bool emptyQuery = false;
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        if (misMatchesPerQuery[q] > queries[q].size())
+            throw std::runtime_error("Mismatch number can not be greater than query length!");
+        emptyQuery = emptyQuery || queries[q].empty();
+        if (queries[q].empty() || queries[q].size() > text.size())
+            continue;
+        searchedQueries.push_back(q);
+        longestQuery = std::max(longestQuery, queries[q].size());
+        shortestQuery = std::min(shortestQuery, queries[q].size());
+        for (char symbol : queries[q])
+            if (alphabet.find(symbol) == std::string::npos)
+                alphabet.push_back(symbol);
+    }
+    // An empty query has no transform and matches at every text position, as in the naive search
+    if (emptyQuery)
+        for (size_t pos = 0; pos < text.size(); pos++)
+            if (Corpus::withinDocument(documentStarts, pos, 0))
+                resultMap[""].insert(pos);
+    if (searchedQueries.empty())
+        return resultMap;
+
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "fft_search", "search", static_cast<int64_t>(searchedQueries.size()));
+
+    size_t blockSize = fftBlockSize(longestQuery, text.size());
+    NumberTheoreticTransform transform(blockSize);
+
+    // Transforms of the reversed symbol indicators of every query, shared by all text blocks.
+    // Correlating the text with the query is convolving it with the reversed query, so the matches
+    // of the alignment at offset p of a block are at index p + m - 1 of the convolution.
+    std::vector<std::vector<uint32_t>> queryTransforms(searchedQueries.size());
+    std::for_each(std::execution::par, queryTransforms.begin(), queryTransforms.end(),
+        [&](std::vector<uint32_t>& queryTransform)
+        {
+            const std::string& query = queries[searchedQueries[&queryTransform - queryTransforms.data()]];
+            queryTransform.assign(alphabet.size() * blockSize, 0);
+            for (size_t s = 0; s < alphabet.size(); s++)
+            {
+                uint32_t* symbolTransform = queryTransform.data() + s * blockSize;
+                for (size_t j = 0; j < query.size(); j++)
+                    symbolTransform[query.size() - 1 - j] = query[j] == alphabet[s];
+                transform.forward(symbolTransform);
+            }
+        });
+
+    // Consecutive blocks overlap by the longest query, so that every alignment is complete in one block
+    size_t step = blockSize - longestQuery + 1;
+    std::vector<size_t> blockStarts;
+    for (size_t start = 0; start + shortestQuery <= text.size(); start += step)
+        blockStarts.push_back(start);
+
+    std::for_each(std::execution::par, blockStarts.begin(), blockStarts.end(),
+        [&](size_t start)
+        {
+            KMISMATCH_TRACE_SPAN(blockSpan, "fft_block", "search", static_cast<int64_t>(start));
+            ScratchArena arena;
+            std::pmr::vector<uint32_t> textTransforms(alphabet.size() * blockSize, 0, arena.resource());
+            size_t blockEnd = std::min(start + blockSize, text.size());
+            for (size_t s = 0; s < alphabet.size(); s++)
+            {
+                uint32_t* symbolTransform = textTransforms.data() + s * blockSize;
+                for (size_t i = start; i < blockEnd; i++)
+                    symbolTransform[i - start] = text[i] == alphabet[s];
+                transform.forward(symbolTransform);
+            }
+
+            std::pmr::vector<uint32_t> matches(blockSize, arena.resource());
+            std::pmr::vector<std::pair<size_t, size_t>> hits(arena.resource());
+            size_t alignments = 0;
+            for (size_t i = 0; i < searchedQueries.size(); i++)
+            {
+                const std::string& query = queries[searchedQueries[i]];
+                size_t alignmentsEnd = std::min(start + step, text.size() - query.size() + 1);
+                if (alignmentsEnd <= start)
+                    continue;
+
+                std::fill(matches.begin(), matches.end(), 0);
+                for (size_t s = 0; s < alphabet.size(); s++)
+                    transform.multiplyAccumulate(matches.data(), textTransforms.data() + s * blockSize,
+                        queryTransforms[i].data() + s * blockSize);
+                transform.inverse(matches.data());
+
+                size_t minMatches = query.size() - misMatchesPerQuery[searchedQueries[i]];
+                for (size_t pos = start; pos < alignmentsEnd; pos++)
+                    if (matches[pos - start + query.size() - 1] >= minMatches && Corpus::withinDocument(documentStarts, pos, query.size()))
+                        hits.emplace_back(searchedQueries[i], pos);
+                alignments += alignmentsEnd - start;
+            }
+            KMISMATCH_STATS(
+                SearchStats::add(StatsCounter::Verifications, alignments);
+                SearchStats::add(StatsCounter::Hits, hits.size()));
+            if (hits.empty())
+                return;
+
+            std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+            {
+                KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(start), SearchTrace::LOCK_WAIT_MIN_NS);
+                lock.lock();
+            }
+            for (auto& [q, pos] : hits)
+                resultMap[this->queries[q]].insert(pos);
+        });
+    KMISMATCH_STATS(SearchStats::add(StatsCounter::Queries, searchedQueries.size()));
+
+    return resultMap;
+}
+
+void KMismatchSearch::buildFmIndex()
+{
+    KMISMATCH_STATS_STAGE(StatsStage::IndexBuild);
+    KMISMATCH_TRACE_SPAN(buildSpan, "fm_index_build", "index", static_cast<int64_t>(text.size()));
+    this->fmIndex = FmIndex::build(text);
+}
+
+void KMismatchSearch::loadFmIndex(const std::string& fileName)
+{
+    auto index = FmIndex::load(fileName);
+    if (index->getTextSize() != text.size() || index->getTextHash() != FmIndex::hashText(text))
+        throw std::runtime_error("FM-index file was built for another text: " + fileName);
+    this->fmIndex = index;
+}
+
+void KMismatchSearch::saveFmIndex(const std::string& fileName)
+{
+    if (!this->fmIndex)
+        buildFmIndex();
+    this->fmIndex->save(fileName);
+}
+
+std::shared_ptr<const FmIndex> KMismatchSearch::getFmIndex() const
+{
+    return fmIndex;
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::fmSearch(size_t misMatches)
+{
+    return fmSearch(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::fmSearch(const std::vector<size_t>& misMatchesPerQuery)
+{
+    std::map<std::string, std::set<size_t>> resultMap;
+    std::mutex mtx;
+
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+    if (!wildcards.empty())
+        throw std::runtime_error("Wildcards are only supported by the MCS and naive searches!");
+    for (size_t q = 0; q < queries.size(); q++)
+        if (misMatchesPerQuery[q] > queries[q].size())
+            throw std::runtime_error("Mismatch number can not be greater than query length!");
+
+    if (!this->fmIndex)
+        buildFmIndex();
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "fm_search", "search", static_cast<int64_t>(queries.size()));
+
+    const FmIndex& index = *this->fmIndex;
+    std::for_each(std::execution::par, queries.begin(), queries.end(),
+        [&](const std::string& query)
+        {
+            size_t q = &query - queries.data();
+            KMISMATCH_TRACE_SPAN(querySpan, "query", "search", static_cast<int64_t>(q));
+            ScratchArena arena;
+            std::pmr::vector<size_t> positions(arena.resource());
+            size_t steps = index.search(query, misMatchesPerQuery[q], positions, arena.resource());
+            std::erase_if(positions, [&](size_t pos) { return !Corpus::withinDocument(documentStarts, pos, query.size()); });
+            KMISMATCH_STATS(
+                SearchStats::add(StatsCounter::Queries, 1);
+                SearchStats::add(StatsCounter::Lookups, steps);
+                SearchStats::add(StatsCounter::Hits, positions.size()));
+            (void)steps;
+
+            if (positions.empty())
+                return;
+            std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+            {
+                KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(q), SearchTrace::LOCK_WAIT_MIN_NS);
+                lock.lock();
+            }
+            resultMap[query].insert(positions.begin(), positions.end());
+        });
+
+    return resultMap;
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::seedSearch(size_t misMatches)
+{
+    return seedSearch(std::vector<size_t>(queries.size(), misMatches));
+}
+
+std::map<std::string, std::set<size_t>> KMismatchSearch::seedSearch(const std::vector<size_t>& misMatchesPerQuery)
+{
+    std::map<std::string, std::set<size_t>> resultMap;
+    std::mutex mtx;
+
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+    if (!wildcards.empty())
+        throw std::runtime_error("Wildcards are only supported by the MCS and naive searches!");
+
+    // The k + 1 pieces of every query, identical pieces of several queries being a single pattern
+    std::vector<std::string> patterns;
+    std::unordered_map<std::string, uint32_t> patternIds;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> pieceOccurrences;  // (query, offset) of every pattern
+    std::vector<uint32_t> scannedQueries;
+    std::vector<VerificationKernel> kernels;
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        if (misMatchesPerQuery[q] > queries[q].size())
+            throw std::runtime_error("Mismatch number can not be greater than query length!");
+        kernels.push_back(selectVerificationKernel(queries[q].size(), misMatchesPerQuery[q]));
+        if (queries[q].size() < misMatchesPerQuery[q] + 1)
+        {
+            scannedQueries.push_back(static_cast<uint32_t>(q));
+            continue;
+        }
+        for (auto& [offset, pieceLength] : splitQuery(queries[q].size(), misMatchesPerQuery[q] + 1))
+        {
+            auto [piece, inserted] = patternIds.try_emplace(queries[q].substr(offset, pieceLength), static_cast<uint32_t>(patterns.size()));
+            if (inserted)
+            {
+                patterns.push_back(piece->first);
+                pieceOccurrences.emplace_back();
+            }
+            pieceOccurrences[piece->second].emplace_back(static_cast<uint32_t>(q), static_cast<uint32_t>(offset));
+        }
+    }
+
+    AhoCorasick automaton;
+    {
+        KMISMATCH_STATS_STAGE(StatsStage::IndexBuild);
+        KMISMATCH_TRACE_SPAN(buildSpan, "seed_automaton_build", "index", static_cast<int64_t>(patterns.size()));
+        automaton = AhoCorasick(patterns);
+    }
+    KMISMATCH_STATS_STAGE(StatsStage::Search);
+    KMISMATCH_TRACE_SPAN(searchSpan, "seed_search", "search", static_cast<int64_t>(queries.size()));
+
+    std::vector<size_t> chunkStarts;
+    for (size_t start = 0; start < text.size(); start += SEED_CHUNK_SIZE)
+        chunkStarts.push_back(start);
+
+    std::atomic<size_t> candidatesCount = 0;
+    size_t overlap = automaton.getLongestPattern() ? automaton.getLongestPattern() - 1 : 0;
+    std::for_each(std::execution::par, chunkStarts.begin(), chunkStarts.end(),
+        [&](size_t start)
+        {
+            KMISMATCH_TRACE_SPAN(chunkSpan, "seed_chunk", "search", static_cast<int64_t>(start));
+            ScratchArena arena;
+            size_t end = std::min(start + SEED_CHUNK_SIZE, text.size());
+
+            // The chunk is scanned from the longest pattern before it, and reports the pieces ending in it
+            std::pmr::vector<std::pair<uint32_t, size_t>> candidates(arena.resource());
+            size_t scanStart = start - std::min(start, overlap);
+            automaton.scan(text.data() + scanStart, text.data() + end,
+                [&](uint32_t pattern, size_t pieceEnd)
+                {
+                    pieceEnd += scanStart;
+                    if (pieceEnd <= start)
+                        return;
+                    size_t pieceStart = pieceEnd - patterns[pattern].size();
+                    for (auto& [q, offset] : pieceOccurrences[pattern])
+                        if (pieceStart >= offset)
+                            candidates.emplace_back(q, pieceStart - offset);
+                });
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            for (uint32_t q : scannedQueries)
+                for (size_t pos = start; pos < end; pos++)
+                    candidates.emplace_back(q, pos);
+            candidatesCount += candidates.size();
+
+            std::pmr::vector<std::pair<uint32_t, size_t>> hits(arena.resource());
+            for (auto& [q, pos] : candidates)
+                if (verifyOnPosition(kernels[q], queries[q], pos, misMatchesPerQuery[q]))
+                    hits.emplace_back(q, pos);
+            KMISMATCH_STATS(
+                SearchStats::add(StatsCounter::Candidates, candidates.size());
+                SearchStats::add(StatsCounter::Verifications, candidates.size());
+                SearchStats::add(StatsCounter::Hits, hits.size()));
+
+            if (hits.empty())
+                return;
+            std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+            {
+                KMISMATCH_TRACE_SPAN(lockSpan, "result_lock_wait", "lock", static_cast<int64_t>(start), SearchTrace::LOCK_WAIT_MIN_NS);
+                lock.lock();
+            }
+            for (auto& [q, pos] : hits)
+                resultMap[queries[q]].insert(pos);
+        });
+    KMISMATCH_STATS(SearchStats::add(StatsCounter::Queries, queries.size()));
+    this->lastCandidatesCount = candidatesCount;
+
+    return resultMap;
+}
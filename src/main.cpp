@@ -1,11 +1,19 @@
 #include <iostream>
 #include <vector>
 #include "k_mismatch_search.h"
+#include "search_stats.h"
+#include "search_trace.h"
+#include "resource_planner.h"
+#include "sharded_search.h"
 #include <numeric>
 #include <fstream>
 #include <stdexcept>
 #include <limits>
 #include <optional>
+#include <cstdlib>
+#include <chrono>
+#include <iomanip>
+#include <filesystem>
 
 /**
  * Safely converts a string to an integer and checks if the input is valid.
@@ -39,8 +47,9 @@ int safeStoi(const char* str, const std::string& paramName) {
 void errMsg(std::string programName)
 {
     std::cerr << "Usage: " << programName << " -t <text_file> -q <queries_file> -m <misMatches> "
-        << "[-mc <mcs_file>] [-i <index_file>] [-sm <mcs_file_to_save>] "
-        << "[-si <index_file_to_save>] [-sr <results_file_to_save>] [-h]";
+        << "[-t <text_file>...] [-fa] [-mc <mcs_file>] [-i <index_file>] [-sm <mcs_file_to_save>] "
+        << "[-si <index_file_to_save>] [-sr <results_file_to_save>] [-ts] [-om <seconds>] "
+        << "[-e <mcs|naive|segment|fft|fm|seed|auto>] [-sg <segments>] [-qm <mismatches_file>] [-st] [-tr <trace_file>] [-pl] [-mm <megabytes>] [-rc] [-w <symbols>] [-r <mode>] [-dl <milliseconds>] [-cb <candidates>] [-ns <shards>] [-h]";
 }
 
 /**
@@ -52,19 +61,281 @@ void helpMsg(std::string programName)
 {
     std::cout << "Usage: " << programName << " [options]\n\n"
         << "Options:\n"
-        << "  -t,  --text <text_file>            Path to the text file (required).\n"
+        << "  -t,  --text <text_file>            Path to the text file (required); given several times,\n"
+        << "                                     a corpus with a document per file, whose positions are\n"
+        << "                                     reported as file:offset.\n"
+        << "  -fa, --fasta                       Read the text files as FASTA, a document per record named\n"
+        << "                                     by its header, positions reported as name:offset (optional).\n"
         << "  -q,  --queries <queries_file>      Path to the queries file (required).\n"
         << "  -m,  --mismatches <number>         Maximum number of mismatches allowed (required).\n"
         << "  -mc, --mcs <mcs_file>              Path to the MCS file (optional).\n"
-        << "  -i,  --index <index_file>          Path to the index file (optional).\n"
+        << "  -i,  --index <index_file>          Path to the index file, the FM-index file with the fm\n"
+        << "                                     engine (optional).\n"
         << "  -sm, --save_mcs <mcs_file>         Path to save the MCS file (optional).\n"
-        << "  -si, --save_index <index_file>     Path to save the index file (optional).\n"
+        << "  -si, --save_index <index_file>     Path to save the index file, the FM-index file with the\n"
+        << "                                     fm engine (optional).\n"
         << "  -sr, --save_result <results_file>  Path to save the result file (optional).\n"
+        << "  -ts, --text_stats                  Build the MCS from text statistics and report predicted\n"
+        << "                                     versus measured candidates per query (optional).\n"
+        << "  -om, --optimize_mcs <seconds>      Shrink the MCS with a set cover optimizer within the\n"
+        << "                                     given time limit before searching or saving (optional).\n"
+        << "  -e,  --engine <name>               Search engine: mcs (default), naive, segment, fft, fm,\n"
+        << "                                     seed, or auto to pick the engine of every query length\n"
+        << "                                     from the predicted times, logged to stderr (optional).\n"
+        << "  -sg, --segments <number>           Number of segments per query for the segment engine,\n"
+        << "                                     at least mismatches + 1 (optional).\n"
+        << "  -qm, --query_mismatches <file>     File with a mismatch threshold per query line, each at\n"
+        << "                                     most the mismatches number; one index serves all (optional).\n"
+        << "  -st, --stats                       Print per-stage timings and search counters as JSON\n"
+        << "                                     to stderr (optional).\n"
+        << "  -tr, --trace <trace_file>          Write a Chrome trace of the run, viewable in Perfetto or\n"
+        << "                                     chrome://tracing, when the program exits (optional).\n"
+        << "  -pl, --plan                        Print the predicted index size, peak memory, candidates\n"
+        << "                                     per query and time of every engine without searching (optional).\n"
+        << "  -mm, --mem_cap <megabytes>         Refuse runs whose predicted peak memory exceeds the cap\n"
+        << "                                     (optional).\n"
+        << "  -rc, --reverse_complement          Search the reverse complement strand too, for nucleotide\n"
+        << "                                     texts and queries with the mcs engine; positions are\n"
+        << "                                     followed by + or - for their strand (optional).\n"
+        << "  -w,  --wildcards <symbols>         Symbols matching any symbol in the text and the queries,\n"
+        << "                                     such as N-, with the mcs or naive engine (optional).\n"
+        << "  -r,  --results <mode>              What to report per query with the mcs engine: all\n"
+        << "                                     (default), exists, count, first-N or best-N, the N first\n"
+        << "                                     or fewest-mismatch hits as position:mismatches (optional).\n"
+        << "  -dl, --deadline <milliseconds>     Stop the mcs or naive search this long after it starts and\n"
+        << "                                     report the positions found so far (optional).\n"
+        << "  -cb, --candidate_budget <number>   Most candidates verified per query by the mcs engine, the\n"
+        << "                                     query being truncated above (optional).\n"
+        << "  -ns, --shards <number>             Search with this many worker processes, each indexing one\n"
+        << "                                     range of the text, with the mcs, naive, fft, fm or seed\n"
+        << "                                     engine and a single text file (optional).\n"
+        << "       --shard <begin:owned:end>     Run as the worker of a text range, answering the queries\n"
+        << "                                     of a coordinator on stdin and stdout (internal).\n"
         << "  -h,  --help                        Display this help message.\n\n"
         << "Example usage:\n"
         << "  " << programName << " -t text.txt -q queries.txt -m 2 -mc mcsfile.txt -i indexfile.txt\n\n";
 }
 
+/**
+ * Writes a result position, as document:offset in a corpus.
+ *
+ * @param os The output stream.
+ * @param position The text position.
+ * @param search The search, locating the position in its documents.
+ * @param documentNames The name of every document, empty if the text is not a corpus.
+ */
+void writePosition(std::ostream& os, size_t position, const KMismatchSearch& search, const std::vector<std::string>& documentNames)
+{
+    if (documentNames.empty())
+    {
+        os << position;
+        return;
+    }
+    DocumentPosition documentPosition = search.locate(position);
+    os << documentNames[documentPosition.document] << ":" << documentPosition.offset;
+}
+
+/**
+ * Writes a result position of a both strands search, followed by + on the forward and - on the reverse strand.
+ *
+ * @param os The output stream.
+ * @param position The text position and its strand.
+ * @param search The search, locating the position in its documents.
+ * @param documentNames The name of every document, empty if the text is not a corpus.
+ */
+void writePosition(std::ostream& os, const std::pair<size_t, Strand>& position, const KMismatchSearch& search,
+    const std::vector<std::string>& documentNames)
+{
+    writePosition(os, position.first, search, documentNames);
+    os << (position.second == Strand::Forward ? '+' : '-');
+}
+
+/**
+ * Writes the results of a result mode, a line per query with its count with exists and count,
+ * or its hits as position:mismatches with first-N and best-N.
+ *
+ * @param os The output stream.
+ * @param result The result of every query.
+ * @param mode The result mode.
+ * @param search The search, locating the positions in its documents.
+ * @param documentNames The name of every document, empty if the text is not a corpus.
+ */
+void writeResults(std::ostream& os, const std::map<std::string, QueryResult>& result, ResultMode mode,
+    const KMismatchSearch& search, const std::vector<std::string>& documentNames)
+{
+    for (auto& [query, queryResult] : result)
+    {
+        os << query << " ";
+        if (mode == ResultMode::Exists || mode == ResultMode::Count)
+            os << queryResult.count << " ";
+        else
+            for (auto& [position, mismatches] : queryResult.hits)
+            {
+                writePosition(os, position, search, documentNames);
+                os << ":" << mismatches << " ";
+            }
+        os << std::endl;
+    }
+}
+
+/**
+ * Writes the results, a line per query with its positions.
+ *
+ * @param os The output stream.
+ * @param result The positions of every query.
+ * @param search The search, locating the positions in its documents.
+ * @param documentNames The name of every document, empty if the text is not a corpus.
+ */
+template <typename Positions>
+void writeResults(std::ostream& os, const std::map<std::string, Positions>& result, const KMismatchSearch& search,
+    const std::vector<std::string>& documentNames)
+{
+    for (auto& [query, positions] : result)
+    {
+        os << query << " ";
+        for (auto& position : positions)
+        {
+            writePosition(os, position, search, documentNames);
+            os << " ";
+        }
+        os << std::endl;
+    }
+}
+
+static const uint64_t AUTO_MAX_MCS_COMBINATIONS = 1 << 24;  // Most combinations of an MCS built by the automatic selection
+
+/**
+ * Returns the most mismatch combinations an MCS of the queries covers for one query length.
+ *
+ * @param queries The queries.
+ * @param misMatches Number of allowed mismatches.
+ * @return The combinations of the longest cover, 0 if no query is long enough for an MCS.
+ */
+uint64_t mcsCombinations(const std::vector<std::string>& queries, size_t misMatches)
+{
+    uint64_t combinations = 0;
+    for (auto& query : queries)
+        if (query.size() >= misMatches + 2)
+            combinations = std::max(combinations, CombinationRange(std::min<uint64_t>(query.size(),
+                kMismatchIntegerType::UINT_TYPE_SIZE), misMatches).size());
+    return combinations;
+}
+
+/**
+ * Searches the queries with an engine other than the reverse complement and result mode searches.
+ *
+ * @param search The search, with its text and queries.
+ * @param engine Name of the engine: mcs, naive, segment, fft, fm or seed.
+ * @param misMatchesPerQuery Mismatch threshold of every query.
+ * @param misMatches Number of allowed mismatches of the segment engine.
+ * @param segments Number of segments per query of the segment engine.
+ * @return The positions of every query.
+ */
+std::map<std::string, std::set<size_t>> searchWithEngine(KMismatchSearch& search, const std::string& engine,
+    const std::vector<size_t>& misMatchesPerQuery, size_t misMatches, size_t segments)
+{
+    if (engine == "naive")
+        return search.naiveSearch(misMatchesPerQuery);
+    if (engine == "segment")
+        return search.segmentSearch(misMatches, segments);
+    if (engine == "fft")
+        return search.fftSearch(misMatchesPerQuery);
+    if (engine == "fm")
+        return search.fmSearch(misMatchesPerQuery);
+    if (engine == "seed")
+        return search.seedSearch(misMatchesPerQuery);
+    return search.mcsSearch(misMatchesPerQuery);
+}
+
+/**
+ * Searches every query length group with the engine the selection picked for it, each engine running once over
+ * all its groups, and logs the estimated versus the measured time of every engine to stderr.
+ *
+ * @param search The search, with its text and all the queries, which are restored after the runs.
+ * @param selection The engine of every query length group.
+ * @param misMatchesPerQuery Mismatch threshold of every query.
+ * @param onRun Called after the run of every engine, such as to collect the query statuses.
+ * @return The positions of every query.
+ */
+template <typename OnRun>
+std::map<std::string, std::set<size_t>> searchSelection(KMismatchSearch& search, const EngineSelection& selection,
+    const std::vector<size_t>& misMatchesPerQuery, OnRun&& onRun)
+{
+    std::vector<std::string> allQueries = search.getQueries();
+    std::map<std::string, std::set<size_t>> result;
+    for (auto& [engine, estimatedSeconds] : selection.engineSeconds)
+    {
+        std::vector<std::string> engineQueries;
+        std::vector<size_t> engineMisMatches;
+        for (auto& group : selection.groups)
+            if (group.engine == engine)
+                for (size_t q : group.queryIndices)
+                {
+                    engineQueries.push_back(allQueries[q]);
+                    engineMisMatches.push_back(misMatchesPerQuery[q]);
+                }
+        search.setQueries(engineQueries);
+        auto start = std::chrono::steady_clock::now();
+        auto engineResult = searchWithEngine(search, engine, engineMisMatches, 0, 0);
+        double measuredSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        onRun();
+        std::cerr << "Engine " << engine << ": " << engineQueries.size() << " queries, estimated " << std::fixed
+            << std::setprecision(3) << estimatedSeconds << " s, measured " << measuredSeconds << " s\n"
+            << std::defaultfloat;
+        result.merge(engineResult);
+    }
+    search.setQueries(allQueries);
+    return result;
+}
+
+/**
+ * Searches the queries with worker processes of this program, each holding the index of one shard of the text.
+ *
+ * @param workerProgram This program, as it was started.
+ * @param textFile Path to the text file.
+ * @param shards Number of worker processes.
+ * @param queries The queries.
+ * @param misMatchesPerQuery Mismatch threshold of every query.
+ * @param workerArguments Arguments of the workers besides their shard: text file, mismatches, engine and wildcards.
+ * @return The positions of every query.
+ */
+std::map<std::string, std::set<size_t>> searchShards(const std::string& workerProgram, const std::string& textFile, size_t shards,
+    const std::vector<std::string>& queries, const std::vector<size_t>& misMatchesPerQuery,
+    const std::vector<std::string>& workerArguments)
+{
+    // Consecutive shards overlap by the longest query but one, so every alignment lies within a shard
+    size_t longestQuery = 0;
+    for (auto& query : queries)
+        longestQuery = std::max(longestQuery, query.size());
+    std::vector<Shard> textShards = ShardCoordinator::partition(std::filesystem::file_size(textFile), shards,
+        longestQuery > 0 ? longestQuery - 1 : 0);
+
+    // A program started through PATH is looked up there again, a path is made absolute
+    std::filesystem::path program(workerProgram);
+    std::vector<std::string> workerCommand = {
+        program.has_parent_path() ? std::filesystem::absolute(program).string() : workerProgram };
+    workerCommand.insert(workerCommand.end(), workerArguments.begin(), workerArguments.end());
+    ShardCoordinator coordinator(workerCommand, textShards);
+    return coordinator.search(queries, misMatchesPerQuery);
+}
+
+static std::string traceFileToSave;  // Path to save the trace file, written at exit (optional)
+
+/**
+ * Writes the recorded trace spans at program exit.
+ */
+void writeTraceAtExit()
+{
+    try
+    {
+        SearchTrace::writeChromeTrace(traceFileToSave);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
 /**
  * The main function that handles command-line arguments, sets up the k-mismatch search,
  * and outputs the search results.
@@ -78,12 +349,30 @@ int main(int argc, char* argv[])
     KMismatchSearch kMismatchSearch;  // k-mismatch search object
     int misMatches = -1;              // Number of mismatches allowed
     std::string textFile;             // Path to the text file
+    std::vector<std::string> textFiles;  // Paths to the text files, a document each unless FASTA (optional)
+    bool fasta = false;               // Read the text files as FASTA, a document per record (optional)
     std::string queriesFile;          // Path to the queries file
     std::string mcsFile;              // Path to the MCS file (optional)
     std::string indexFile;            // Path to the index file (optional)
     std::string mcsFileToSave;        // Path to save the MCS file (optional)
     std::string indexFileToSave;      // Path to save the index file (optional)
     std::string resultsFileToSave;    // Path to save the result file (optional)
+    bool textStats = false;           // Build the MCS from text statistics (optional)
+    const size_t textSampleSize = 1 << 20;  // Maximal size of the text sample used for statistics
+    int optimizeSeconds = -1;         // Time limit of the MCS optimization (optional)
+    std::string engine = "mcs";       // Search engine (optional)
+    int segments = 0;                 // Number of segments per query for the segment engine (optional)
+    std::string queryMismatchesFile;  // Path to the per-query mismatch thresholds file (optional)
+    bool stats = false;               // Print search statistics (optional)
+    bool plan = false;                // Print the resource plan without searching (optional)
+    int memCapMegabytes = 0;          // Maximal predicted peak memory of a run, 0 for no cap (optional)
+    bool bothStrands = false;         // Search the reverse complement strand too (optional)
+    std::string wildcards;            // Symbols matching any symbol (optional)
+    std::string resultsMode = "all";  // What to report per query (optional)
+    int deadlineMilliseconds = -1;    // Time limit of the search (optional)
+    int candidateBudget = 0;          // Most candidates verified per query, 0 for no budget (optional)
+    int shards = 0;                   // Number of worker processes of a sharded search, 0 for none (optional)
+    std::string shardRange;           // Text range of a worker of a sharded search (internal)
 
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
@@ -91,7 +380,10 @@ int main(int argc, char* argv[])
 
         // Check for each option and retrieve its argument if necessary
         if ((arg == "-t" || arg == "--text") && i + 1 < argc)
+        {
             textFile = argv[++i];
+            textFiles.push_back(textFile);
+        }
         else if ((arg == "-q" || arg == "--queries") && i + 1 < argc)
             queriesFile = argv[++i];
         else if ((arg == "-m" || arg == "--mismatches") && i + 1 < argc)
@@ -113,6 +405,59 @@ int main(int argc, char* argv[])
             indexFileToSave = argv[++i];
         else if ((arg == "-sr" || arg == "--save_result") && i + 1 < argc)
             resultsFileToSave = argv[++i];
+        else if (arg == "-ts" || arg == "--text_stats")
+            textStats = true;
+        else if ((arg == "-om" || arg == "--optimize_mcs") && i + 1 < argc)
+            optimizeSeconds = safeStoi(argv[++i], "optimize_mcs");
+        else if ((arg == "-e" || arg == "--engine") && i + 1 < argc)
+            engine = argv[++i];
+        else if ((arg == "-sg" || arg == "--segments") && i + 1 < argc)
+            segments = safeStoi(argv[++i], "segments");
+        else if ((arg == "-qm" || arg == "--query_mismatches") && i + 1 < argc)
+            queryMismatchesFile = argv[++i];
+        else if (arg == "-fa" || arg == "--fasta")
+            fasta = true;
+        else if (arg == "-st" || arg == "--stats")
+            stats = true;
+        else if (arg == "-pl" || arg == "--plan")
+            plan = true;
+        else if ((arg == "-mm" || arg == "--mem_cap") && i + 1 < argc)
+            memCapMegabytes = safeStoi(argv[++i], "mem_cap");
+        else if ((arg == "-tr" || arg == "--trace") && i + 1 < argc)
+            traceFileToSave = argv[++i];
+        else if (arg == "-rc" || arg == "--reverse_complement")
+            bothStrands = true;
+        else if ((arg == "-w" || arg == "--wildcards") && i + 1 < argc)
+            wildcards = argv[++i];
+        else if ((arg == "-r" || arg == "--results") && i + 1 < argc)
+            resultsMode = argv[++i];
+        else if ((arg == "-dl" || arg == "--deadline") && i + 1 < argc)
+            deadlineMilliseconds = safeStoi(argv[++i], "deadline");
+        else if ((arg == "-cb" || arg == "--candidate_budget") && i + 1 < argc)
+            candidateBudget = safeStoi(argv[++i], "candidate_budget");
+        else if ((arg == "-ns" || arg == "--shards") && i + 1 < argc)
+        {
+            try
+            {
+                shards = safeStoi(argv[++i], "shards");
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            if (shards < 1)
+            {
+                std::cerr << "shards must be positive.\n";
+                return 1;
+            }
+#ifdef _WIN32
+            std::cerr << "Error: the sharded search is not supported on Windows.\n";
+            return 1;
+#endif
+        }
+        else if (arg == "--shard" && i + 1 < argc)
+            shardRange = argv[++i];
         else if (arg == "-h" || arg == "--help")
         {
             helpMsg(argv[0]);
@@ -127,22 +472,182 @@ int main(int argc, char* argv[])
     }
 
     // Validate required arguments
-    if (textFile.empty() || queriesFile.empty() || misMatches == -1)
+    if (textFile.empty() || (queriesFile.empty() && shardRange.empty()) || misMatches == -1)
     {
         std::cerr << "Error: text_file, queries_file and mismatches number are required.\n";
         errMsg(argv[0]);
         return 1;
     }
+    if (engine != "mcs" && engine != "naive" && engine != "segment" && engine != "fft" && engine != "fm" && engine != "seed"
+        && engine != "auto")
+    {
+        std::cerr << "Error: unknown engine '" << engine << "'.\n";
+        errMsg(argv[0]);
+        return 1;
+    }
+    // Only the mcs engine supports the reverse complement search, the result modes and the candidate budget
+    if (engine == "auto" && (bothStrands || resultsMode != "all" || candidateBudget > 0))
+        engine = "mcs";
+
+    if (bothStrands && engine != "mcs")
+    {
+        std::cerr << "Error: the reverse complement search needs the mcs engine.\n";
+        return 1;
+    }
+    if (!wildcards.empty() && (bothStrands || (engine != "mcs" && engine != "naive" && engine != "auto")))
+    {
+        std::cerr << "Error: wildcards need the mcs or naive engine, without the reverse complement search.\n";
+        return 1;
+    }
 
-    // Initialize the KMismatchSearch object with the provided files and options
+    // Result mode, first-N and best-N carrying their number of hits
+    ResultMode resultMode = ResultMode::All;
+    size_t resultLimit = 0;
     try
     {
-        if (mcsFile.empty())
+        if (resultsMode == "exists")
+            resultMode = ResultMode::Exists;
+        else if (resultsMode == "count")
+            resultMode = ResultMode::Count;
+        else if (resultsMode.starts_with("first-"))
+            resultMode = ResultMode::First;
+        else if (resultsMode.starts_with("best-"))
+            resultMode = ResultMode::Best;
+        else if (resultsMode != "all")
+            throw std::invalid_argument("unknown result mode '" + resultsMode + "'.");
+        if (resultMode == ResultMode::First || resultMode == ResultMode::Best)
+            resultLimit = safeStoi(resultsMode.c_str() + resultsMode.find('-') + 1, "results");
+        if (resultLimit == 0 && (resultMode == ResultMode::First || resultMode == ResultMode::Best))
+            throw std::invalid_argument("the number of hits of " + resultsMode + " must be positive.");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (resultMode != ResultMode::All && (engine != "mcs" || bothStrands))
+    {
+        std::cerr << "Error: result modes need the mcs engine, without the reverse complement search.\n";
+        return 1;
+    }
+    if ((deadlineMilliseconds >= 0 && engine != "mcs" && engine != "naive" && engine != "auto")
+        || (candidateBudget > 0 && engine != "mcs"))
+    {
+        std::cerr << "Error: the deadline needs the mcs or naive engine, and the candidate budget the mcs engine.\n";
+        return 1;
+    }
+    // Every worker of a sharded search runs a plain search of its range of a single text file
+    if ((shards > 0 || !shardRange.empty()) && (textFiles.size() > 1 || fasta || engine == "segment" || engine == "auto"
+        || bothStrands || resultMode != ResultMode::All || deadlineMilliseconds >= 0 || candidateBudget > 0
+        || !mcsFile.empty() || !indexFile.empty() || !mcsFileToSave.empty() || !indexFileToSave.empty() || textStats
+        || optimizeSeconds >= 0 || plan || memCapMegabytes > 0))
+    {
+        std::cerr << "Error: the sharded search needs the mcs, naive, fft, fm or seed engine and a single text file,\n"
+            << "without MCS or index files, plans, result modes, search limits or the reverse complement search.\n";
+        return 1;
+    }
+
+    // A worker of a sharded search holds the text range of its shard and answers the coordinator until it stops
+    if (!shardRange.empty())
+    {
+        try
+        {
+            Shard shard = ShardProtocol::parseShard(shardRange);
+            std::string text = ShardWorker::loadShardText(textFile, shard);
+            kMismatchSearch.setText(text);
+            kMismatchSearch.setWildcards(wildcards);
+            ShardWorker worker(kMismatchSearch, shard, engine, misMatches);
+            worker.serve(std::cin, std::cout);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (stats)
+    {
+#ifdef KMISMATCH_ENABLE_STATS
+        SearchStats::setEnabled(true);
+#else
+        std::cerr << "Warning: statistics are not compiled in, rebuild with KMISMATCH_ENABLE_STATS.\n";
+#endif
+    }
+
+    if (!traceFileToSave.empty())
+    {
+#ifdef KMISMATCH_ENABLE_TRACE
+        SearchTrace::setEnabled(true);
+        std::atexit(writeTraceAtExit);
+#else
+        std::cerr << "Warning: tracing is not compiled in, rebuild with KMISMATCH_ENABLE_TRACE.\n";
+#endif
+    }
+
+    // Initialize the KMismatchSearch object with the provided files and options. Several text files, or FASTA
+    // files, are a corpus of documents searched together
+    bool corpus = textFiles.size() > 1 || fasta;
+    std::vector<std::string> documentNames;
+    try
+    {
+        if (corpus)
+        {
+            Corpus documents = fasta ? Corpus::loadFromFasta(textFiles) : Corpus::loadFromFiles(textFiles);
+            documentNames = documents.getNames();
+            kMismatchSearch.setCorpus(documents);
+        }
+
+        if (shards > 0)
+        {
+            // The workers read the text, the coordinator only the queries
+            std::vector<std::string> queries = kMismatchSearch.loadQueriesFromFile(queriesFile);
+            kMismatchSearch.setQueries(queries);
+        }
+        else if (corpus && !mcsFile.empty())
+        {
+            std::vector<std::string> queries = kMismatchSearch.loadQueriesFromFile(queriesFile);
+            kMismatchSearch.setQueries(queries);
+            MCS mcs = MCS::loadFromFile(mcsFile);
+            kMismatchSearch.setMcs(mcs);
+            if (!indexFile.empty() && !plan && engine != "fm")
+            {
+                auto cache = kMismatchSearch.loadCacheFromFile(indexFile);
+                kMismatchSearch.setCache(cache);
+            }
+        }
+        else if (mcsFile.empty() && (corpus || textStats || engine != "mcs" || plan))
+        {
+            if (!corpus)
+            {
+                std::string text = kMismatchSearch.loadTextFromFile(textFile);
+                kMismatchSearch.setText(text);
+            }
+            std::vector<std::string> queries = kMismatchSearch.loadQueriesFromFile(queriesFile);
+            kMismatchSearch.setQueries(queries);
+            // The plan covers every engine, with the MCS the mcs engine would use. The automatic selection
+            // leaves out the mcs engine when its MCS would cover too many combinations to be worth building
+            if (engine == "auto" && mcsCombinations(queries, misMatches) > AUTO_MAX_MCS_COMBINATIONS)
+                std::cerr << "Engine selection: too many mismatch combinations for an MCS, leaving out the mcs engine\n";
+            else if ((plan || engine == "auto" || engine == "mcs") && !textStats)
+                kMismatchSearch.buildLengthBucketsMcs(misMatches);
+            else if (engine == "segment" && !plan)
+                kMismatchSearch.buildSegmentMcs(misMatches, segments);
+            else if (engine == "mcs" || engine == "auto" || plan)
+                kMismatchSearch.buildSelectivityAwareLengthBucketsMcs(misMatches, textSampleSize);
+        }
+        else if (mcsFile.empty())
             kMismatchSearch = KMismatchSearch(textFile, queriesFile, misMatches);
-        else if (indexFile.empty())
+        else if (indexFile.empty() || plan || engine == "fm")
             kMismatchSearch = KMismatchSearch(textFile, queriesFile, mcsFile);
         else
             kMismatchSearch = KMismatchSearch(textFile, queriesFile, mcsFile, indexFile);
+
+        // The FM-index of the text replaces the MCS index with the fm engine, and with the automatic selection
+        // without an MCS file
+        if ((engine == "fm" || (engine == "auto" && mcsFile.empty())) && !indexFile.empty() && !plan)
+            kMismatchSearch.loadFmIndex(indexFile);
     }
     catch (const std::exception& e)
     {
@@ -150,40 +655,227 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    kMismatchSearch.setWildcards(wildcards);
+
+    // The reverse complement is defined for nucleotides only
+    if (bothStrands)
+    {
+        auto isNucleotides = [](const std::string& str) { return std::all_of(str.begin(), str.end(), isNucleotide); };
+        if (!isNucleotides(kMismatchSearch.getText())
+            || !std::all_of(kMismatchSearch.getQueries().begin(), kMismatchSearch.getQueries().end(), isNucleotides))
+        {
+            std::cerr << "Error: the reverse complement search needs a nucleotide text and queries (ACGTN).\n";
+            return 1;
+        }
+    }
+
+    // Shrink the MCS if requested, before the automatic selection so that it predicts the times of the optimized
+    // MCS. The selection may have left out the mcs engine, and built no MCS
+    if (optimizeSeconds >= 0 && !kMismatchSearch.getQueries().empty()
+        && (engine == "mcs" || (engine == "auto" && !kMismatchSearch.getMcs().getMcsForms().empty())))
+    {
+        size_t formsBefore = kMismatchSearch.getMcs().getMcsForms().size();
+        kMismatchSearch.optimizeMcs(misMatches, std::chrono::seconds(optimizeSeconds));
+        std::cerr << "MCS optimized from " << formsBefore << " to "
+            << kMismatchSearch.getMcs().getMcsForms().size() << " forms\n";
+    }
+
+    // Mismatch threshold of every query, all equal to the mismatches number unless given per query
+    std::vector<size_t> misMatchesPerQuery(kMismatchSearch.getQueries().size(), misMatches);
+    if (!queryMismatchesFile.empty())
+    {
+        std::ifstream file(queryMismatchesFile);
+        if (!file)
+        {
+            std::cerr << "Error: Unable to open query mismatches file: " << queryMismatchesFile << std::endl;
+            return 1;
+        }
+        // One line per query, so that a misaligned file is not searched with the wrong thresholds
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(file, line);)
+            lines.push_back(line);
+        if (lines.size() != misMatchesPerQuery.size())
+        {
+            std::cerr << "Error: the query mismatches file has " << lines.size() << " lines for "
+                << misMatchesPerQuery.size() << " queries.\n";
+            return 1;
+        }
+        for (size_t i = 0; i < misMatchesPerQuery.size(); i++)
+        {
+            const std::string& line = lines[i];
+            try
+            {
+                misMatchesPerQuery[i] = safeStoi(line.c_str(), "query mismatches");
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            if (misMatchesPerQuery[i] > static_cast<size_t>(misMatches))
+            {
+                std::cerr << "Error: query mismatches can not be greater than the mismatches number.\n";
+                return 1;
+            }
+        }
+        if (engine == "segment")
+        {
+            std::cerr << "Error: the segment engine does not support per-query mismatches.\n";
+            return 1;
+        }
+    }
+
+    // Predict the resources of the run, print them in plan mode and refuse runs above the memory cap.
+    // The automatic selection picks the engine of every query length from the predicted times
+    EngineSelection selection;
+    if (plan || memCapMegabytes > 0 || engine == "auto")
+    {
+        size_t memCapBytes = static_cast<size_t>(std::max(memCapMegabytes, 0)) * 1024 * 1024;
+        ResourcePlanner planner(kMismatchSearch, misMatches, segments);
+        if (engine == "auto")
+        {
+            // Only the mcs and naive engines support the wildcards and the deadline
+            std::vector<std::string> engines = { "mcs", "naive" };
+            if (wildcards.empty() && deadlineMilliseconds < 0)
+                engines.insert(engines.end(), { "fft", "fm", "seed" });
+            try
+            {
+                selection = planner.selectEngines(engines, memCapBytes);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            for (auto& group : selection.groups)
+                std::cerr << "Engine selection: " << group.queryIndices.size() << " queries of length "
+                    << group.queryLength << " -> " << group.engine << "\n";
+            if (selection.groups.empty() && !kMismatchSearch.getQueries().empty() && !plan)
+            {
+                std::cerr << planner.formatPlans(selection.plans, memCapBytes)
+                    << "Error: no engine is predicted to run within the memory cap of " << memCapMegabytes << " MB.\n";
+                return 1;
+            }
+        }
+        if (plan)
+        {
+            std::cout << planner.formatPlans(planner.planAll(), memCapBytes);
+            return 0;
+        }
+        EnginePlan enginePlan = engine == "auto" ? EnginePlan() : planner.planEngine(engine);
+        if (enginePlan.available && enginePlan.peakBytes > memCapBytes)
+        {
+            std::cerr << planner.formatPlans({ enginePlan }, memCapBytes)
+                << "Error: predicted peak memory exceeds the memory cap of " << memCapMegabytes << " MB.\n";
+            return 1;
+        }
+    }
+
+    // Bound the search, the deadline counting from its start
+    SearchLimits searchLimits;
+    if (deadlineMilliseconds >= 0)
+        searchLimits.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMilliseconds);
+    searchLimits.candidateBudget = candidateBudget;
+    kMismatchSearch.setSearchLimits(searchLimits);
+
     // Perform the k-mismatch search
-    auto result = kMismatchSearch.mcsSearch(misMatches);
+    std::map<std::string, std::set<size_t>> result;
+    std::map<std::string, std::set<std::pair<size_t, Strand>>> strandResult;
+    std::map<std::string, QueryResult> modeResult;
+    size_t truncated = 0;
+    size_t notStarted = 0;
+    auto countLimitedQueries = [&]()
+    {
+        auto& statuses = kMismatchSearch.getLastQueryStatuses();
+        truncated += std::ranges::count(statuses, QueryStatus::Truncated);
+        notStarted += std::ranges::count(statuses, QueryStatus::NotStarted);
+    };
+    try
+    {
+        if (bothStrands)
+            strandResult = kMismatchSearch.mcsSearchBothStrands(misMatchesPerQuery);
+        else if (resultMode != ResultMode::All)
+            modeResult = kMismatchSearch.mcsSearch(misMatchesPerQuery, resultMode, resultLimit);
+        else if (shards > 0)
+        {
+            std::vector<std::string> workerArguments = { "-t", textFile, "-m", std::to_string(misMatches), "-e", engine };
+            if (!wildcards.empty())
+                workerArguments.insert(workerArguments.end(), { "-w", wildcards });
+            result = searchShards(argv[0], textFile, shards, kMismatchSearch.getQueries(), misMatchesPerQuery, workerArguments);
+        }
+        else if (engine == "auto")
+            result = searchSelection(kMismatchSearch, selection, misMatchesPerQuery, countLimitedQueries);
+        else
+            result = searchWithEngine(kMismatchSearch, engine, misMatchesPerQuery, misMatches, segments);
+        if (engine != "auto")
+            countLimitedQueries();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Report the queries the limits stopped
+    if (deadlineMilliseconds >= 0 || candidateBudget > 0)
+    {
+        if (truncated || notStarted)
+            std::cerr << "Warning: the search limits truncated " << truncated << " queries and left "
+                << notStarted << " queries not started.\n";
+    }
+
+    // Report the predicted versus the measured number of candidates per query
+    if (textStats && engine == "mcs" && !kMismatchSearch.getQueries().empty())
+    {
+        std::string textSample = kMismatchSearch.getTextSample(textSampleSize);
+        std::map<size_t, double> predictedPerLength;
+        double predicted = 0.0;
+        for (auto& query : kMismatchSearch.getQueries())
+        {
+            if (!predictedPerLength.contains(query.size()))
+            {
+                // Every query is searched with the MCS of its length bucket
+                auto bucketMcs = kMismatchSearch.getLengthMcs().find(query.size());
+                const MCS& queryMcs = bucketMcs == kMismatchSearch.getLengthMcs().end() ? kMismatchSearch.getMcs() : bucketMcs->second;
+                predictedPerLength[query.size()] = queryMcs.predictCandidatesPerQuery(
+                    query.size(), textSample, kMismatchSearch.getText().size());
+            }
+            predicted += predictedPerLength[query.size()];
+        }
+        size_t queriesCount = kMismatchSearch.getQueries().size();
+        std::cerr << "Predicted candidates per query: " << predicted / queriesCount << "\n"
+            << "Measured candidates per query: "
+            << static_cast<double>(kMismatchSearch.getLastCandidatesCount()) / queriesCount << "\n";
+    }
+
+    // Print the search statistics if requested
+    if (stats && SearchStats::isEnabled())
+        std::cerr << SearchStats::toJson();
 
     // Save the MCS file if requested
     if (!mcsFileToSave.empty())
         kMismatchSearch.getMcs().saveToFile(mcsFileToSave);
 
     // Save the index file if requested
-    if (!indexFileToSave.empty())
+    // The automatic selection saves the FM-index when only the fm engine built an index
+    bool fmIndexToSave = engine == "fm"
+        || (engine == "auto" && kMismatchSearch.getFmIndex() && kMismatchSearch.getIndex().empty());
+    if (!indexFileToSave.empty() && fmIndexToSave)
+        kMismatchSearch.saveFmIndex(indexFileToSave);
+    else if (!indexFileToSave.empty())
         kMismatchSearch.saveCacheToFile(indexFileToSave);
 
     // Save the results to a file if requested, otherwise print to stdout
+    std::ofstream outFile;
     if (!resultsFileToSave.empty())
-    {
-        std::ofstream outFile(resultsFileToSave);
-        for (auto& [query, positions] : result)
-        {
-            outFile << query << " ";
-            for (auto position : positions)
-                outFile << position << " ";
-            outFile << std::endl;
-        }
-        outFile.close();
-    }
+        outFile.open(resultsFileToSave);
+    std::ostream& out = resultsFileToSave.empty() ? std::cout : outFile;
+    if (bothStrands)
+        writeResults(out, strandResult, kMismatchSearch, documentNames);
+    else if (resultMode != ResultMode::All)
+        writeResults(out, modeResult, resultMode, kMismatchSearch, documentNames);
     else
-    {
-        for (auto& [query, positions] : result)
-        {
-            std::cout << query << " ";
-            for (auto position : positions)
-                std::cout << position << " ";
-            std::cout << std::endl;
-        }
-    }
+        writeResults(out, result, kMismatchSearch, documentNames);
 
     return 0;
 }
@@ -1,13 +1,29 @@
 #include "mcs.h"
+#include <array>
+#include "search_stats.h"
+#include "search_trace.h"
+#include "scratch_arena.h"
 
-constexpr inline static size_t binom(size_t n, size_t k) noexcept
+// Binomial coefficients C(n, k) for n, k up to the bit width of the sequences (Pascal's triangle)
+static constexpr auto binomials = []
 {
-	if (k > n)
-		return 0; // out of range
-	if (k == 0 || k == n)
-		return 1; // edge
+	constexpr size_t size = kMismatchIntegerType::UINT_TYPE_SIZE + 1;
+	std::array<std::array<uint64_t, size>, size> table{};
+	for (size_t n = 0; n < size; ++n)
+	{
+		table[n][0] = 1;
+		for (size_t k = 1; k <= n; ++k)
+			table[n][k] = table[n - 1][k - 1] + table[n - 1][k];
+	}
+	return table;
+}();
 
-	return (binom(n - 1, k - 1) * n) / k;
+// Length of the combinations an MCS has to cover for queries of a length.
+// Sequences are limited to the bit width of the integer type, and an MCS covering the combinations
+// of a query prefix also covers the longer queries, as the prefix has at most as many mismatches.
+static uint64_t coverLength(uint64_t length)
+{
+	return std::min<uint64_t>(length, kMismatchIntegerType::UINT_TYPE_SIZE);
 }
 
 // Generates forms of ones and zeros in a binary sequence
@@ -28,42 +44,67 @@ std::vector<Form> Form::generateAllForms(uint64_t length, uint64_t mismatchK)
 		throw std::runtime_error("Matches per form must be equal or greater than 2!");
 		exit(1);
 	}
-		
-	uint64_t max_zeros = length - ones;
-
 
-	allForms.reserve(binom(length - 1, max_zeros));
-	// Recursive function to generate forms
-	std::function<void(uint64_t, uint64_t, kMismatchIntegerType::uint_type)> generateForms;
-	generateForms = [&allForms, &generateForms](uint64_t remainOnes, uint64_t remainZeros, kMismatchIntegerType::uint_type curFormInt) 
-	{
-		if (!remainOnes)
-			allForms.push_back(Form((curFormInt << 1) | 1));
-		if (remainOnes)
-			generateForms(remainOnes - 1, remainZeros, (curFormInt << 1) | 1);
-		if (remainZeros)
-			generateForms(remainOnes, remainZeros - 1, curFormInt << 1);
-	};
-
-	generateForms(ones - 2, max_zeros, 1);
+	// Forms have two ones, so they are enumerated by the number of zeros between them, shortest first
+	length = coverLength(length);
+	allForms.reserve(length - 1);
+	kMismatchIntegerType::uint_type one = static_cast<kMismatchIntegerType::uint_type>(1);
+	for (uint64_t zeros = 0; zeros + 2 <= length; ++zeros)
+		allForms.push_back(Form((one << (zeros + 1)) | one));
 
 	return allForms;
 }
 
 
 std::string Form::getStringFromPosition(const std::string& str, size_t pos) const
+{
+	std::string result(this->getSize(), '_');
+	fillStringFromPosition(str, pos, result.data());
+	return result;
+}
+
+std::pmr::string Form::getStringFromPosition(const std::string& str, size_t pos, std::pmr::memory_resource* resource) const
+{
+	std::pmr::string result(this->getSize(), '_', resource);
+	fillStringFromPosition(str, pos, result.data());
+	return result;
+}
+
+void Form::fillStringFromPosition(const std::string& str, size_t pos, char* result) const
 {
 	kMismatchIntegerType::uint_type formIntSeq = this->sequenceInt;
 	kMismatchIntegerType::uint_type one = static_cast<kMismatchIntegerType::uint_type>(1);
-	std::string result(this->getSize(), '_');
 	for (size_t i = 0; i < this->getSize(); ++i, ++pos)
 	{
 		if (formIntSeq & one)
 			result[i] = str[pos];  // Copy character from original string
 		formIntSeq >>= 1;
 	}
+}
 
-	return result;
+bool Form::samples(size_t i) const
+{
+	return (this->sequenceInt >> i) & static_cast<kMismatchIntegerType::uint_type>(1);
+}
+
+size_t Form::getWeight() const
+{
+	return popcount(this->sequenceInt);
+}
+
+void Form::fillStrandKeysFromPosition(const std::string& str, size_t pos, char* key, char* reverseComplementKey) const
+{
+	kMismatchIntegerType::uint_type one = static_cast<kMismatchIntegerType::uint_type>(1);
+	size_t last = this->getSize() - 1;
+	for (size_t i = 0; i <= last; ++i)
+	{
+		char symbol = str[pos + i];
+		if ((this->sequenceInt >> i) & one)
+			key[i] = symbol;
+		// The reverse complement reads the window from its end
+		if ((this->sequenceInt >> (last - i)) & one)
+			reverseComplementKey[last - i] = complementBase(symbol);
+	}
 }
 
 
@@ -104,35 +145,42 @@ kMismatchIntegerType::uint_type cutRightZeros(kMismatchIntegerType::uint_type n)
 	return n;
 }
 
-std::set<Form> Combination::getAllForms(uint64_t matches) const
+// Inserts into a set all forms with a given number of ones within a combination.
+// The chosen ones are enumerated as subsets of the combination ones with Gosper's next bit permutation.
+template <typename FormSet>
+static void collectInnerForms(kMismatchIntegerType::uint_type combInt, uint64_t matches, FormSet& allInnerForms)
 {
-	std::set<Form> allInnerForms;
-	kMismatchIntegerType::uint_type combInt = this->sequenceInt;
-
-	// Recursive function to generate combinations
-	std::function<void(uint64_t, kMismatchIntegerType::uint_type, kMismatchIntegerType::uint_type)> generateInnerForms;
-	generateInnerForms = [&allInnerForms, &generateInnerForms, &combInt]
-	(uint64_t remainOnes, kMismatchIntegerType::uint_type curPosition, kMismatchIntegerType::uint_type curFormInt)
-		{
-			if (!remainOnes) {
-				allInnerForms.insert(Form(cutRightZeros(curFormInt)));
-				return;
-			}
+	std::array<kMismatchIntegerType::uint_type, kMismatchIntegerType::UINT_TYPE_SIZE> onePositions;
+	size_t onesNumber = 0;
+	for (kMismatchIntegerType::uint_type rest = combInt; rest; rest &= rest - 1)
+		onePositions[onesNumber++] = rest & (~rest + 1);
+	if (!matches || matches > onesNumber)
+		return;
 
-			while (!((static_cast<uint64_t>(1) << (kMismatchIntegerType::UINT_TYPE_SIZE - 1)) & curPosition))
-			{
-				if (combInt & curPosition)
-					generateInnerForms(remainOnes - 1, curPosition << 1, curFormInt | curPosition);
-				curPosition <<= 1;
-			}
-
-			if ((combInt & curPosition) && (remainOnes == 1))
-				allInnerForms.insert(Form(cutRightZeros(curFormInt | curPosition)));
-
-		};
+	kMismatchIntegerType::uint_type one = static_cast<kMismatchIntegerType::uint_type>(1);
+	kMismatchIntegerType::uint_type subset = matches == kMismatchIntegerType::UINT_TYPE_SIZE ? ~static_cast<kMismatchIntegerType::uint_type>(0) : (one << matches) - 1;
+	for (uint64_t rank = 0; rank < binomials[onesNumber][matches]; ++rank)
+	{
+		kMismatchIntegerType::uint_type formInt = 0;
+		for (kMismatchIntegerType::uint_type rest = subset; rest; rest &= rest - 1)
+			formInt |= onePositions[std::countr_zero(rest)];
+		allInnerForms.insert(Form(cutRightZeros(formInt)));
+		if (rank + 1 < binomials[onesNumber][matches])
+			subset = CombinationRange::Iterator::nextBitPermutation(subset);
+	}
+}
 
-	generateInnerForms(matches, 1, 0);
+std::set<Form> Combination::getAllForms(uint64_t matches) const
+{
+	std::set<Form> allInnerForms;
+	collectInnerForms(this->sequenceInt, matches, allInnerForms);
+	return allInnerForms;
+}
 
+std::pmr::set<Form> Combination::getAllForms(uint64_t matches, std::pmr::memory_resource* resource) const
+{
+	std::pmr::set<Form> allInnerForms(resource);
+	collectInnerForms(this->sequenceInt, matches, allInnerForms);
 	return allInnerForms;
 }
 
@@ -146,30 +194,197 @@ std::set<Form> Combination::getAllForms(uint64_t matches) const
 // Returns: Vector of Combination objects representing all combinations
 std::vector<Combination> Combination::generateAllCombinations(uint64_t length, uint64_t mismatchK)
 {
+	CombinationRange range(length, mismatchK);
 	std::vector<Combination> allCombinations;
-	uint64_t zeros = mismatchK;
-	uint64_t ones = length - mismatchK;
+	allCombinations.reserve(range.size());
+	for (Combination combination : range)
+		allCombinations.push_back(combination);
+	return allCombinations;
+}
 
-	allCombinations.reserve(binom(length - 1, zeros));
+// A combination keeps its first position a match, the mismatches take mismatchK of the other positions.
+// Ascending integers of the mismatch bits follow the colexicographic order of the mismatch positions, whose rank
+// is the sum of C(position, i) over the i-th lowest position, and are the descending order of the combinations.
+CombinationRange::CombinationRange(uint64_t length, uint64_t mismatchK)
+	: length(length), mismatchK(mismatchK), first(0), last(0)
+{
+	if (!length || length > kMismatchIntegerType::UINT_TYPE_SIZE)
+		throw std::runtime_error("Combination length must be between 1 and " + std::to_string(kMismatchIntegerType::UINT_TYPE_SIZE) + "!");
+	this->last = mismatchK < length ? binomials[length - 1][mismatchK] : 0;
+	this->lengthMask = length == kMismatchIntegerType::UINT_TYPE_SIZE ? ~static_cast<kMismatchIntegerType::uint_type>(0)
+		: (static_cast<kMismatchIntegerType::uint_type>(1) << length) - 1;
+}
 
-	// Recursive function to generate combinations
-	std::function<void(uint64_t, uint64_t, kMismatchIntegerType::uint_type)> generateCombinations;
-	generateCombinations = [&allCombinations, &generateCombinations]
-	(uint64_t remainOnes, uint64_t remainZeros, kMismatchIntegerType::uint_type curCombinationInt) {
-		if (!remainOnes && !remainZeros)
-			allCombinations.push_back(Combination(curCombinationInt));
-		if (remainOnes)
-			generateCombinations(remainOnes - 1, remainZeros, (curCombinationInt << 1) | 1);
-		if (remainZeros)
-			generateCombinations(remainOnes, remainZeros - 1, curCombinationInt << 1);
-		};
+uint64_t CombinationRange::size() const
+{
+	return this->last - this->first;
+}
 
-	generateCombinations(ones - 1, zeros, 1);
+bool CombinationRange::empty() const
+{
+	return this->last == this->first;
+}
 
-	return allCombinations;
+uint64_t CombinationRange::getFirst() const
+{
+	return this->first;
+}
+
+CombinationRange::Iterator CombinationRange::begin() const
+{
+	if (this->empty())
+		return this->end();
+	return Iterator(unrankMismatches(this->first), this->lengthMask, this->first);
 }
 
+CombinationRange::Iterator CombinationRange::end() const
+{
+	return Iterator(0, this->lengthMask, this->last);
+}
+
+kMismatchIntegerType::uint_type CombinationRange::unrankMismatches(uint64_t rank) const
+{
+	kMismatchIntegerType::uint_type mismatches = 0;
+	uint64_t position = this->length - 1;
+	for (uint64_t i = this->mismatchK; i > 0; --i)
+	{
+		// The i-th mismatch is at the highest position with C(position, i) <= rank
+		do
+			--position;
+		while (binomials[position][i] > rank);
+		mismatches |= static_cast<kMismatchIntegerType::uint_type>(1) << position;
+		rank -= binomials[position][i];
+	}
+	return mismatches;
+}
 
+Combination CombinationRange::unrank(uint64_t rank) const
+{
+	return Combination(this->lengthMask & ~unrankMismatches(rank));
+}
+
+uint64_t CombinationRange::rank(const Combination& combination) const
+{
+	uint64_t rank = 0;
+	uint64_t i = 1;
+	for (kMismatchIntegerType::uint_type mismatches = this->lengthMask & ~combination.sequenceInt; mismatches; mismatches &= mismatches - 1)
+		rank += binomials[std::countr_zero(mismatches)][i++];
+	return rank;
+}
+
+CombinationRange CombinationRange::subrange(uint64_t first, uint64_t last) const
+{
+	CombinationRange range = *this;
+	range.first = std::clamp(first, this->first, this->last);
+	range.last = std::clamp(last, range.first, this->last);
+	return range;
+}
+
+std::vector<CombinationRange> CombinationRange::split(size_t parts) const
+{
+	std::vector<CombinationRange> ranges;
+	parts = std::max<size_t>(parts, 1);
+	for (size_t part = 0; part < parts; ++part)
+	{
+		CombinationRange range = subrange(this->first + this->size() * part / parts, this->first + this->size() * (part + 1) / parts);
+		if (!range.empty())
+			ranges.push_back(range);
+	}
+	return ranges;
+}
+
+// Number of combination ranks of a task of the coverage counts
+static constexpr uint64_t COVERAGE_BLOCK_RANKS = 1 << 14;
+
+// Returns a bitset with the ranks of all combinations of a range set
+static std::vector<uint64_t> allCombinationsBitset(const CombinationRange& combinations)
+{
+	std::vector<uint64_t> bitset((combinations.size() + 63) / 64, ~static_cast<uint64_t>(0));
+	if (combinations.size() % 64)
+		bitset.back() = (static_cast<uint64_t>(1) << (combinations.size() % 64)) - 1;
+	return bitset;
+}
+
+// Calls a function with the rank and the combination of every combination of a range whose rank is set in a bitset.
+// Runs of set ranks are stepped through by the range iterator, the first combination of a run is unranked.
+template <typename Function>
+static void forEachInBitset(const CombinationRange& combinations, const std::vector<uint64_t>& bitset, Function function)
+{
+	uint64_t first = combinations.getFirst();
+	uint64_t last = first + combinations.size();
+	CombinationRange::Iterator it;
+	bool positioned = false;
+	for (uint64_t word = first / 64; word * 64 < last; ++word)
+	{
+		uint64_t bits = bitset[word];
+		if (word == first / 64)
+			bits &= ~static_cast<uint64_t>(0) << (first % 64);
+		if ((word + 1) * 64 > last)
+			bits &= (static_cast<uint64_t>(1) << (last % 64)) - 1;
+		for (; bits; bits &= bits - 1)
+		{
+			uint64_t rank = word * 64 + std::countr_zero(bits);
+			if (!positioned || it.getRank() != rank)
+			{
+				it = combinations.subrange(rank, last).begin();
+				positioned = true;
+			}
+			function(rank, *it);
+			++it;
+		}
+	}
+}
+
+// Counts for every form the combinations of the bitset containing it, over blocks of ranks in parallel
+static std::vector<uint64_t> countCoverage(const std::vector<Form>& forms, const CombinationRange& combinations,
+	const std::vector<uint64_t>& uncovered)
+{
+	auto blocks = combinations.split((combinations.size() + COVERAGE_BLOCK_RANKS - 1) / COVERAGE_BLOCK_RANKS);
+	return std::transform_reduce(
+		std::execution::par,
+		blocks.begin(), blocks.end(),
+		std::vector<uint64_t>(forms.size(), 0),
+
+		// Sums the counts of two groups of blocks
+		[](std::vector<uint64_t> a, const std::vector<uint64_t>& b) {
+			for (size_t i = 0; i < a.size(); ++i)
+				a[i] += b[i];
+			return a;
+		},
+
+		// Counts the forms within the combinations of a block, each combination generated once for all forms
+		[&forms, &uncovered](const CombinationRange& block) {
+			KMISMATCH_TRACE_SPAN(coverageSpan, "mcs_coverage_block", "mcs", static_cast<int64_t>(block.getFirst()));
+			std::vector<uint64_t> counts(forms.size(), 0);
+			forEachInBitset(block, uncovered, [&forms, &counts](uint64_t, const Combination& combination) {
+				for (size_t i = 0; i < forms.size(); ++i)
+					counts[i] += combination.contains(forms[i]);
+				});
+			return counts;
+		});
+}
+
+// Clears the ranks of the combinations containing a form from the bitset, returns the number of cleared ranks
+static uint64_t removeCovered(const Form& form, const CombinationRange& combinations, std::vector<uint64_t>& uncovered)
+{
+	uint64_t removed = 0;
+	forEachInBitset(combinations, uncovered, [&form, &uncovered, &removed](uint64_t rank, const Combination& combination) {
+		if (combination.contains(form))
+		{
+			uncovered[rank / 64] &= ~(static_cast<uint64_t>(1) << (rank % 64));
+			removed++;
+		}
+		});
+	return removed;
+}
+
+static size_t bitsetCount(const std::vector<uint64_t>& bitset)
+{
+	size_t count = 0;
+	for (uint64_t word : bitset)
+		count += popcount(word);
+	return count;
+}
 
 const std::vector<Form>& MCS::getMcsForms() const
 {
@@ -178,63 +393,394 @@ const std::vector<Form>& MCS::getMcsForms() const
 
 MCS MCS::buildMCSNaiveMultithreaded(std::vector<std::string>& queries, uint64_t mismatchK)
 {
-	MCS resultMCS;
 	uint64_t length = 1;
 	for (auto& query : queries)
 		length = query.length() > length ? query.length() : length;
+	return buildMCSNaiveMultithreaded(length, mismatchK);
+}
+
+MCS MCS::buildMCSNaiveMultithreaded(uint64_t length, uint64_t mismatchK)
+{
+	MCS resultMCS;
 	if (mismatchK > length)
 	{
 		throw std::runtime_error("Mismatch number can not be greater than query length!");
 		exit(1);
 	}
 
-	auto combinations = Combination::generateAllCombinations(length, mismatchK);
+	KMISMATCH_STATS_STAGE(StatsStage::McsBuild);
+	KMISMATCH_TRACE_SPAN(mcsSpan, "mcs_build", "mcs", static_cast<int64_t>(length));
+	CombinationRange combinations(coverLength(length), mismatchK);
+	KMISMATCH_STATS(SearchStats::add(StatsCounter::McsCombinations, combinations.size()));
+	auto uncovered = allCombinationsBitset(combinations);
 	auto forms = Form::generateAllForms(length, mismatchK);
-	while (!combinations.empty())
+	coverGreedily(combinations, uncovered, forms, resultMCS.mcsForms);
+
+	//std::sort(resultMCS.mcsForms.begin(), resultMCS.mcsForms.end());
+
+	return resultMCS;
+}
+
+MCS MCS::buildMCSFromPool(uint64_t length, uint64_t mismatchK, std::vector<Form>& pool)
+{
+	MCS resultMCS;
+	if (mismatchK > length)
 	{
-		//Calcualate the form that contributes for the maximal number of combinations
-		auto bestFormToCombinationNumberPair = std::transform_reduce(
-			std::execution::par,  // Use a parallel execution policy
-			forms.begin(), forms.end(),  // Input range
-			std::pair<Form, uint64_t>{forms.front(), 0},  // Initial value
-
-			// Binary operation for reduction
-			// It takes two pairs of <Form, uint64_t> as input and returns the one with the greater count.
-			[](const std::pair<Form, uint64_t>& a, const std::pair<Form, uint64_t>& b) {
-				if (a.second == b.second)
-					return a.first < b.first ? a : b;
-				return a.second > b.second ? a : b;
-			},
-
-			// Unary operation for transformation
-			// It takes a Form as input and calculates the number of combinations containing that form.
-			// Returns a pair of <Form, uint64_t>, where the uint64_t value represents the count of combinations containing the form.
-			[&combinations](const Form& form) {
-				uint64_t curFormCombinationNumber = 0;
-				// Iterate over each combination
-				for (const Combination& combination : combinations) {
-					if (combination.contains(form)) {
-						curFormCombinationNumber++;
-					}
-				}
-				// Return a pair containing the form and the count of combinations containing it
-				return std::pair<Form, uint64_t>{form, curFormCombinationNumber};
-			});
+		throw std::runtime_error("Mismatch number can not be greater than query length!");
+		exit(1);
+	}
 
+	KMISMATCH_STATS_STAGE(StatsStage::McsBuild);
+	KMISMATCH_TRACE_SPAN(mcsSpan, "mcs_build", "mcs", static_cast<int64_t>(length));
+	CombinationRange combinations(coverLength(length), mismatchK);
+	KMISMATCH_STATS(SearchStats::add(StatsCounter::McsCombinations, combinations.size()));
+	auto uncovered = allCombinationsBitset(combinations);
+
+	// First reuse the pool forms that fit in the length, then complete the cover with new forms
+	std::vector<Form> poolForms;
+	std::copy_if(pool.begin(), pool.end(), std::back_inserter(poolForms),
+		[length](const Form& form) { return form.getSize() <= length; });
+	uint64_t remaining = combinations.size();
+	if (!poolForms.empty())
+		remaining = coverGreedily(combinations, uncovered, poolForms, resultMCS.mcsForms);
+	if (remaining)
+		coverGreedily(combinations, uncovered, Form::generateAllForms(length, mismatchK), resultMCS.mcsForms);
+
+	resultMCS.removeRedundantForms(length, mismatchK);
+	for (auto& form : resultMCS.mcsForms)
+		if (std::ranges::find(pool, form) == pool.end())
+			pool.push_back(form);
+
+	return resultMCS;
+}
+
+uint64_t MCS::coverGreedily(const CombinationRange& combinations, std::vector<uint64_t>& uncovered,
+	const std::vector<Form>& forms, std::vector<Form>& mcsForms, const std::vector<double>& formCosts)
+{
+	auto cost = [&formCosts](size_t i) { return formCosts.empty() ? 1.0 : formCosts[i]; };
+	uint64_t remaining = bitsetCount(uncovered);
+	while (remaining)
+	{
+		KMISMATCH_STATS(SearchStats::add(StatsCounter::McsContainsChecks, forms.size() * remaining));
+		KMISMATCH_TRACE_SPAN(iterationSpan, "mcs_greedy_iteration", "mcs", static_cast<int64_t>(remaining));
+
+		//Calculate the form that covers the maximal number of combinations per unit of cost
+		auto counts = countCoverage(forms, combinations, uncovered);
+		size_t best = 0;
+		for (size_t i = 1; i < forms.size(); ++i)
+		{
+			double score = counts[i] / cost(i);
+			double bestScore = counts[best] / cost(best);
+			if (score > bestScore || (score == bestScore && forms[i] < forms[best]))
+				best = i;
+		}
+
+		// None of the forms covers the remaining combinations
+		if (!counts[best])
+			break;
 
 		//Adding the best form the the MCS
-		resultMCS.mcsForms.push_back(bestFormToCombinationNumberPair.first);
+		KMISMATCH_STATS(SearchStats::add(StatsCounter::McsGreedyIterations, 1));
+		mcsForms.push_back(forms[best]);
 
 		//Removing the combinations, containing the best form form
-		auto newEndIt = std::remove_if(combinations.begin(), combinations.end(),
-			[&bestFormToCombinationNumberPair](const Combination& combination) {
-				return combination.contains(bestFormToCombinationNumberPair.first);
-			});
-		combinations.erase(newEndIt, combinations.end());
+		remaining -= removeCovered(forms[best], combinations, uncovered);
+	}
+	return remaining;
+}
+
+std::vector<double> MCS::estimateCandidatesPerLookup(const std::vector<Form>& forms, const std::string& textSample, size_t textSize)
+{
+	std::vector<double> candidatesPerLookup(forms.size(), 0.0);
+
+	std::transform(std::execution::par, forms.begin(), forms.end(), candidatesPerLookup.begin(),
+		[&textSample, textSize](const Form& form) {
+			if (form.getSize() > textSample.size())
+				return 0.0;
+
+			// Key frequency histogram of the form over the sample
+			ScratchArena arena;
+			std::pmr::unordered_map<std::pmr::string, size_t> keyFrequencies(arena.resource());
+			size_t windows = textSample.size() - form.getSize() + 1;
+			for (size_t pos = 0; pos < windows; ++pos)
+				keyFrequencies[form.getStringFromPosition(textSample, pos, arena.resource())]++;
+
+			// A query key follows the text key distribution, so a lookup is expected to
+			// return sum(p(key) * count(key)) = textSize * sum(p(key)^2) positions
+			double sumOfSquares = 0.0;
+			for (auto& [key, frequency] : keyFrequencies)
+			{
+				double probability = static_cast<double>(frequency) / windows;
+				sumOfSquares += probability * probability;
+			}
+			return sumOfSquares * textSize;
+		});
+
+	return candidatesPerLookup;
+}
 
+MCS MCS::buildMCSSelectivityAware(std::vector<std::string>& queries, uint64_t mismatchK, const std::string& textSample, size_t textSize)
+{
+	MCS resultMCS;
+	uint64_t length = 1;
+	for (auto& query : queries)
+		length = query.length() > length ? query.length() : length;
+	if (mismatchK > length)
+	{
+		throw std::runtime_error("Mismatch number can not be greater than query length!");
+		exit(1);
 	}
 
-	//std::sort(resultMCS.mcsForms.begin(), resultMCS.mcsForms.end());
+	KMISMATCH_STATS_STAGE(StatsStage::McsBuild);
+	KMISMATCH_TRACE_SPAN(mcsSpan, "mcs_build", "mcs", static_cast<int64_t>(length));
+	CombinationRange combinations(coverLength(length), mismatchK);
+	KMISMATCH_STATS(SearchStats::add(StatsCounter::McsCombinations, combinations.size()));
+	auto uncovered = allCombinationsBitset(combinations);
+	auto forms = Form::generateAllForms(length, mismatchK);
+	auto candidatesPerLookup = estimateCandidatesPerLookup(forms, textSample, textSize);
+
+	// Expected work of a form per query: one lookup per query offset plus the verification of its candidates
+	std::vector<double> formCosts(forms.size());
+	for (size_t i = 0; i < forms.size(); ++i)
+		formCosts[i] = static_cast<double>(length - forms[i].getSize() + 1) * (1.0 + candidatesPerLookup[i]);
+
+	coverGreedily(combinations, uncovered, forms, resultMCS.mcsForms, formCosts);
+	return resultMCS;
+}
+
+double MCS::predictCandidatesPerQuery(size_t queryLength, const std::string& textSample, size_t textSize) const
+{
+	auto candidatesPerLookup = estimateCandidatesPerLookup(this->mcsForms, textSample, textSize);
+	double candidates = 0.0;
+	for (size_t i = 0; i < this->mcsForms.size(); ++i)
+		if (this->mcsForms[i].getSize() <= queryLength)
+			candidates += (queryLength - this->mcsForms[i].getSize() + 1) * candidatesPerLookup[i];
+	return candidates;
+}
+
+// Returns the combinations containing the form as a bitset, one bit per combination rank
+static std::vector<uint64_t> formCoverage(const Form& form, const CombinationRange& combinations)
+{
+	std::vector<uint64_t> coverage((combinations.size() + 63) / 64, 0);
+	for (auto it = combinations.begin(); it != combinations.end(); ++it)
+		if ((*it).contains(form))
+			coverage[it.getRank() / 64] |= static_cast<uint64_t>(1) << (it.getRank() % 64);
+	return coverage;
+}
+
+// Combinations covered by at least one, two and three forms of a cover, one bit per combination rank
+struct CoverLevels
+{
+	std::vector<uint64_t> once;
+	std::vector<uint64_t> twice;
+	std::vector<uint64_t> thrice;
+};
+
+// Counts the forms of a cover up to three for every combination, word by word over the form coverages
+static CoverLevels coverLevels(const std::vector<std::vector<uint64_t>>& coverages, const std::vector<size_t>& cover,
+	size_t words)
+{
+	CoverLevels levels{ std::vector<uint64_t>(words, 0), std::vector<uint64_t>(words, 0), std::vector<uint64_t>(words, 0) };
+	for (size_t formIndex : cover)
+		for (size_t w = 0; w < words; ++w)
+		{
+			uint64_t coverage = coverages[formIndex][w];
+			levels.thrice[w] |= levels.twice[w] & coverage;
+			levels.twice[w] |= levels.once[w] & coverage;
+			levels.once[w] |= coverage;
+		}
+	return levels;
+}
+
+// Exact branch and bound set cover over precomputed form coverages.
+// Branches on the forms covering the first uncovered combination and prunes with
+// the bound chosen + ceil(uncovered / maximal coverage of a single form).
+class ExactCoverSearch
+{
+public:
+	ExactCoverSearch(const std::vector<std::vector<uint64_t>>& coverages, std::vector<size_t> bestCover,
+		std::chrono::steady_clock::time_point deadline)
+		: coverages(coverages), bestCover(std::move(bestCover)), deadline(deadline) {}
+
+	std::vector<size_t> solve(size_t combinationsNumber)
+	{
+		std::vector<uint64_t> uncovered((combinationsNumber + 63) / 64, ~static_cast<uint64_t>(0));
+		if (combinationsNumber % 64)
+			uncovered.back() = (static_cast<uint64_t>(1) << (combinationsNumber % 64)) - 1;
+		std::vector<size_t> chosen;
+		search(uncovered, chosen);
+		return bestCover;
+	}
+
+private:
+	void search(const std::vector<uint64_t>& uncovered, std::vector<size_t>& chosen)
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+			return;
+
+		size_t firstWord = 0;
+		while (firstWord < uncovered.size() && !uncovered[firstWord])
+			firstWord++;
+		if (firstWord == uncovered.size())
+		{
+			if (chosen.size() < bestCover.size())
+				bestCover = chosen;
+			return;
+		}
+		if (chosen.size() + 1 >= bestCover.size())
+			return;
+
+		uint64_t firstBit = uncovered[firstWord] & (~uncovered[firstWord] + 1);
+		size_t remaining = bitsetCount(uncovered);
+
+		// Candidate forms covering the first uncovered combination, the most covering first
+		std::vector<std::pair<size_t, size_t>> branches;
+		size_t maxCover = 0;
+		for (size_t i = 0; i < coverages.size(); ++i)
+		{
+			size_t cover = 0;
+			for (size_t w = 0; w < uncovered.size(); ++w)
+				cover += popcount(coverages[i][w] & uncovered[w]);
+			maxCover = std::max(maxCover, cover);
+			if (coverages[i][firstWord] & firstBit)
+				branches.emplace_back(cover, i);
+		}
+		if (!maxCover || chosen.size() + (remaining + maxCover - 1) / maxCover >= bestCover.size())
+			return;
+
+		std::sort(branches.begin(), branches.end(), std::greater<>());
+		std::vector<uint64_t> nextUncovered(uncovered.size());
+		for (auto& [cover, formIndex] : branches)
+		{
+			for (size_t w = 0; w < uncovered.size(); ++w)
+				nextUncovered[w] = uncovered[w] & ~coverages[formIndex][w];
+			chosen.push_back(formIndex);
+			search(nextUncovered, chosen);
+			chosen.pop_back();
+		}
+	}
+
+	const std::vector<std::vector<uint64_t>>& coverages;
+	std::vector<size_t> bestCover;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+MCS MCS::subsetForMismatches(uint64_t length, uint64_t mismatchK) const
+{
+	MCS resultMCS;
+	std::vector<Form> fittingForms;
+	std::copy_if(this->mcsForms.begin(), this->mcsForms.end(), std::back_inserter(fittingForms),
+		[length](const Form& form) { return form.getSize() <= length; });
+	if (fittingForms.empty())
+		return resultMCS;
+
+	CombinationRange combinations(coverLength(length), mismatchK);
+	auto uncovered = allCombinationsBitset(combinations);
+	if (coverGreedily(combinations, uncovered, fittingForms, resultMCS.mcsForms))
+		return MCS(fittingForms);
+
+	resultMCS.removeRedundantForms(length, mismatchK);
+	return resultMCS;
+}
+
+void MCS::removeRedundantForms(uint64_t length, uint64_t mismatchK)
+{
+	CombinationRange combinations(coverLength(length), mismatchK);
+	std::vector<std::vector<uint64_t>> coverages(this->mcsForms.size());
+	std::transform(std::execution::par, this->mcsForms.begin(), this->mcsForms.end(), coverages.begin(),
+		[&combinations](const Form& form) { return formCoverage(form, combinations); });
+
+	// A form is redundant when every combination it contains is covered twice, the levels being recounted
+	// after a removal
+	size_t words = (combinations.size() + 63) / 64;
+	std::vector<size_t> cover(this->mcsForms.size());
+	std::iota(cover.begin(), cover.end(), 0);
+	CoverLevels levels = coverLevels(coverages, cover, words);
+	for (size_t formIndex = this->mcsForms.size(); formIndex-- > 0;)
+	{
+		bool redundant = true;
+		for (size_t w = 0; w < words && redundant; ++w)
+			redundant = !(coverages[formIndex][w] & ~levels.twice[w]);
+		if (!redundant)
+			continue;
+		this->mcsForms.erase(this->mcsForms.begin() + formIndex);
+		cover.erase(cover.begin() + formIndex);
+		levels = coverLevels(coverages, cover, words);
+	}
+}
+
+MCS MCS::optimize(const MCS& mcs, uint64_t length, uint64_t mismatchK, std::chrono::milliseconds timeLimit)
+{
+	// Instances up to this number of combinations are solved exactly (within the time limit)
+	const size_t maxExactCombinations = 1 << 16;
+	auto deadline = std::chrono::steady_clock::now() + timeLimit;
+
+	MCS resultMCS = mcs;
+	resultMCS.removeRedundantForms(length, mismatchK);
+
+	CombinationRange combinations(coverLength(length), mismatchK);
+	std::vector<Form> candidates = Form::generateAllForms(length, mismatchK);
+	for (auto& form : resultMCS.mcsForms)
+		if (std::ranges::find(candidates, form) == candidates.end())
+			candidates.push_back(form);
+
+	std::vector<std::vector<uint64_t>> coverages(candidates.size());
+	std::transform(std::execution::par, candidates.begin(), candidates.end(), coverages.begin(),
+		[&combinations](const Form& form) { return formCoverage(form, combinations); });
+
+	// Current cover as indices into the candidates
+	std::vector<size_t> cover;
+	for (auto& form : resultMCS.mcsForms)
+		for (size_t i = 0; i < candidates.size(); ++i)
+			if (candidates[i] == form)
+			{
+				cover.push_back(i);
+				break;
+			}
+
+	// Local search: replace a pair of forms by a single form covering everything only the pair covers
+	size_t words = (combinations.size() + 63) / 64;
+	CoverLevels levels = coverLevels(coverages, cover, words);
+
+	bool improved = true;
+	while (improved && std::chrono::steady_clock::now() < deadline)
+	{
+		improved = false;
+		for (size_t a = 0; a < cover.size() && !improved; ++a)
+			for (size_t b = a + 1; b < cover.size() && !improved; ++b)
+			{
+				const auto& coverageA = coverages[cover[a]];
+				const auto& coverageB = coverages[cover[b]];
+				// Combinations of one form of the pair covered once, and of both covered twice
+				std::vector<uint64_t> needed(words);
+				for (size_t w = 0; w < words; ++w)
+					needed[w] = ((coverageA[w] ^ coverageB[w]) & ~levels.twice[w])
+						| (coverageA[w] & coverageB[w] & ~levels.thrice[w]);
+
+				for (size_t c = 0; c < candidates.size(); ++c)
+				{
+					bool coversNeeded = true;
+					for (size_t w = 0; w < needed.size() && coversNeeded; ++w)
+						coversNeeded = !(needed[w] & ~coverages[c][w]);
+					if (!coversNeeded)
+						continue;
+
+					cover[a] = c;
+					cover.erase(cover.begin() + b);
+					levels = coverLevels(coverages, cover, words);
+					improved = true;
+					break;
+				}
+			}
+	}
+
+	if (combinations.size() <= maxExactCombinations)
+		cover = ExactCoverSearch(coverages, cover, deadline).solve(combinations.size());
+
+	resultMCS.mcsForms.clear();
+	for (size_t formIndex : cover)
+		resultMCS.mcsForms.push_back(candidates[formIndex]);
+	resultMCS.removeRedundantForms(length, mismatchK);
 
 	return resultMCS;
 }
@@ -280,3 +826,8 @@ MCS::MCS()
 {
 	this->mcsForms = std::vector<Form>();
 }
+
+MCS::MCS(const std::vector<Form>& forms)
+{
+	this->mcsForms = forms;
+}
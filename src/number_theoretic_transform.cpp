@@ -0,0 +1,120 @@
+#include "number_theoretic_transform.h"
+#include <stdexcept>
+#include <string>
+
+/// Generator of the multiplicative group modulo MODULUS.
+static constexpr uint32_t PRIMITIVE_ROOT = 3;
+
+static inline uint32_t multiplyMod(uint32_t a, uint32_t b)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(a) * b % NumberTheoreticTransform::MODULUS);
+}
+
+static inline uint32_t addMod(uint32_t a, uint32_t b)
+{
+    uint32_t sum = a + b;
+    return sum >= NumberTheoreticTransform::MODULUS ? sum - NumberTheoreticTransform::MODULUS : sum;
+}
+
+static inline uint32_t subtractMod(uint32_t a, uint32_t b)
+{
+    return a >= b ? a - b : a + NumberTheoreticTransform::MODULUS - b;
+}
+
+// Multiplies by a constant w with its precomputed quotient floor(w * 2^32 / MODULUS) (Shoup's multiplication),
+// which replaces the 64-bit remainder by a multiplication and a conditional subtraction
+static inline uint32_t multiplyShoup(uint32_t a, uint32_t w, uint32_t wQuotient)
+{
+    uint32_t quotient = static_cast<uint32_t>((static_cast<uint64_t>(a) * wQuotient) >> 32);
+    uint32_t result = a * w - quotient * NumberTheoreticTransform::MODULUS;
+    return result >= NumberTheoreticTransform::MODULUS ? result - NumberTheoreticTransform::MODULUS : result;
+}
+
+static inline uint32_t shoupQuotient(uint32_t w)
+{
+    return static_cast<uint32_t>((static_cast<uint64_t>(w) << 32) / NumberTheoreticTransform::MODULUS);
+}
+
+static uint32_t powerMod(uint32_t base, uint64_t exponent)
+{
+    uint32_t result = 1;
+    for (; exponent; exponent >>= 1, base = multiplyMod(base, base))
+        if (exponent & 1)
+            result = multiplyMod(result, base);
+    return result;
+}
+
+NumberTheoreticTransform::NumberTheoreticTransform(size_t size)
+    : size(size), roots(size), rootQuotients(size), inverseRoots(size), inverseRootQuotients(size)
+{
+    if (!size || (size & (size - 1)) || size > MAX_SIZE)
+        throw std::runtime_error("Transform size must be a power of two of at most " + std::to_string(MAX_SIZE) + "!");
+
+    this->inverseSize = powerMod(static_cast<uint32_t>(size), MODULUS - 2);
+    for (size_t half = 1; half < size; half <<= 1)
+    {
+        uint32_t root = powerMod(PRIMITIVE_ROOT, (MODULUS - 1) / (2 * half));
+        uint32_t inverseRoot = powerMod(root, MODULUS - 2);
+        uint32_t power = 1;
+        uint32_t inversePower = 1;
+        for (size_t j = 0; j < half; ++j)
+        {
+            this->roots[half + j] = power;
+            this->rootQuotients[half + j] = shoupQuotient(power);
+            this->inverseRoots[half + j] = inversePower;
+            this->inverseRootQuotients[half + j] = shoupQuotient(inversePower);
+            power = multiplyMod(power, root);
+            inversePower = multiplyMod(inversePower, inverseRoot);
+        }
+    }
+}
+
+size_t NumberTheoreticTransform::getSize() const
+{
+    return this->size;
+}
+
+void NumberTheoreticTransform::forward(uint32_t* values) const
+{
+    // Decimation in frequency, the butterflies of the largest half first
+    for (size_t half = this->size >> 1; half >= 1; half >>= 1)
+    {
+        const uint32_t* twiddles = this->roots.data() + half;
+        const uint32_t* quotients = this->rootQuotients.data() + half;
+        for (size_t block = 0; block < this->size; block += 2 * half)
+            for (size_t j = 0; j < half; ++j)
+            {
+                uint32_t u = values[block + j];
+                uint32_t v = values[block + j + half];
+                values[block + j] = addMod(u, v);
+                values[block + j + half] = multiplyShoup(subtractMod(u, v), twiddles[j], quotients[j]);
+            }
+    }
+}
+
+void NumberTheoreticTransform::inverse(uint32_t* values) const
+{
+    // Decimation in time, the butterflies of the smallest half first
+    for (size_t half = 1; half < this->size; half <<= 1)
+    {
+        const uint32_t* twiddles = this->inverseRoots.data() + half;
+        const uint32_t* quotients = this->inverseRootQuotients.data() + half;
+        for (size_t block = 0; block < this->size; block += 2 * half)
+            for (size_t j = 0; j < half; ++j)
+            {
+                uint32_t u = values[block + j];
+                uint32_t v = multiplyShoup(values[block + j + half], twiddles[j], quotients[j]);
+                values[block + j] = addMod(u, v);
+                values[block + j + half] = subtractMod(u, v);
+            }
+    }
+    uint32_t inverseSizeQuotient = shoupQuotient(this->inverseSize);
+    for (size_t i = 0; i < this->size; ++i)
+        values[i] = multiplyShoup(values[i], this->inverseSize, inverseSizeQuotient);
+}
+
+void NumberTheoreticTransform::multiplyAccumulate(uint32_t* accumulator, const uint32_t* a, const uint32_t* b) const
+{
+    for (size_t i = 0; i < this->size; ++i)
+        accumulator[i] = addMod(accumulator[i], multiplyMod(a[i], b[i]));
+}
@@ -0,0 +1,385 @@
+#include "posting_index.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <execution>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+/// Keys per chunk of the parallel radix sort passes, below which a chunk is not worth its histogram.
+static constexpr size_t MIN_CHUNK_KEYS = 1 << 14;
+
+PostingIndex::Table::Table(const Form& form)
+    : form(form)
+{
+    for (size_t i = 0; i < form.getSize(); i++)
+        if (form.samples(i))
+            this->offsets.push_back(static_cast<uint32_t>(i));
+}
+
+const Form& PostingIndex::Table::getForm() const
+{
+    return this->form;
+}
+
+size_t PostingIndex::Table::getKeys() const
+{
+    return this->keys;
+}
+
+size_t PostingIndex::Table::getPostings() const
+{
+    return this->positions.size();
+}
+
+bool PostingIndex::Table::isDirect() const
+{
+    return this->direct;
+}
+
+bool PostingIndex::Table::packKey(const char* key, uint64_t& packedKey) const
+{
+    packedKey = 0;
+    for (size_t i = this->offsets.size(); i-- > 0;)
+    {
+        uint8_t code = this->codes[static_cast<unsigned char>(key[this->offsets[i]])];
+        if (code == NO_CODE)
+            return false;
+        packedKey = packedKey * this->alphabet.size() + code;
+    }
+    return true;
+}
+
+void PostingIndex::Table::writeKey(size_t group, char* key) const
+{
+    if (!this->packed)
+    {
+        for (size_t i = 0; i < this->offsets.size(); i++)
+            key[this->offsets[i]] = this->wideKeys[group * this->offsets.size() + i];
+        return;
+    }
+    uint64_t packedKey = this->direct ? group : this->packedKeys[group];
+    for (size_t i = 0; i < this->offsets.size(); i++, packedKey /= this->alphabet.size())
+        key[this->offsets[i]] = this->alphabet[packedKey % this->alphabet.size()];
+}
+
+std::span<const size_t> PostingIndex::Table::find(std::string_view key) const
+{
+    size_t group = 0;
+    if (this->packed)
+    {
+        uint64_t packedKey;
+        if (!packKey(key.data(), packedKey))
+            return {};
+        if (this->direct)
+            group = static_cast<size_t>(packedKey);
+        else
+        {
+            auto found = std::lower_bound(this->packedKeys.begin(), this->packedKeys.end(), packedKey);
+            if (found == this->packedKeys.end() || *found != packedKey)
+                return {};
+            group = static_cast<size_t>(found - this->packedKeys.begin());
+        }
+    }
+    else
+    {
+        // Binary search over the sampled symbols of the groups
+        size_t weight = this->offsets.size();
+        auto compare = [&](size_t g)
+        {
+            for (size_t i = 0; i < weight; i++)
+                if (this->wideKeys[g * weight + i] != key[this->offsets[i]])
+                    return static_cast<unsigned char>(this->wideKeys[g * weight + i]) < static_cast<unsigned char>(key[this->offsets[i]]) ? -1 : 1;
+            return 0;
+        };
+        size_t low = 0;
+        size_t high = this->starts.size() - 1;
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (compare(mid) < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (low == this->starts.size() - 1 || compare(low) != 0)
+            return {};
+        group = low;
+    }
+    return std::span<const size_t>(this->positions.data() + this->starts[group], this->starts[group + 1] - this->starts[group]);
+}
+
+void PostingIndex::radixSort(std::vector<uint64_t>& keys, std::vector<size_t>& positions, size_t bits)
+{
+    constexpr size_t RADIX = static_cast<size_t>(1) << RADIX_BITS;
+    size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    size_t chunks = std::clamp<size_t>(keys.size() / MIN_CHUNK_KEYS, 1, 4 * threads);
+    size_t chunkSize = (keys.size() + chunks - 1) / std::max<size_t>(chunks, 1);
+    std::vector<size_t> chunkIds(chunks);
+    std::iota(chunkIds.begin(), chunkIds.end(), 0);
+
+    std::vector<uint64_t> sortedKeys(keys.size());
+    std::vector<size_t> sortedPositions(positions.size());
+    std::vector<size_t> counts(chunks * RADIX);
+    for (size_t shift = 0; shift < bits; shift += RADIX_BITS)
+    {
+        // Digit counts of every chunk, then the output offset of every (digit, chunk) in digit major order,
+        // so that every chunk scatters its keys after the ones of the chunks before it
+        std::fill(counts.begin(), counts.end(), 0);
+        std::for_each(std::execution::par, chunkIds.begin(), chunkIds.end(),
+            [&](size_t chunk)
+            {
+                size_t* chunkCounts = counts.data() + chunk * RADIX;
+                for (size_t i = chunk * chunkSize; i < std::min(keys.size(), (chunk + 1) * chunkSize); i++)
+                    chunkCounts[(keys[i] >> shift) & (RADIX - 1)]++;
+            });
+        size_t offset = 0;
+        for (size_t digit = 0; digit < RADIX; digit++)
+            for (size_t chunk = 0; chunk < chunks; chunk++)
+                offset += std::exchange(counts[chunk * RADIX + digit], offset);
+        std::for_each(std::execution::par, chunkIds.begin(), chunkIds.end(),
+            [&](size_t chunk)
+            {
+                size_t* chunkOffsets = counts.data() + chunk * RADIX;
+                for (size_t i = chunk * chunkSize; i < std::min(keys.size(), (chunk + 1) * chunkSize); i++)
+                {
+                    size_t target = chunkOffsets[(keys[i] >> shift) & (RADIX - 1)]++;
+                    sortedKeys[target] = keys[i];
+                    sortedPositions[target] = positions[i];
+                }
+            });
+        keys.swap(sortedKeys);
+        positions.swap(sortedPositions);
+    }
+}
+
+template <typename WindowPosition, typename WindowKey>
+void PostingIndex::fillTable(Table& table, size_t windows, WindowPosition&& windowPosition, WindowKey&& windowKey)
+{
+    size_t weight = table.offsets.size();
+    std::vector<size_t> windowIds(windows);
+    std::iota(windowIds.begin(), windowIds.end(), 0);
+
+    // The key space of the form, if the packed keys fit 64 bits
+    uint64_t keySpace = 1;
+    table.packed = true;
+    for (size_t i = 0; i < weight && table.packed; i++)
+    {
+        if (keySpace > std::numeric_limits<uint64_t>::max() / std::max<size_t>(table.alphabet.size(), 1))
+            table.packed = false;
+        keySpace *= std::max<size_t>(table.alphabet.size(), 1);
+    }
+
+    if (table.packed)
+    {
+        std::vector<uint64_t> packedKeys(windows);
+        std::for_each(std::execution::par, windowIds.begin(), windowIds.end(),
+            [&](size_t window) { table.packKey(windowKey(window), packedKeys[window]); });
+        radixSort(packedKeys, windowIds, static_cast<size_t>(std::bit_width(keySpace - 1)));
+
+        table.direct = keySpace <= DIRECT_ADDRESS_MAX_KEYS;
+        if (table.direct)
+        {
+            // Offsets of every possible key, the keys being sorted
+            table.starts.assign(static_cast<size_t>(keySpace) + 1, 0);
+            for (uint64_t key : packedKeys)
+                table.starts[static_cast<size_t>(key) + 1]++;
+            for (size_t key = 0; key < keySpace; key++)
+                table.keys += table.starts[key + 1] != 0;
+            std::inclusive_scan(table.starts.begin(), table.starts.end(), table.starts.begin());
+        }
+        else
+        {
+            for (size_t i = 0; i < windows; i++)
+                if (i == 0 || packedKeys[i] != packedKeys[i - 1])
+                {
+                    table.packedKeys.push_back(packedKeys[i]);
+                    table.starts.push_back(i);
+                }
+            table.starts.push_back(windows);
+            table.keys = table.packedKeys.size();
+        }
+    }
+    else
+    {
+        // Keys too wide to pack are compared symbol by symbol
+        auto less = [&](size_t a, size_t b)
+        {
+            const char* keyA = windowKey(a);
+            const char* keyB = windowKey(b);
+            for (uint32_t offset : table.offsets)
+                if (keyA[offset] != keyB[offset])
+                    return static_cast<unsigned char>(keyA[offset]) < static_cast<unsigned char>(keyB[offset]);
+            return false;
+        };
+        std::stable_sort(std::execution::par, windowIds.begin(), windowIds.end(), less);
+        for (size_t i = 0; i < windows; i++)
+            if (i == 0 || less(windowIds[i - 1], windowIds[i]))
+            {
+                const char* key = windowKey(windowIds[i]);
+                for (uint32_t offset : table.offsets)
+                    table.wideKeys.push_back(key[offset]);
+                table.starts.push_back(i);
+            }
+        table.starts.push_back(windows);
+        table.keys = table.starts.size() - 1;
+    }
+
+    table.positions.resize(windows);
+    std::transform(std::execution::par, windowIds.begin(), windowIds.end(), table.positions.begin(),
+        [&](size_t window) { return windowPosition(window); });
+}
+
+PostingIndex PostingIndex::build(const std::string& text, const std::vector<Form>& forms, const std::vector<size_t>& documentStarts)
+{
+    // Codes of the text symbols, in byte order
+    std::array<bool, 256> present{};
+    for (unsigned char symbol : text)
+        present[symbol] = true;
+    std::string alphabet;
+    for (size_t symbol = 0; symbol < present.size(); symbol++)
+        if (present[symbol])
+            alphabet.push_back(static_cast<char>(symbol));
+
+    PostingIndex index;
+    for (auto& form : forms)
+    {
+        Table& table = index.tables.emplace_back(Table(form));
+        table.alphabet = alphabet;
+        table.codes.fill(NO_CODE);
+        for (size_t code = 0; code < alphabet.size(); code++)
+            table.codes[static_cast<unsigned char>(alphabet[code])] = static_cast<uint8_t>(code);
+        if (documentStarts.empty())
+        {
+            size_t windows = text.size() >= form.getSize() ? text.size() - form.getSize() + 1 : 0;
+            fillTable(table, windows, [](size_t window) { return window; },
+                [&](size_t window) { return text.data() + window; });
+            continue;
+        }
+
+        // The windows of every document, filled in parallel after the windows of the documents before it
+        std::vector<size_t> documentWindows(documentStarts.size() + 1, 0);
+        for (size_t document = 0; document < documentStarts.size(); document++)
+        {
+            size_t documentEnd = document + 1 < documentStarts.size() ? documentStarts[document + 1] : text.size();
+            size_t documentSize = documentEnd - documentStarts[document];
+            documentWindows[document + 1] = documentWindows[document]
+                + (documentSize >= form.getSize() ? documentSize - form.getSize() + 1 : 0);
+        }
+        std::vector<size_t> windowPositions(documentWindows.back());
+        std::vector<size_t> documents(documentStarts.size());
+        std::iota(documents.begin(), documents.end(), 0);
+        std::for_each(std::execution::par, documents.begin(), documents.end(),
+            [&](size_t document)
+            {
+                std::iota(windowPositions.begin() + documentWindows[document], windowPositions.begin() + documentWindows[document + 1],
+                    documentStarts[document]);
+            });
+        fillTable(table, windowPositions.size(), [&](size_t window) { return windowPositions[window]; },
+            [&](size_t window) { return text.data() + windowPositions[window]; });
+    }
+    return index;
+}
+
+PostingIndex PostingIndex::fromMap(const std::map<std::string, std::set<size_t>>& keys, const std::vector<Form>& forms)
+{
+    // Keys of every form, recognized by their size and the positions they sample
+    std::vector<std::vector<std::pair<const std::string*, size_t>>> formKeys(forms.size());
+    std::array<bool, 256> present{};
+    for (auto& [key, positions] : keys)
+    {
+        auto form = std::find_if(forms.begin(), forms.end(), [&](const Form& candidate)
+            {
+                if (candidate.getSize() != key.size())
+                    return false;
+                for (size_t i = 0; i < key.size(); i++)
+                    if (candidate.samples(i) == (key[i] == '_'))
+                        return false;
+                return true;
+            });
+        if (form == forms.end())
+            throw std::runtime_error("Index key " + key + " does not match any form of the MCS!");
+        for (size_t pos : positions)
+            formKeys[form - forms.begin()].emplace_back(&key, pos);
+        for (size_t i = 0; i < key.size(); i++)
+            if (form->samples(i))
+                present[static_cast<unsigned char>(key[i])] = true;
+    }
+    std::string alphabet;
+    for (size_t symbol = 0; symbol < present.size(); symbol++)
+        if (present[symbol])
+            alphabet.push_back(static_cast<char>(symbol));
+
+    PostingIndex index;
+    for (size_t f = 0; f < forms.size(); f++)
+    {
+        Table& table = index.tables.emplace_back(Table(forms[f]));
+        table.alphabet = alphabet;
+        table.codes.fill(NO_CODE);
+        for (size_t code = 0; code < alphabet.size(); code++)
+            table.codes[static_cast<unsigned char>(alphabet[code])] = static_cast<uint8_t>(code);
+        auto& windows = formKeys[f];
+        fillTable(table, windows.size(), [&](size_t window) { return windows[window].second; },
+            [&](size_t window) { return windows[window].first->data(); });
+    }
+    return index;
+}
+
+std::map<std::string, std::set<size_t>> PostingIndex::toMap() const
+{
+    std::map<std::string, std::set<size_t>> keys;
+    for (auto& table : this->tables)
+        table.forEach([&](const std::string& key, std::span<const size_t> positions)
+            {
+                keys[key].insert(positions.begin(), positions.end());
+            });
+    return keys;
+}
+
+bool PostingIndex::empty() const
+{
+    return this->tables.empty();
+}
+
+const PostingIndex::Table* PostingIndex::findTable(const Form& form) const
+{
+    for (auto& table : this->tables)
+        if (table.form == form)
+            return &table;
+    return nullptr;
+}
+
+size_t PostingIndex::getKeys() const
+{
+    size_t keys = 0;
+    for (auto& table : this->tables)
+        keys += table.keys;
+    return keys;
+}
+
+size_t PostingIndex::getPostings() const
+{
+    size_t postings = 0;
+    for (auto& table : this->tables)
+        postings += table.positions.size();
+    return postings;
+}
+
+size_t PostingIndex::memoryBytes() const
+{
+    size_t bytes = 0;
+    for (auto& table : this->tables)
+        bytes += sizeof(Table) + (table.starts.size() + table.positions.size()) * sizeof(size_t)
+            + table.packedKeys.size() * sizeof(uint64_t) + table.wideKeys.size();
+    return bytes;
+}
+
+double PostingIndex::estimateTableBytes(double windows, double keys, double keySpace, size_t weight)
+{
+    double groupBytes = keySpace < 18446744073709551616.0 ? sizeof(uint64_t) : static_cast<double>(weight);
+    if (keySpace <= static_cast<double>(DIRECT_ADDRESS_MAX_KEYS))
+        return sizeof(Table) + (keySpace + 1 + windows) * sizeof(size_t);
+    return sizeof(Table) + (keys + 1 + windows) * sizeof(size_t) + keys * groupBytes;
+}
@@ -0,0 +1,581 @@
+#include "resource_planner.h"
+#include "search_stats.h"
+#include "search_trace.h"
+#include "number_theoretic_transform.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+ResourcePlanner::ResourcePlanner(const KMismatchSearch& search, size_t misMatches, size_t segments, size_t sampleSize)
+    : search(search)
+{
+    this->misMatches = misMatches;
+    this->segments = segments;
+    this->sample = search.getTextSample(sampleSize);
+    this->threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    calibrate();
+}
+
+void ResourcePlanner::calibrate()
+{
+    // The calibration runs are not part of the statistics and the trace of the planned run
+    bool statsEnabled = SearchStats::isEnabled();
+    bool traceEnabled = SearchTrace::isEnabled();
+    SearchStats::setEnabled(false);
+    SearchTrace::setEnabled(false);
+
+    std::string calibrationText = sample.substr(0, std::min(sample.size(), CALIBRATION_SIZE));
+    std::vector<std::string> noQueries;
+    MCS calibrationMcs = search.getMcs().getMcsForms().empty() ? MCS({ Form(0b11) }) : search.getMcs();
+    KMismatchSearch calibration;
+    calibration.setText(calibrationText);
+    calibration.setQueries(noQueries);
+    calibration.setMcs(calibrationMcs);
+
+    // Index build, timed through a search without queries
+    size_t postings = 0;
+    for (auto& form : calibrationMcs.getMcsForms())
+        if (form.getSize() <= calibrationText.size())
+            postings += calibrationText.size() - form.getSize() + 1;
+    auto start = std::chrono::steady_clock::now();
+    calibration.mcsSearch(std::vector<size_t>());
+    auto end = std::chrono::steady_clock::now();
+    if (postings)
+        nsPerPosting = std::chrono::duration<double, std::nano>(end - start).count() / postings;
+
+    // Lookups of the text keys, as query keys follow the text distribution
+    const Form& lookupForm = calibrationMcs.getMcsForms().front();
+    size_t lookups = 0;
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    const PostingIndex::Table* lookupTable = calibration.getIndex().findTable(lookupForm);
+    for (size_t pos = 0; pos + lookupForm.getSize() <= calibrationText.size(); pos++, lookups++)
+        found += !lookupTable->find(lookupForm.getStringFromPosition(calibrationText, pos)).empty();
+    end = std::chrono::steady_clock::now();
+    if (lookups)
+        nsPerLookup = std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+
+    // Naive search of the first queries, its time per verification including the result collection
+    const size_t maxVerifications = 1 << 20;
+    size_t hits = 0;
+    std::vector<std::string> scanQueries;
+    std::vector<size_t> scanMisMatches;
+    for (auto& query : search.getQueries())
+    {
+        if ((scanQueries.size() + 1) * calibrationText.size() > maxVerifications && !scanQueries.empty())
+            break;
+        if (query.size() < misMatches)
+            continue;
+        scanQueries.push_back(query);
+        scanMisMatches.push_back(misMatches);
+    }
+    calibration.setQueries(scanQueries);
+    start = std::chrono::steady_clock::now();
+    hits += calibration.naiveSearch(scanMisMatches).size();
+    end = std::chrono::steady_clock::now();
+    size_t verifications = scanQueries.size() * calibrationText.size();
+    if (verifications)
+        nsPerScanVerification = std::chrono::duration<double, std::nano>(end - start).count() * threads / verifications;
+
+    // MCS search of the first queries, its time per candidate including the position collection past the lookups
+    const size_t maxMcsQueries = 16;
+    std::vector<std::string> mcsQueries;
+    std::vector<size_t> mcsMisMatches;
+    size_t mcsLookups = 0;
+    for (auto& query : search.getQueries())
+    {
+        if (mcsQueries.size() == maxMcsQueries)
+            break;
+        if (query.size() <= misMatches)
+            continue;
+        mcsQueries.push_back(query);
+        mcsMisMatches.push_back(misMatches);
+        for (auto& form : calibrationMcs.getMcsForms())
+            if (form.getSize() <= query.size())
+                mcsLookups += query.size() - form.getSize() + 1;
+    }
+    calibration.setQueries(mcsQueries);
+    start = std::chrono::steady_clock::now();
+    hits += calibration.mcsSearch(mcsMisMatches).size();
+    end = std::chrono::steady_clock::now();
+    if (calibration.getLastCandidatesCount())
+        nsPerVerification = std::max((std::chrono::duration<double, std::nano>(end - start).count() * threads
+            - mcsLookups * nsPerLookup) / calibration.getLastCandidatesCount(), 0.0);
+
+    // Transforms and pointwise products of the FFT search
+    NumberTheoreticTransform transform(CALIBRATION_TRANSFORM_SIZE);
+    std::vector<uint32_t> values(CALIBRATION_TRANSFORM_SIZE);
+    std::vector<uint32_t> accumulator(CALIBRATION_TRANSFORM_SIZE, 0);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = calibrationText.empty() ? 0 : calibrationText[i % calibrationText.size()] == calibrationText[0];
+    start = std::chrono::steady_clock::now();
+    transform.forward(values.data());
+    transform.inverse(values.data());
+    end = std::chrono::steady_clock::now();
+    nsPerButterfly = std::chrono::duration<double, std::nano>(end - start).count()
+        / (2 * CALIBRATION_TRANSFORM_SIZE * std::log2(CALIBRATION_TRANSFORM_SIZE));
+    start = std::chrono::steady_clock::now();
+    transform.multiplyAccumulate(accumulator.data(), values.data(), values.data());
+    end = std::chrono::steady_clock::now();
+    nsPerProduct = std::chrono::duration<double, std::nano>(end - start).count() / CALIBRATION_TRANSFORM_SIZE;
+
+    // FM-index build, and backward search steps of the first queries
+    start = std::chrono::steady_clock::now();
+    auto fmIndex = FmIndex::build(calibrationText);
+    end = std::chrono::steady_clock::now();
+    if (!calibrationText.empty())
+        nsPerFmSymbol = std::chrono::duration<double, std::nano>(end - start).count() / calibrationText.size();
+    const size_t maxFmQueries = 64;
+    size_t steps = 0;
+    size_t fmQueries = 0;
+    std::pmr::vector<size_t> positions;
+    start = std::chrono::steady_clock::now();
+    for (auto& query : search.getQueries())
+    {
+        if (fmQueries++ == maxFmQueries)
+            break;
+        positions.clear();
+        steps += fmIndex->search(query, std::min(misMatches, query.size()), positions, std::pmr::get_default_resource());
+        hits += positions.size();
+    }
+    end = std::chrono::steady_clock::now();
+    if (steps)
+    {
+        nsPerFmStep = std::chrono::duration<double, std::nano>(end - start).count() / steps;
+        fmStepsPerQuery = static_cast<double>(steps) / std::min(fmQueries, maxFmQueries);
+    }
+
+    // Aho-Corasick scan of the pieces of the first queries, with the seed hits it reports
+    const size_t maxSeedQueries = 64;
+    std::vector<std::string> pieces;
+    for (auto& query : search.getQueries())
+    {
+        if (pieces.size() >= maxSeedQueries * (misMatches + 1))
+            break;
+        if (query.size() > misMatches)
+            for (auto& [offset, pieceLength] : KMismatchSearch::splitQuery(query.size(), misMatches + 1))
+                pieces.push_back(query.substr(offset, pieceLength));
+    }
+    AhoCorasick automaton(pieces);
+    size_t seedHits = 0;
+    start = std::chrono::steady_clock::now();
+    automaton.scan(calibrationText.data(), calibrationText.data() + calibrationText.size(),
+        [&](uint32_t, size_t) { seedHits++; });
+    end = std::chrono::steady_clock::now();
+    if (!calibrationText.empty())
+        nsPerSeedSymbol = std::chrono::duration<double, std::nano>(end - start).count() / calibrationText.size();
+
+    // Seed search of the same queries, whose candidates are collected, sorted and verified apart from the scan
+    std::vector<std::string> seedQueries;
+    std::vector<size_t> seedMisMatches;
+    for (auto& query : search.getQueries())
+    {
+        if (seedQueries.size() == maxSeedQueries)
+            break;
+        if (query.size() > misMatches)
+        {
+            seedQueries.push_back(query);
+            seedMisMatches.push_back(misMatches);
+        }
+    }
+    calibration.setQueries(seedQueries);
+    start = std::chrono::steady_clock::now();
+    hits += calibration.seedSearch(seedMisMatches).size();
+    end = std::chrono::steady_clock::now();
+    if (calibration.getLastCandidatesCount())
+        nsPerSeedCandidate = std::max((std::chrono::duration<double, std::nano>(end - start).count() * threads
+            - calibrationText.size() * nsPerSeedSymbol) / calibration.getLastCandidatesCount(), nsPerVerification);
+
+    SearchStats::setEnabled(statsEnabled);
+    SearchTrace::setEnabled(traceEnabled);
+    // The counts are kept so the timed loops are not optimized away
+    volatile size_t calibrationSink = seedHits + found + hits;
+    (void)calibrationSink;
+}
+
+double ResourcePlanner::baseBytes() const
+{
+    double queriesBytes = 0.0;
+    for (auto& query : search.getQueries())
+        queriesBytes += sizeof(std::string) + (query.size() > SSO_CAPACITY ? query.size() + 1 : 0);
+    // The index build and the naive search iterate over a vector of all text positions
+    return static_cast<double>(search.getText().size()) * (1 + sizeof(size_t)) + queriesBytes;
+}
+
+void ResourcePlanner::estimateIndex(const std::vector<Form>& forms, EnginePlan& plan) const
+{
+    double textSize = static_cast<double>(search.getText().size());
+    std::unordered_set<char> alphabet(sample.begin(), sample.end());
+    double sigma = std::max<double>(alphabet.size(), 1.0);
+
+    plan.forms = forms.size();
+    for (auto& form : forms)
+    {
+        size_t formSize = form.getSize();
+        if (formSize > textSize)
+            continue;
+        // The windows crossing two documents of a corpus are not indexed
+        double windows = textSize - formSize + 1;
+        const std::vector<size_t>& documentStarts = search.getDocumentStarts();
+        if (!documentStarts.empty())
+        {
+            windows = 0.0;
+            for (size_t document = 0; document < documentStarts.size(); document++)
+            {
+                size_t documentEnd = document + 1 < documentStarts.size() ? documentStarts[document + 1] : search.getText().size();
+                if (documentEnd - documentStarts[document] >= formSize)
+                    windows += documentEnd - documentStarts[document] - formSize + 1;
+            }
+            if (windows == 0.0)
+                continue;
+        }
+        size_t weight = form.getWeight();
+        double keySpace = std::pow(sigma, static_cast<double>(weight));
+
+        std::unordered_set<std::string> sampleKeys;
+        double sampleWindows = sample.size() >= formSize ? sample.size() - formSize + 1.0 : 0.0;
+        for (size_t pos = 0; pos + formSize <= sample.size(); pos++)
+            sampleKeys.insert(form.getStringFromPosition(sample, pos));
+        double distinct = static_cast<double>(sampleKeys.size());
+
+        // Effective key space U with U * (1 - exp(-n / U)) distinct keys expected in n sample windows
+        double space = keySpace;
+        if (distinct < sampleWindows)
+        {
+            double low = std::max(distinct, 1.0);
+            double high = keySpace;
+            for (int i = 0; i < 100 && low < high * 0.999; i++)
+            {
+                double mid = std::sqrt(low * high);
+                if (mid * (1.0 - std::exp(-sampleWindows / mid)) < distinct)
+                    low = mid;
+                else
+                    high = mid;
+            }
+            space = high;
+        }
+        double keys = std::min(std::max(space * (1.0 - std::exp(-windows / space)), distinct), windows);
+
+        plan.indexKeys += keys;
+        plan.indexPostings += windows;
+        plan.indexBytes += PostingIndex::estimateTableBytes(windows, keys, keySpace, weight);
+    }
+    plan.peakBytes = baseBytes() + plan.indexBytes;
+}
+
+EnginePlan ResourcePlanner::planEngine(const std::string& engine) const
+{
+    return planEngine(engine, search.getQueries());
+}
+
+EnginePlan ResourcePlanner::planEngine(const std::string& engine, const std::vector<std::string>& queries) const
+{
+    EnginePlan plan;
+    plan.engine = engine;
+    double textSize = static_cast<double>(search.getText().size());
+
+    if (engine == "naive")
+    {
+        plan.candidatesPerQuery = textSize;
+        plan.peakBytes = baseBytes();
+        plan.seconds = textSize * queries.size() * nsPerScanVerification / threads / 1e9;
+        return plan;
+    }
+
+    if (engine == "fft")
+    {
+        // Queries that fit in the text, and the symbols they use
+        std::unordered_set<char> alphabet;
+        size_t searched = 0;
+        size_t longest = 0;
+        size_t shortest = search.getText().size();
+        for (auto& query : queries)
+            if (!query.empty() && query.size() <= search.getText().size())
+            {
+                searched++;
+                longest = std::max(longest, query.size());
+                shortest = std::min(shortest, query.size());
+                alphabet.insert(query.begin(), query.end());
+            }
+        // The FFT search does not iterate over a vector of all text positions
+        plan.peakBytes = baseBytes() - textSize * sizeof(size_t);
+        if (!searched)
+            return plan;
+
+        double blockSize = 0.0;
+        try
+        {
+            blockSize = static_cast<double>(KMismatchSearch::fftBlockSize(longest, search.getText().size()));
+        }
+        catch (const std::exception& e)
+        {
+            plan.available = false;
+            plan.note = e.what();
+            return plan;
+        }
+        double sigma = static_cast<double>(alphabet.size());
+        double blocks = std::ceil((textSize - shortest + 1) / (blockSize - longest + 1));
+        double transforms = blocks * (sigma + searched) + searched * sigma;
+        plan.candidatesPerQuery = textSize;
+        plan.peakBytes += (searched * sigma + threads * (sigma + 1)) * blockSize * sizeof(uint32_t);
+        plan.seconds = (transforms * blockSize * std::log2(blockSize) * nsPerButterfly
+            + blocks * searched * sigma * blockSize * nsPerProduct) / threads / 1e9;
+        // The transforms of the text blocks serve all the queries
+        plan.buildSeconds = blocks * sigma * blockSize * std::log2(blockSize) * nsPerButterfly / threads / 1e9;
+        return plan;
+    }
+
+    if (engine == "fm")
+    {
+        std::unordered_set<char> alphabet(sample.begin(), sample.end());
+        plan.indexBytes = static_cast<double>(FmIndex::estimateBytes(search.getText().size(), alphabet.size()));
+        // The suffix sorting buffers are freed as the index is filled, the peak is bounded by both together
+        plan.peakBytes = baseBytes() - textSize * sizeof(size_t) + plan.indexBytes
+            + static_cast<double>(FmIndex::estimateBuildBytes(search.getText().size()));
+        // Backtracking explores the substrings of the text close to the queries, whose number grows about
+        // with the logarithm of the text size, from the steps measured on the calibration text
+        double calibrationSize = static_cast<double>(std::min(sample.size(), CALIBRATION_SIZE));
+        double stepsScale = calibrationSize > 1.0 ? std::max(std::log2(textSize) / std::log2(calibrationSize), 1.0) : 1.0;
+        // A loaded index is not built again
+        plan.buildSeconds = search.getFmIndex() ? 0.0 : textSize * nsPerFmSymbol / 1e9;
+        plan.seconds = plan.buildSeconds + queries.size() * fmStepsPerQuery * stepsScale * nsPerFmStep / threads / 1e9;
+        return plan;
+    }
+
+    if (engine == "seed")
+    {
+        // Every piece of a query is an exact seed, found about as often as a contiguous form of its length
+        std::unordered_set<char> alphabet;
+        std::map<size_t, double> hitsPerLength;
+        double patternSymbols = 0.0;
+        double candidates = 0.0;
+        double scannedPositions = 0.0;
+        for (auto& query : queries)
+        {
+            if (query.size() < misMatches + 1)
+            {
+                scannedPositions += textSize;
+                continue;
+            }
+            alphabet.insert(query.begin(), query.end());
+            patternSymbols += query.size();
+            for (auto& [offset, pieceLength] : KMismatchSearch::splitQuery(query.size(), misMatches + 1))
+            {
+                size_t formLength = std::min<size_t>(pieceLength, kMismatchIntegerType::UINT_TYPE_SIZE);
+                if (!hitsPerLength.contains(formLength))
+                {
+                    Form form(formLength == kMismatchIntegerType::UINT_TYPE_SIZE ? ~0ULL : (1ULL << formLength) - 1);
+                    hitsPerLength[formLength] = MCS::estimateCandidatesPerLookup({ form }, sample, search.getText().size())[0];
+                }
+                candidates += hitsPerLength[formLength];
+            }
+        }
+        plan.indexBytes = static_cast<double>(AhoCorasick::estimateBytes(static_cast<size_t>(patternSymbols), alphabet.size()));
+        // The seed search does not iterate over a vector of all text positions
+        plan.peakBytes = baseBytes() - textSize * sizeof(size_t) + plan.indexBytes;
+        if (!queries.empty())
+            plan.candidatesPerQuery = (candidates + scannedPositions) / queries.size();
+        plan.seconds = (textSize * nsPerSeedSymbol + candidates * nsPerSeedCandidate
+            + scannedPositions * nsPerScanVerification) / threads / 1e9;
+        plan.buildSeconds = textSize * nsPerSeedSymbol / threads / 1e9;
+        return plan;
+    }
+
+    double lookups = 0.0;
+    double candidates = 0.0;
+    double scannedPositions = 0.0;
+    if (engine == "mcs")
+    {
+        if (search.getMcs().getMcsForms().empty())
+        {
+            plan.available = false;
+            plan.note = "no MCS";
+            return plan;
+        }
+        estimateIndex(search.getMcs().getMcsForms(), plan);
+
+        std::map<size_t, double> candidatesPerLength;
+        for (auto& query : queries)
+        {
+            auto bucketMcs = search.getLengthMcs().find(query.size());
+            const MCS& formsMcs = bucketMcs == search.getLengthMcs().end() ? search.getMcs() : bucketMcs->second;
+            // Queries too short for an MCS are checked on every text position
+            if (formsMcs.getMcsForms().empty())
+            {
+                scannedPositions += textSize;
+                continue;
+            }
+            for (auto& form : formsMcs.getMcsForms())
+                if (form.getSize() <= query.size())
+                    lookups += query.size() - form.getSize() + 1;
+            if (!candidatesPerLength.contains(query.size()))
+                candidatesPerLength[query.size()] = formsMcs.predictCandidatesPerQuery(query.size(), sample, search.getText().size());
+            candidates += candidatesPerLength[query.size()];
+        }
+    }
+    else if (engine == "segment")
+    {
+        MCS mcs;
+        try
+        {
+            mcs = KMismatchSearch::segmentMcs(queries, misMatches, segments);
+        }
+        catch (const std::exception& e)
+        {
+            plan.available = false;
+            plan.note = e.what();
+            return plan;
+        }
+        estimateIndex(mcs.getMcsForms(), plan);
+
+        auto candidatesPerLookup = MCS::estimateCandidatesPerLookup(mcs.getMcsForms(), sample, search.getText().size());
+        for (auto& query : queries)
+            for (auto& [offset, segmentLength] : KMismatchSearch::splitQuery(query.size(), std::max(segments, misMatches + 1)))
+                for (size_t i = 0; i < mcs.getMcsForms().size(); i++)
+                {
+                    size_t formSize = mcs.getMcsForms()[i].getSize();
+                    if (formSize > segmentLength)
+                        continue;
+                    lookups += segmentLength - formSize + 1;
+                    candidates += (segmentLength - formSize + 1) * candidatesPerLookup[i];
+                }
+    }
+    else
+        throw std::runtime_error("Unknown engine: " + engine);
+
+    if (!queries.empty())
+        plan.candidatesPerQuery = (candidates + scannedPositions) / queries.size();
+    // A loaded or already built index is not built again
+    bool indexed = engine == "mcs" && !search.getIndex().empty();
+    plan.buildSeconds = indexed ? 0.0 : plan.indexPostings * nsPerPosting / 1e9;
+    plan.seconds = plan.buildSeconds + (lookups * nsPerLookup + candidates * nsPerVerification
+        + scannedPositions * nsPerScanVerification) / threads / 1e9;
+    return plan;
+}
+
+EngineSelection ResourcePlanner::selectEngines(const std::vector<std::string>& engines, size_t memCapBytes) const
+{
+    EngineSelection selection;
+    const std::vector<std::string>& queries = search.getQueries();
+    std::map<size_t, std::vector<size_t>> lengthGroups;
+    for (size_t q = 0; q < queries.size(); q++)
+        lengthGroups[queries[q].size()].push_back(q);
+
+    // Engines within the memory cap over all the queries, as the picked ones may search all of them
+    std::vector<EnginePlan> candidates;
+    for (auto& engine : engines)
+    {
+        if (engine == "segment")
+            throw std::runtime_error("The segment engine can not be selected automatically!");
+        EnginePlan plan = planEngine(engine);
+        selection.plans.push_back(plan);
+        if (plan.available && (!memCapBytes || plan.peakBytes <= memCapBytes))
+            candidates.push_back(plan);
+    }
+    if (candidates.empty() || lengthGroups.empty())
+        return selection;
+    if (candidates.size() > MAX_SELECTED_ENGINES)
+        throw std::runtime_error("Too many engines to select from!");
+
+    // Time of every group with every engine, without the shared part
+    std::vector<std::vector<double>> groupSeconds(lengthGroups.size(), std::vector<double>(candidates.size()));
+    size_t group = 0;
+    for (auto& [length, indices] : lengthGroups)
+    {
+        std::vector<std::string> groupQueries;
+        for (size_t q : indices)
+            groupQueries.push_back(queries[q]);
+        for (size_t e = 0; e < candidates.size(); e++)
+        {
+            EnginePlan plan = planEngine(candidates[e].engine, groupQueries);
+            groupSeconds[group][e] = plan.available ? std::max(plan.seconds - plan.buildSeconds, 0.0)
+                : std::numeric_limits<double>::infinity();
+        }
+        group++;
+    }
+
+    // Every subset of the engines, each group taking its fastest engine of the subset
+    double bestSeconds = std::numeric_limits<double>::infinity();
+    size_t bestSubset = 0;
+    for (size_t subset = 1; subset < (static_cast<size_t>(1) << candidates.size()); subset++)
+    {
+        double seconds = 0.0;
+        for (size_t e = 0; e < candidates.size(); e++)
+            if (subset >> e & 1)
+                seconds += candidates[e].buildSeconds;
+        for (auto& engineSeconds : groupSeconds)
+        {
+            double fastest = std::numeric_limits<double>::infinity();
+            for (size_t e = 0; e < candidates.size(); e++)
+                if (subset >> e & 1)
+                    fastest = std::min(fastest, engineSeconds[e]);
+            seconds += fastest;
+        }
+        if (seconds < bestSeconds)
+        {
+            bestSeconds = seconds;
+            bestSubset = subset;
+        }
+    }
+    if (!bestSubset)
+        return selection;
+
+    group = 0;
+    for (auto& [length, indices] : lengthGroups)
+    {
+        size_t fastest = candidates.size();
+        for (size_t e = 0; e < candidates.size(); e++)
+            if ((bestSubset >> e & 1) && (fastest == candidates.size() || groupSeconds[group][e] < groupSeconds[group][fastest]))
+                fastest = e;
+        QueryGroupPlan groupPlan;
+        groupPlan.queryLength = length;
+        groupPlan.queryIndices = indices;
+        groupPlan.engine = candidates[fastest].engine;
+        groupPlan.seconds = groupSeconds[group][fastest];
+        selection.groups.push_back(groupPlan);
+        if (!selection.engineSeconds.contains(groupPlan.engine))
+            selection.engineSeconds[groupPlan.engine] = candidates[fastest].buildSeconds;
+        selection.engineSeconds[groupPlan.engine] += groupPlan.seconds;
+        group++;
+    }
+    return selection;
+}
+
+std::vector<EnginePlan> ResourcePlanner::planAll() const
+{
+    return { planEngine("mcs"), planEngine("segment"), planEngine("naive"), planEngine("fft"), planEngine("fm"), planEngine("seed") };
+}
+
+std::string ResourcePlanner::formatPlans(const std::vector<EnginePlan>& plans, size_t memCapBytes) const
+{
+    const double megabyte = 1024.0 * 1024.0;
+    std::ostringstream oss;
+    oss << "Plan: " << search.getText().size() << " text symbols, " << search.getQueries().size() << " queries, "
+        << misMatches << " mismatches, " << sample.size() << " sampled symbols, " << threads << " threads\n";
+    oss << std::left << std::setw(9) << "engine" << std::right << std::setw(7) << "forms" << std::setw(14) << "index_keys"
+        << std::setw(14) << "postings" << std::setw(12) << "index_MB" << std::setw(12) << "peak_MB"
+        << std::setw(16) << "cand/query" << std::setw(12) << "time_s" << "\n";
+    for (auto& plan : plans)
+    {
+        oss << std::left << std::setw(9) << plan.engine << std::right;
+        if (!plan.available)
+        {
+            oss << "  unavailable: " << plan.note << "\n";
+            continue;
+        }
+        oss << std::fixed << std::setprecision(0) << std::setw(7) << plan.forms << std::setw(14) << plan.indexKeys
+            << std::setw(14) << plan.indexPostings << std::setprecision(1) << std::setw(12) << plan.indexBytes / megabyte
+            << std::setw(12) << plan.peakBytes / megabyte << std::setw(16) << plan.candidatesPerQuery
+            << std::setprecision(3) << std::setw(12) << plan.seconds;
+        if (memCapBytes && plan.peakBytes > memCapBytes)
+            oss << "  exceeds memory cap";
+        oss << "\n";
+    }
+    return oss.str();
+}
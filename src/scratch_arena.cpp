@@ -0,0 +1,45 @@
+#include "scratch_arena.h"
+
+/// Size of the buffer every task starts allocating from.
+static constexpr size_t INITIAL_BUFFER_SIZE = 64 * 1024;
+
+/// Largest block kept by the pool, larger buffers go to malloc.
+static constexpr size_t LARGEST_POOL_BLOCK = 4 * 1024 * 1024;
+
+struct ScratchArena::ThreadResources
+{
+    ThreadResources()
+        : pool(std::pmr::pool_options{ 0, LARGEST_POOL_BLOCK }, std::pmr::new_delete_resource()),
+          monotonic(initialBuffer.get(), INITIAL_BUFFER_SIZE, &pool)
+    {
+    }
+
+    std::unique_ptr<std::byte[]> initialBuffer = std::make_unique<std::byte[]>(INITIAL_BUFFER_SIZE);  ///< First buffer of every task.
+    std::pmr::unsynchronized_pool_resource pool;  ///< Keeps the buffers the monotonic resource grew into.
+    std::pmr::monotonic_buffer_resource monotonic;  ///< The allocator of the tasks.
+    size_t depth = 0;  ///< Number of arenas the thread is in.
+};
+
+ScratchArena::ThreadResources& ScratchArena::local()
+{
+    // Allocated on the heap, as a large static TLS block does not fit a dynamically loaded library
+    thread_local std::unique_ptr<ThreadResources> threadResources = std::make_unique<ThreadResources>();
+    return *threadResources;
+}
+
+ScratchArena::ScratchArena()
+    : resources(local())
+{
+    resources.depth++;
+}
+
+ScratchArena::~ScratchArena()
+{
+    if (--resources.depth == 0)
+        resources.monotonic.release();
+}
+
+std::pmr::memory_resource* ScratchArena::resource() const
+{
+    return &resources.monotonic;
+}
@@ -0,0 +1,154 @@
+#include "search_stats.h"
+
+std::atomic<bool> SearchStats::enabled = false;
+std::mutex SearchStats::registryMutex;
+std::vector<std::unique_ptr<SearchStats::ThreadStats>> SearchStats::registry;
+std::array<std::atomic<uint64_t>, static_cast<size_t>(StatsGauge::Count)> SearchStats::gauges{};
+
+static const char* const counterNames[] = {
+    "mcs_combinations", "mcs_greedy_iterations", "mcs_contains_checks", "queries", "duplicate_queries",
+    "lookups", "shared_lookups", "candidates", "verifications", "hits"
+};
+static const char* const gaugeNames[] = { "mcs_forms", "index_keys", "index_postings" };
+static const char* const stageNames[] = {
+    "mcs_build_ms", "index_build_ms", "search_ms", "lookup_thread_ms", "verification_thread_ms"
+};
+
+bool SearchStats::isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void SearchStats::setEnabled(bool enable)
+{
+    enabled = enable;
+}
+
+SearchStats::ThreadStats& SearchStats::local()
+{
+    thread_local ThreadStats* threadStats = nullptr;
+    if (!threadStats)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadStats>());
+        threadStats = registry.back().get();
+    }
+    return *threadStats;
+}
+
+void SearchStats::add(StatsCounter counter, uint64_t value)
+{
+    local().counters[static_cast<size_t>(counter)] += value;
+}
+
+void SearchStats::set(StatsGauge gauge, uint64_t value)
+{
+    gauges[static_cast<size_t>(gauge)] = value;
+}
+
+void SearchStats::addStageTime(StatsStage stage, uint64_t nanoseconds)
+{
+    local().stageNanoseconds[static_cast<size_t>(stage)] += nanoseconds;
+}
+
+void SearchStats::addFormCounters(const Form& form, const FormCounters& counters)
+{
+    FormCounters& formCounters = local().forms[form];
+    formCounters.candidates += counters.candidates;
+    formCounters.verifications += counters.verifications;
+    formCounters.hits += counters.hits;
+}
+
+void SearchStats::reset()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& threadStats : registry)
+    {
+        threadStats->counters.fill(0);
+        threadStats->stageNanoseconds.fill(0);
+        threadStats->forms.clear();
+    }
+    for (auto& gauge : gauges)
+        gauge = 0;
+}
+
+std::string SearchStats::toJson()
+{
+    std::array<uint64_t, static_cast<size_t>(StatsCounter::Count)> counters{};
+    std::array<uint64_t, static_cast<size_t>(StatsStage::Count)> stageNanoseconds{};
+    std::map<Form, FormCounters> forms;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto& threadStats : registry)
+        {
+            for (size_t i = 0; i < counters.size(); i++)
+                counters[i] += threadStats->counters[i];
+            for (size_t i = 0; i < stageNanoseconds.size(); i++)
+                stageNanoseconds[i] += threadStats->stageNanoseconds[i];
+            for (auto& [form, formCounters] : threadStats->forms)
+            {
+                forms[form].candidates += formCounters.candidates;
+                forms[form].verifications += formCounters.verifications;
+                forms[form].hits += formCounters.hits;
+            }
+        }
+    }
+
+    std::ostringstream oss;
+    oss << "{\n  \"stages\": {";
+    for (size_t i = 0; i < stageNanoseconds.size(); i++)
+        oss << (i ? ", " : "") << "\"" << stageNames[i] << "\": " << stageNanoseconds[i] / 1e6;
+    oss << "},\n  \"counters\": {";
+    for (size_t i = 0; i < counters.size(); i++)
+        oss << (i ? ", " : "") << "\"" << counterNames[i] << "\": " << counters[i];
+    for (size_t i = 0; i < gauges.size(); i++)
+        oss << ", \"" << gaugeNames[i] << "\": " << gauges[i].load();
+    // Query entries per searched query
+    uint64_t searched = counters[static_cast<size_t>(StatsCounter::Queries)];
+    double dedupRatio = searched
+        ? static_cast<double>(searched + counters[static_cast<size_t>(StatsCounter::DuplicateQueries)]) / searched : 1.0;
+    oss << ", \"dedup_ratio\": " << dedupRatio;
+    oss << "},\n  \"forms\": [";
+    size_t formIndex = 0;
+    for (auto& [form, formCounters] : forms)
+    {
+        double falsePositiveRate = formCounters.verifications
+            ? 1.0 - static_cast<double>(formCounters.hits) / formCounters.verifications : 0.0;
+        oss << (formIndex++ ? "," : "") << "\n    {\"form\": \"" << form << "\", \"candidates\": " << formCounters.candidates
+            << ", \"verifications\": " << formCounters.verifications << ", \"hits\": " << formCounters.hits
+            << ", \"false_positive_rate\": " << falsePositiveRate << "}";
+    }
+    oss << "\n  ]\n}\n";
+    return oss.str();
+}
+
+StageTimer::StageTimer(StatsStage stage)
+{
+    this->stage = stage;
+    this->active = SearchStats::isEnabled();
+    if (this->active)
+        this->start = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer()
+{
+    if (this->active)
+        SearchStats::addStageTime(this->stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->start).count());
+}
+
+LapTimer::LapTimer()
+{
+    this->active = SearchStats::isEnabled();
+    if (this->active)
+        this->last = std::chrono::steady_clock::now();
+}
+
+void LapTimer::lap(StatsStage stage)
+{
+    if (!this->active)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    SearchStats::addStageTime(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(now - this->last).count());
+    this->last = now;
+}
@@ -0,0 +1,109 @@
+#include "search_trace.h"
+#include <fstream>
+#include <stdexcept>
+
+std::atomic<bool> SearchTrace::enabled = false;
+std::mutex SearchTrace::registryMutex;
+std::vector<std::unique_ptr<SearchTrace::ThreadBuffer>> SearchTrace::registry;
+
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+bool SearchTrace::isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void SearchTrace::setEnabled(bool enable)
+{
+    enabled = enable;
+}
+
+int64_t SearchTrace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+SearchTrace::ThreadBuffer& SearchTrace::local()
+{
+    thread_local ThreadBuffer* threadBuffer = nullptr;
+    if (!threadBuffer)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadBuffer>());
+        threadBuffer = registry.back().get();
+        threadBuffer->threadIndex = registry.size();
+        threadBuffer->events.resize(RING_CAPACITY);
+    }
+    return *threadBuffer;
+}
+
+void SearchTrace::record(const Event& event)
+{
+    ThreadBuffer& threadBuffer = local();
+    threadBuffer.events[threadBuffer.next] = event;
+    if (++threadBuffer.next == RING_CAPACITY)
+    {
+        threadBuffer.next = 0;
+        threadBuffer.wrapped = true;
+    }
+}
+
+void SearchTrace::reset()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& threadBuffer : registry)
+    {
+        threadBuffer->next = 0;
+        threadBuffer->wrapped = false;
+    }
+}
+
+void SearchTrace::writeChromeTrace(const std::string& fileName)
+{
+    std::ofstream file(fileName);
+    if (!file)
+        throw std::runtime_error("Unable to open trace file: " + fileName);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"k_mismatch\"}}";
+    for (auto& threadBuffer : registry)
+    {
+        file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << threadBuffer->threadIndex
+            << ", \"args\": {\"name\": \"worker " << threadBuffer->threadIndex
+            << (threadBuffer->wrapped ? " (oldest spans dropped)" : "") << "\"}}";
+
+        // Oldest span first, the ring starts at the next write position once it wrapped
+        size_t count = threadBuffer->wrapped ? RING_CAPACITY : threadBuffer->next;
+        size_t first = threadBuffer->wrapped ? threadBuffer->next : 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            const Event& event = threadBuffer->events[(first + i) % RING_CAPACITY];
+            file << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << threadBuffer->threadIndex
+                << ", \"ts\": " << event.startNs / 1000.0 << ", \"dur\": " << event.durationNs / 1000.0;
+            if (event.arg != NO_ARG)
+                file << ", \"args\": {\"arg\": " << event.arg << "}";
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category, int64_t arg, int64_t minDurationNs)
+{
+    this->name = name;
+    this->category = category;
+    this->arg = arg;
+    this->minDurationNs = minDurationNs;
+    this->startNs = SearchTrace::isEnabled() ? SearchTrace::now() : -1;
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (this->startNs < 0)
+        return;
+    int64_t durationNs = SearchTrace::now() - this->startNs;
+    if (durationNs >= this->minDurationNs)
+        SearchTrace::record({ this->name, this->category, this->startNs, durationNs, this->arg });
+}
@@ -0,0 +1,476 @@
+#include "sharded_search.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#ifndef _WIN32
+//
+// A stream buffer over a file descriptor, such as one end of a pipe, buffering reads and writes.
+//
+class FileDescriptorBuffer : public std::streambuf
+{
+public:
+    explicit FileDescriptorBuffer(int fd) : fd(fd)
+    {
+        setg(buffer, buffer, buffer);
+        setp(buffer, buffer + BUFFER_SIZE);
+    }
+
+protected:
+    int_type underflow() override
+    {
+        ssize_t count;
+        do
+            count = ::read(fd, buffer, BUFFER_SIZE);
+        while (count < 0 && errno == EINTR);
+        if (count <= 0)
+            return traits_type::eof();
+        setg(buffer, buffer, buffer + count);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    int_type overflow(int_type symbol) override
+    {
+        if (sync() != 0)
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(symbol, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(symbol);
+            pbump(1);
+        }
+        return traits_type::not_eof(symbol);
+    }
+
+    int sync() override
+    {
+        // A write to a worker that exited fails with EPIPE instead of killing the process: SIGPIPE is blocked on
+        // this thread during the writes, and the one they raise is discarded before the mask is restored
+        sigset_t pipeSignal, previousMask, pending;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+        sigpending(&pending);
+        bool alreadyPending = sigismember(&pending, SIGPIPE);
+
+        int status = 0;
+        for (char* next = pbase(); next < pptr() && status == 0;)
+        {
+            ssize_t count = ::write(fd, next, static_cast<size_t>(pptr() - next));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count < 0)
+            {
+                if (errno == EPIPE && !alreadyPending)
+                {
+                    timespec noWait{};
+                    while (sigtimedwait(&pipeSignal, nullptr, &noWait) < 0 && errno == EINTR);
+                    errno = EPIPE;
+                }
+                status = -1;
+            }
+            else
+                next += count;
+        }
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        if (status == 0)
+            setp(buffer, buffer + BUFFER_SIZE);
+        return status;
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = static_cast<size_t>(1) << 16;
+
+    int fd;  ///< The file descriptor, read or written, never both.
+    char buffer[BUFFER_SIZE];  ///< Buffer of the reads or of the writes.
+};
+
+/// One worker process and the pipes to its standard input and output.
+struct ShardCoordinator::Worker
+{
+    pid_t pid = -1;  ///< The process.
+    int input = -1;  ///< Write end of the pipe to the standard input of the worker.
+    int output = -1;  ///< Read end of the pipe from the standard output of the worker.
+    std::unique_ptr<FileDescriptorBuffer> inputBuffer;  ///< Buffer of input.
+    std::unique_ptr<FileDescriptorBuffer> outputBuffer;  ///< Buffer of output.
+    std::unique_ptr<std::ostream> toWorker;  ///< Stream to the worker.
+    std::unique_ptr<std::istream> fromWorker;  ///< Stream from the worker.
+};
+#else
+/// Worker processes are not started on Windows, the coordinator holding none.
+struct ShardCoordinator::Worker
+{
+    std::unique_ptr<std::ostream> toWorker;  ///< Stream to the worker.
+    std::unique_ptr<std::istream> fromWorker;  ///< Stream from the worker.
+};
+#endif
+
+void ShardProtocol::writeQueries(std::ostream& os, const std::vector<std::string>& queries,
+    const std::vector<size_t>& misMatchesPerQuery, size_t first, size_t last)
+{
+    os << "QUERIES " << last - first << "\n";
+    for (size_t i = first; i < last; i++)
+        os << misMatchesPerQuery[i] << " " << queries[i] << "\n";
+    os.flush();
+    if (!os)
+        throw std::runtime_error("Unable to send the queries to a shard worker!");
+}
+
+bool ShardProtocol::readQueries(std::istream& is, std::vector<std::string>& queries, std::vector<size_t>& misMatchesPerQuery)
+{
+    std::string line;
+    if (!std::getline(is, line) || line == "END")
+        return false;
+    size_t count = 0;
+    if (!(std::istringstream(line) >> line >> count) || line != "QUERIES")
+        throw std::runtime_error("Malformed shard message: expected a batch of queries!");
+
+    queries.assign(count, "");
+    misMatchesPerQuery.assign(count, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        // The query is the rest of the line after the threshold and one space, so it may hold spaces
+        if (!std::getline(is, line))
+            throw std::runtime_error("Malformed shard message: the batch of queries is truncated!");
+        size_t space = line.find(' ');
+        if (space == std::string::npos || space == 0 || line.find_first_not_of("0123456789") != space)
+            throw std::runtime_error("Malformed shard message: a query has no mismatch threshold!");
+        misMatchesPerQuery[i] = std::stoull(line.substr(0, space));
+        queries[i] = line.substr(space + 1);
+    }
+    return true;
+}
+
+void ShardProtocol::writeEnd(std::ostream& os)
+{
+    os << "END\n";
+    os.flush();
+}
+
+void ShardProtocol::writeHits(std::ostream& os, const std::vector<std::pair<size_t, size_t>>& hits)
+{
+    os << "HITS " << hits.size() << "\n";
+    for (auto& [query, position] : hits)
+        os << query << " " << position << "\n";
+    os.flush();
+}
+
+void ShardProtocol::writeError(std::ostream& os, const std::string& message)
+{
+    std::string line = message;
+    std::replace(line.begin(), line.end(), '\n', ' ');
+    os << "ERROR " << line << "\n";
+    os.flush();
+}
+
+std::vector<std::pair<size_t, size_t>> ShardProtocol::readHits(std::istream& is)
+{
+    std::string line;
+    if (!std::getline(is, line))
+        throw std::runtime_error("A shard worker closed its connection!");
+    if (line.starts_with("ERROR "))
+        throw std::runtime_error(line.substr(6));
+    size_t count = 0;
+    std::string tag;
+    if (!(std::istringstream(line) >> tag >> count) || tag != "HITS")
+        throw std::runtime_error("Malformed shard message: expected the hits of a batch!");
+
+    std::vector<std::pair<size_t, size_t>> hits(count);
+    for (auto& [query, position] : hits)
+        if (!std::getline(is, line) || !(std::istringstream(line) >> query >> position))
+            throw std::runtime_error("Malformed shard message: the hits are truncated!");
+    return hits;
+}
+
+std::string ShardProtocol::formatShard(const Shard& shard)
+{
+    return std::to_string(shard.begin) + ":" + std::to_string(shard.ownedEnd) + ":" + std::to_string(shard.end);
+}
+
+Shard ShardProtocol::parseShard(const std::string& str)
+{
+    Shard shard;
+    char separator1 = 0;
+    char separator2 = 0;
+    std::istringstream ss(str);
+    if (!(ss >> shard.begin >> separator1 >> shard.ownedEnd >> separator2 >> shard.end) || separator1 != ':'
+        || separator2 != ':' || ss.peek() != std::char_traits<char>::eof() || str.find('-') != std::string::npos
+        || shard.begin > shard.ownedEnd || shard.ownedEnd > shard.end)
+        throw std::runtime_error("Invalid shard '" + str + "', expected begin:owned_end:end.");
+    return shard;
+}
+
+ShardWorker::ShardWorker(KMismatchSearch& search, const Shard& shard, const std::string& engine, size_t misMatches)
+    : search(search), shard(shard), engine(engine), misMatches(misMatches)
+{
+    if (engine != "mcs" && engine != "naive" && engine != "fft" && engine != "fm" && engine != "seed")
+        throw std::runtime_error("Shard workers support the mcs, naive, fft, fm and seed engines!");
+}
+
+std::string ShardWorker::loadShardText(const std::string& fileName, const Shard& shard)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Unable to open text file: " + fileName);
+    std::string text(shard.end - shard.begin, '\0');
+    file.seekg(static_cast<std::streamoff>(shard.begin));
+    file.read(text.data(), static_cast<std::streamsize>(text.size()));
+    if (static_cast<size_t>(file.gcount()) != text.size())
+        throw std::runtime_error("The shard " + ShardProtocol::formatShard(shard) + " lies past the end of " + fileName);
+    return text;
+}
+
+std::vector<std::pair<size_t, size_t>> ShardWorker::searchBatch(std::vector<std::string>& queries,
+    const std::vector<size_t>& misMatchesPerQuery)
+{
+    // The MCS covers every query length seen so far, a placeholder query standing for each, and the index
+    // built by the next search is kept until a new length comes
+    if (engine == "mcs")
+    {
+        size_t lengths = mcsLengths.size();
+        for (auto& query : queries)
+            mcsLengths.insert(query.size());
+        if (mcsLengths.size() != lengths)
+        {
+            std::vector<std::string> lengthQueries;
+            for (size_t length : mcsLengths)
+                lengthQueries.emplace_back(length, ' ');
+            search.setQueries(lengthQueries);
+            search.buildLengthBucketsMcs(misMatches);
+        }
+    }
+
+    search.setQueries(queries);
+    std::map<std::string, std::set<size_t>> result;
+    if (engine == "naive")
+        result = search.naiveSearch(misMatchesPerQuery);
+    else if (engine == "fft")
+        result = search.fftSearch(misMatchesPerQuery);
+    else if (engine == "fm")
+        result = search.fmSearch(misMatchesPerQuery);
+    else if (engine == "seed")
+        result = search.seedSearch(misMatchesPerQuery);
+    else
+        result = search.mcsSearch(misMatchesPerQuery);
+
+    // Alignments starting in the overlap belong to the next shard
+    std::vector<std::pair<size_t, size_t>> hits;
+    size_t ownedSize = shard.ownedEnd - shard.begin;
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        auto positions = result.find(queries[q]);
+        if (positions != result.end())
+            for (size_t position : positions->second)
+                if (position < ownedSize)
+                    hits.emplace_back(q, position);
+    }
+    return hits;
+}
+
+void ShardWorker::serve(std::istream& is, std::ostream& os)
+{
+    std::vector<std::string> queries;
+    std::vector<size_t> misMatchesPerQuery;
+    while (ShardProtocol::readQueries(is, queries, misMatchesPerQuery))
+    {
+        try
+        {
+            ShardProtocol::writeHits(os, searchBatch(queries, misMatchesPerQuery));
+        }
+        catch (const std::exception& e)
+        {
+            ShardProtocol::writeError(os, e.what());
+        }
+        if (!os)
+            return;
+    }
+}
+
+std::vector<Shard> ShardCoordinator::partition(size_t textSize, size_t shards, size_t overlap)
+{
+    if (shards == 0)
+        throw std::runtime_error("The number of shards must be positive!");
+    shards = std::min(shards, std::max<size_t>(textSize, 1));
+
+    std::vector<Shard> result(shards);
+    for (size_t s = 0; s < shards; s++)
+    {
+        result[s].begin = textSize * s / shards;
+        result[s].ownedEnd = textSize * (s + 1) / shards;
+        result[s].end = std::min(textSize, result[s].ownedEnd + overlap);
+    }
+    return result;
+}
+
+ShardCoordinator::ShardCoordinator(const std::vector<std::string>& workerCommand, const std::vector<Shard>& shards)
+    : shards(shards)
+{
+    if (workerCommand.empty())
+        throw std::runtime_error("The shard worker command is empty!");
+
+#ifdef _WIN32
+    throw std::runtime_error("Worker processes of a sharded search are not supported on Windows!");
+#else
+    try
+    {
+        for (auto& shard : shards)
+            startWorker(workerCommand, shard);
+    }
+    catch (...)
+    {
+        stopWorkers();
+        throw;
+    }
+#endif
+}
+
+#ifndef _WIN32
+// Creates a pipe whose ends are closed on exec
+static bool createPipe(int ends[2])
+{
+    if (pipe(ends) != 0)
+        return false;
+    if (fcntl(ends[0], F_SETFD, FD_CLOEXEC) != 0 || fcntl(ends[1], F_SETFD, FD_CLOEXEC) != 0)
+    {
+        ::close(ends[0]);
+        ::close(ends[1]);
+        return false;
+    }
+    return true;
+}
+
+void ShardCoordinator::startWorker(const std::vector<std::string>& workerCommand, const Shard& shard)
+{
+    std::vector<std::string> arguments = workerCommand;
+    arguments.push_back("--shard");
+    arguments.push_back(ShardProtocol::formatShard(shard));
+    std::vector<char*> argv;
+    for (auto& argument : arguments)
+        argv.push_back(argument.data());
+    argv.push_back(nullptr);
+
+    // The pipe ends are closed on exec, so every worker holds only its own standard input and output, and
+    // sees the end of its input when the coordinator closes its pipe
+    int toWorker[2];
+    int fromWorker[2];
+    if (!createPipe(toWorker))
+        throw std::runtime_error(std::string("Unable to create a shard pipe: ") + std::strerror(errno));
+    if (!createPipe(fromWorker))
+    {
+        ::close(toWorker[0]);
+        ::close(toWorker[1]);
+        throw std::runtime_error(std::string("Unable to create a shard pipe: ") + std::strerror(errno));
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, toWorker[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fromWorker[1], STDOUT_FILENO);
+    pid_t pid = -1;
+    int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(toWorker[0]);
+    ::close(fromWorker[1]);
+    if (error != 0)
+    {
+        ::close(toWorker[1]);
+        ::close(fromWorker[0]);
+        throw std::runtime_error("Unable to start the shard worker " + arguments[0] + ": " + std::strerror(error));
+    }
+
+    auto worker = std::make_unique<Worker>();
+    worker->pid = pid;
+    worker->input = toWorker[1];
+    worker->output = fromWorker[0];
+    worker->inputBuffer = std::make_unique<FileDescriptorBuffer>(worker->input);
+    worker->outputBuffer = std::make_unique<FileDescriptorBuffer>(worker->output);
+    worker->toWorker = std::make_unique<std::ostream>(worker->inputBuffer.get());
+    worker->fromWorker = std::make_unique<std::istream>(worker->outputBuffer.get());
+    this->workers.push_back(std::move(worker));
+}
+#endif
+
+ShardCoordinator::~ShardCoordinator()
+{
+    stopWorkers();
+}
+
+void ShardCoordinator::stopWorkers()
+{
+#ifndef _WIN32
+    for (auto& worker : this->workers)
+    {
+        ShardProtocol::writeEnd(*worker->toWorker);
+        ::close(worker->input);
+        ::close(worker->output);
+    }
+    for (auto& worker : this->workers)
+    {
+        int status = 0;
+        while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR)
+            ;
+    }
+#endif
+    this->workers.clear();
+}
+
+std::map<std::string, std::set<size_t>> ShardCoordinator::search(const std::vector<std::string>& queries,
+    const std::vector<size_t>& misMatchesPerQuery)
+{
+    if (misMatchesPerQuery.size() != queries.size())
+        throw std::runtime_error("Number of mismatch thresholds does not match the number of queries!");
+    for (auto& query : queries)
+        if (query.find('\n') != std::string::npos)
+            throw std::runtime_error("Queries of a sharded search must not hold line breaks!");
+
+    std::map<std::string, std::set<size_t>> result;
+    for (size_t first = 0; first < queries.size(); first += BATCH_QUERIES)
+    {
+        // Every worker reads its whole batch before replying, so the batch is sent to all of them before any
+        // reply is read, and they search it in parallel
+        size_t last = std::min(first + BATCH_QUERIES, queries.size());
+        for (auto& worker : this->workers)
+            ShardProtocol::writeQueries(*worker->toWorker, queries, misMatchesPerQuery, first, last);
+
+        // The replies of all the workers are read before an error is thrown, so the next batch starts in step
+        std::string error;
+        for (size_t w = 0; w < this->workers.size(); w++)
+        {
+            std::vector<std::pair<size_t, size_t>> hits;
+            try
+            {
+                hits = ShardProtocol::readHits(*this->workers[w]->fromWorker);
+            }
+            catch (const std::exception& e)
+            {
+                if (error.empty())
+                    error = "Shard " + ShardProtocol::formatShard(this->shards[w]) + ": " + e.what();
+                continue;
+            }
+            for (auto& [query, position] : hits)
+            {
+                if (query >= last - first)
+                    throw std::runtime_error("Malformed shard message: a hit of an unknown query!");
+                result[queries[first + query]].insert(this->shards[w].begin + position);
+            }
+        }
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+    return result;
+}
@@ -0,0 +1,221 @@
+#include "verification_kernels.h"
+#include "type_defs.h"
+#include <array>
+#include <utility>
+#include <immintrin.h>
+
+/// Largest mismatch threshold with specialized kernels.
+static constexpr size_t MAX_KERNEL_MISMATCHES = 4;
+
+bool verifyGeneric(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches)
+{
+    size_t i = 0;
+
+    // Use AVX2 to compare 32 bytes (characters) at a time
+    while (AVX2Support && i + 32 <= queryLen)
+    {
+        __m256i textChunk = _mm256_loadu_si256((__m256i*)(textPtr + i));
+        __m256i queryChunk = _mm256_loadu_si256((__m256i*)(queryPtr + i));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(textChunk, queryChunk)));
+
+        if (mask)
+        {
+            size_t numMismatches = popcount(mask);
+
+            if (numMismatches > misMatches)
+                return false;
+
+            misMatches -= numMismatches;
+        }
+
+        i += 32;
+    }
+
+    // Handle any remaining characters
+    for (; i < queryLen; ++i)
+        if (queryPtr[i] != textPtr[i])
+            if (misMatches-- == 0)
+                return false;
+
+    return true;
+}
+
+bool verifyReverseComplement(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches)
+{
+    size_t i = 0;
+
+    if (AVX2Support && queryLen >= 32)
+    {
+        const __m256i reverseBytes = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        const __m256i flips = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(COMPLEMENT_FLIPS)));
+        const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+        for (; i + 32 <= queryLen; i += 32)
+        {
+            // The query symbols compared with text symbols i .. i + 31, in reverse order
+            __m256i queryChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(queryPtr + queryLen - i - 32));
+            queryChunk = _mm256_shuffle_epi8(queryChunk, reverseBytes);
+            queryChunk = _mm256_permute2x128_si256(queryChunk, queryChunk, 0x01);
+            queryChunk = _mm256_xor_si256(queryChunk, _mm256_shuffle_epi8(flips, _mm256_and_si256(queryChunk, lowNibble)));
+            __m256i textChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(textPtr + i));
+            uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(textChunk, queryChunk)));
+            size_t numMismatches = popcount(mask);
+            if (numMismatches > misMatches)
+                return false;
+            misMatches -= numMismatches;
+        }
+    }
+
+    for (; i < queryLen; ++i)
+        if (complementBase(queryPtr[queryLen - 1 - i]) != textPtr[i])
+            if (misMatches-- == 0)
+                return false;
+
+    return true;
+}
+
+Wildcards::Wildcards(const std::string& symbols)
+{
+    for (char symbol : symbols)
+        if (!contains(symbol))
+        {
+            this->symbols.push_back(symbol);
+            this->table[static_cast<unsigned char>(symbol)] = true;
+        }
+}
+
+bool Wildcards::empty() const
+{
+    return this->symbols.empty();
+}
+
+const std::string& Wildcards::getSymbols() const
+{
+    return this->symbols;
+}
+
+uint32_t Wildcards::mask32(const char* chunk) const
+{
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk));
+    __m256i wildcard = _mm256_setzero_si256();
+    for (char symbol : this->symbols)
+        wildcard = _mm256_or_si256(wildcard, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(symbol)));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(wildcard));
+}
+
+bool verifyWithWildcards(const char* textPtr, const char* queryPtr, size_t queryLen, size_t misMatches,
+    const Wildcards& wildcards)
+{
+    size_t i = 0;
+
+    while (AVX2Support && i + 32 <= queryLen)
+    {
+        __m256i textChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(textPtr + i));
+        __m256i queryChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(queryPtr + i));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(textChunk, queryChunk)));
+        if (mask)
+            mask &= ~(wildcards.mask32(textPtr + i) | wildcards.mask32(queryPtr + i));
+        if (mask)
+        {
+            size_t numMismatches = popcount(mask);
+            if (numMismatches > misMatches)
+                return false;
+            misMatches -= numMismatches;
+        }
+        i += 32;
+    }
+
+    for (; i < queryLen; ++i)
+        if (queryPtr[i] != textPtr[i] && !wildcards.contains(queryPtr[i]) && !wildcards.contains(textPtr[i]))
+            if (misMatches-- == 0)
+                return false;
+
+    return true;
+}
+
+/// Returns a bit per byte of a 32-byte chunk, set where the text and the query differ.
+static inline uint32_t mismatchMask32(const char* textPtr, const char* queryPtr)
+{
+    __m256i textChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(textPtr));
+    __m256i queryChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(queryPtr));
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(textChunk, queryChunk)));
+}
+
+/// Returns a bit per byte of a 16-byte chunk, set where the text and the query differ.
+static inline uint32_t mismatchMask16(const char* textPtr, const char* queryPtr)
+{
+    __m128i textChunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(textPtr));
+    __m128i queryChunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(queryPtr));
+    return ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(textChunk, queryChunk))) & 0xFFFFu;
+}
+
+/**
+ * Kernel specialized for a query length and a mismatch threshold.
+ * Full 32-byte chunks are compared with an early exit after each one, and the remaining bytes are
+ * compared by an overlapping chunk ending at the query end, whose already counted bytes are shifted out.
+ */
+template <size_t Length, size_t K>
+static bool verifyFixed(const char* textPtr, const char* queryPtr, size_t, size_t)
+{
+    static_assert(Length >= 16, "Specialized kernels compare at least 16 bytes");
+    size_t mismatches = 0;
+    if constexpr (Length >= 32)
+    {
+        bool withinThreshold = [&]<size_t... Chunk>(std::index_sequence<Chunk...>) {
+            return ((mismatches += popcount(mismatchMask32(textPtr + Chunk * 32, queryPtr + Chunk * 32)), mismatches <= K) && ...);
+        }(std::make_index_sequence<Length / 32>());
+        if (!withinThreshold)
+            return false;
+        if constexpr (Length % 32 != 0)
+            mismatches += popcount(mismatchMask32(textPtr + Length - 32, queryPtr + Length - 32) >> (32 - Length % 32));
+    }
+    else
+    {
+        mismatches = popcount(mismatchMask16(textPtr, queryPtr));
+        if constexpr (Length > 16)
+            mismatches += popcount(mismatchMask16(textPtr + Length - 16, queryPtr + Length - 16) >> (32 - Length));
+    }
+    return mismatches <= K;
+}
+
+/// The specialized kernels of a query length, indexed by mismatch threshold.
+struct KernelRow
+{
+    size_t length;
+    std::array<VerificationKernel, MAX_KERNEL_MISMATCHES + 1> kernels;
+};
+
+template <size_t Length, size_t... K>
+static constexpr KernelRow makeKernelRow(std::index_sequence<K...>)
+{
+    return { Length, { &verifyFixed<Length, K>... } };
+}
+
+template <size_t... Lengths>
+static constexpr auto makeKernelTable()
+{
+    return std::array<KernelRow, sizeof...(Lengths)>{ makeKernelRow<Lengths>(std::make_index_sequence<MAX_KERNEL_MISMATCHES + 1>())... };
+}
+
+/// Common read lengths with specialized kernels.
+static constexpr auto kernelTable = makeKernelTable<20, 32, 36, 50, 64, 75, 100, 150>();
+
+bool hasSpecializedKernel(size_t queryLen, size_t misMatches)
+{
+    if (!AVX2Support || misMatches > MAX_KERNEL_MISMATCHES)
+        return false;
+    for (auto& row : kernelTable)
+        if (row.length == queryLen)
+            return true;
+    return false;
+}
+
+VerificationKernel selectVerificationKernel(size_t queryLen, size_t misMatches)
+{
+    if (!AVX2Support || misMatches > MAX_KERNEL_MISMATCHES)
+        return verifyGeneric;
+    for (auto& row : kernelTable)
+        if (row.length == queryLen)
+            return row.kernels[misMatches];
+    return verifyGeneric;
+}
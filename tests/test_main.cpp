@@ -6,6 +6,10 @@ void runAllTests();
 
 int main() {
     std::cout << "Running tests..." << std::endl;
-    runAllTests();
+    try {
+        runAllTests();
+    } catch (...) {
+        return 1;
+    }
     return 0;
 }
@@ -6,11 +6,42 @@
 #include <map>
 #include <set>
 #include <chrono>
+#include <csignal>
+#include <thread>
 #include "gen_samples.h"
 #include "utils.h"
 #include "../include/k_mismatch_search.h"
 #include "../include/mcs.h"
 #include "../include/type_defs.h"
+#include "../include/search_stats.h"
+#include "../include/search_trace.h"
+#include "../include/resource_planner.h"
+#include "../include/scratch_arena.h"
+#include "../include/verification_kernels.h"
+#include "../include/number_theoretic_transform.h"
+#include "../include/fm_index.h"
+#include "../include/aho_corasick.h"
+#include "../include/posting_index.h"
+#include "../include/corpus.h"
+#include "../include/sharded_search.h"
+
+/**
+ * Creates a search of a text and queries, the fixture the engine tests share.
+ *
+ * @param text The text.
+ * @param queries The queries.
+ * @param mcsMismatches Mismatches of the MCS built per query length, or -1 to leave the MCS empty.
+ * @return The search.
+ */
+static KMismatchSearch makeSearch(std::string text, std::vector<std::string> queries, int mcsMismatches = -1)
+{
+    KMismatchSearch search;
+    search.setText(text);
+    search.setQueries(queries);
+    if (mcsMismatches >= 0)
+        search.buildLengthBucketsMcs(mcsMismatches);
+    return search;
+}
 
 void testSafeStoi() {
     std::cout << "Starting testSafeStoi()" << std::endl;
@@ -154,8 +185,8 @@ void testKMismatchSearch() {
         auto result = kMismatchSearch.mcsSearch(misMatches);
         assert(result.size() == 3);
         assert(result["ACGT"].size() == 3);
-        assert(result["CGTA"].size() == 3);
-        assert(result["TACG"].size() == 3);
+        assert(result["CGTA"].size() == 2);
+        assert(result["TACG"].size() == 2);
         
         auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
         assert(result == naiveResult);
@@ -226,6 +257,1354 @@ void testRandomTextAndQueries() {
     std::cout << "Finished testRandomTextAndQueries()" << std::endl;
 }
 
+void testSelectivityAwareMCS() {
+    std::cout << "Starting testSelectivityAwareMCS()" << std::endl;
+    try {
+        const int queryLen = 8;
+        const int misMatches = 2;
+
+        // Low-complexity region followed by a random one
+        std::string text;
+        for (int i = 0; i < 500; i++)
+            text += "AC";
+        text += initRandomText(1000, 4, 1);
+        std::vector<std::string> queries = initRandomQueries(text, 20, queryLen);
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        std::string textSample = kMismatchSearch.getTextSample(1000);
+        assert(textSample.size() <= 1000);
+
+        MCS mcs = MCS::buildMCSSelectivityAware(queries, misMatches, textSample, text.size());
+        for (auto& combination : Combination::generateAllCombinations(queryLen, misMatches))
+            assert(std::any_of(mcs.getMcsForms().begin(), mcs.getMcsForms().end(),
+                [&combination](const Form& form) { return combination.contains(form); }));
+
+        kMismatchSearch.setMcs(mcs);
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatches);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+        assert(mcsResult == naiveResult);
+        assert(mcs.predictCandidatesPerQuery(queryLen, textSample, text.size()) > 0.0);
+        assert(kMismatchSearch.getLastCandidatesCount() > 0);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSelectivityAwareMCS: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testSelectivityAwareMCS()" << std::endl;
+}
+
+void testSelectivityAwareMixedLengths() {
+    std::cout << "Starting testSelectivityAwareMixedLengths()" << std::endl;
+    try {
+        const int misMatches = 3;
+        std::string text = initRandomText(3000, 4, 5);
+        std::vector<std::string> queries = initRandomQueries(text, 5, 24);
+        for (auto& query : initRandomQueries(text, 5, 6))
+            queries.push_back(query);
+
+        // As with -ts, every length bucket gets its own MCS, so the forms of the longer queries do not leave the
+        // shorter ones without a cover
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        kMismatchSearch.buildSelectivityAwareLengthBucketsMcs(misMatches, 1000);
+        assert(kMismatchSearch.getLengthMcs().size() == 2);
+        for (auto& [length, bucketMcs] : kMismatchSearch.getLengthMcs())
+            for (auto& form : bucketMcs.getMcsForms())
+                assert(form.getSize() <= length);
+
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatches);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+        assert(!naiveResult[queries.back()].empty());
+        assert(mcsResult == naiveResult);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSelectivityAwareMixedLengths: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testSelectivityAwareMixedLengths()" << std::endl;
+}
+
+void testOptimizeMCS() {
+    std::cout << "Starting testOptimizeMCS()" << std::endl;
+    try {
+        const uint64_t length = 12;
+        const uint64_t misMatches = 3;
+        std::vector<std::string> queries = { std::string(length, 'A') };
+
+        MCS greedyMcs = MCS::buildMCSNaiveMultithreaded(queries, misMatches);
+        MCS optimizedMcs = MCS::optimize(greedyMcs, length, misMatches, std::chrono::seconds(5));
+        assert(optimizedMcs.getMcsForms().size() <= greedyMcs.getMcsForms().size());
+        for (auto& combination : Combination::generateAllCombinations(length, misMatches))
+            assert(std::any_of(optimizedMcs.getMcsForms().begin(), optimizedMcs.getMcsForms().end(),
+                [&combination](const Form& form) { return combination.contains(form); }));
+
+        // A form repeated in the MCS is redundant
+        MCS mcsFile = greedyMcs;
+        mcsFile.saveToFile("temp_mcs.txt");
+        {
+            std::ofstream file("temp_mcs.txt", std::ios::app);
+            file << greedyMcs.getMcsForms().front() << std::endl;
+        }
+        MCS loadedMcs = MCS::loadFromFile("temp_mcs.txt");
+        assert(loadedMcs.getMcsForms().size() == greedyMcs.getMcsForms().size() + 1);
+        loadedMcs.removeRedundantForms(length, misMatches);
+        assert(loadedMcs.getMcsForms().size() <= greedyMcs.getMcsForms().size());
+
+        // The optimized MCS round trips through the MCS file format
+        optimizedMcs.saveToFile("temp_mcs.txt");
+        assert(MCS::loadFromFile("temp_mcs.txt").getMcsForms().size() == optimizedMcs.getMcsForms().size());
+        std::remove("temp_mcs.txt");
+
+        // Queries of mixed lengths keep all their hits, with an MCS per length and with a single MCS
+        std::string text = initRandomText(20000, 4, 12);
+        std::vector<std::string> mixedQueries = { "AAAGCC" };
+        for (int queryLength : { 6, 9, 14, 20 })
+            for (auto& query : initRandomQueries(text, 10, queryLength))
+                mixedQueries.push_back(query);
+        KMismatchSearch bucketsSearch = makeSearch(text, mixedQueries, misMatches);
+        auto expected = bucketsSearch.naiveSearch(misMatches);
+        bucketsSearch.optimizeMcs(misMatches, std::chrono::seconds(2));
+        assert(bucketsSearch.mcsSearch(misMatches) == expected);
+
+        KMismatchSearch singleSearch = makeSearch(text, mixedQueries);
+        std::vector<std::string> shortestQueries = { std::string(6, 'A') };
+        MCS shortestMcs = MCS::buildMCSNaiveMultithreaded(shortestQueries, misMatches);
+        singleSearch.setMcs(shortestMcs, misMatches);
+        singleSearch.optimizeMcs(misMatches, std::chrono::seconds(2));
+        assert(singleSearch.mcsSearch(misMatches) == expected);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testOptimizeMCS: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testOptimizeMCS()" << std::endl;
+}
+
+void testCombinationRange() {
+    std::cout << "Starting testCombinationRange()" << std::endl;
+    try {
+        for (auto [length, misMatches] : std::vector<std::pair<uint64_t, uint64_t>>{ { 1, 0 }, { 8, 0 }, { 8, 2 }, { 12, 3 }, { 16, 7 }, { 5, 5 } })
+        {
+            // Reference: combinations beginning with 1 with misMatches zeros, in descending order
+            std::vector<uint64_t> expected;
+            for (uint64_t value = (1ull << length) - 1; value >= (1ull << (length - 1)); value--)
+                if (length - popcount(value) == misMatches)
+                    expected.push_back(value);
+
+            CombinationRange range(length, misMatches);
+            assert(range.size() == expected.size());
+            std::vector<uint64_t> enumerated;
+            for (auto it = range.begin(); it != range.end(); ++it)
+            {
+                assert(range.rank(*it) == it.getRank());
+                assert(range.unrank(it.getRank()) == *it);
+                std::ostringstream oss;
+                oss << *it;
+                enumerated.push_back(std::stoull(oss.str(), nullptr, 2));
+            }
+            assert(enumerated == expected);
+            assert(Combination::generateAllCombinations(length, misMatches).size() == expected.size());
+
+            // Splitting into rank intervals enumerates the same combinations
+            size_t splitCount = 0;
+            for (auto& part : range.split(5))
+                for (Combination combination : part)
+                {
+                    std::ostringstream oss;
+                    oss << combination;
+                    assert(std::stoull(oss.str(), nullptr, 2) == expected[splitCount++]);
+                }
+            assert(splitCount == expected.size());
+        }
+
+        // Ranks round trip at the largest length
+        CombinationRange wide(64, 3);
+        for (uint64_t rank = 0; rank < wide.size(); rank += wide.size() / 97)
+            assert(wide.rank(wide.unrank(rank)) == rank);
+        assert(wide.subrange(wide.size() - 2, wide.size() + 5).size() == 2);
+
+        // Inner forms are all pairs of ones of the combination
+        Combination combination(0b1101011);
+        auto forms = combination.getAllForms(2);
+        assert(forms.size() == 6);
+        for (auto& form : forms)
+            assert(combination.contains(form));
+
+        // Queries longer than the sequence width use an MCS of their prefix
+        MCS longMcs = MCS::buildMCSNaiveMultithreaded(100, 2);
+        assert(!longMcs.getMcsForms().empty());
+        for (auto& form : longMcs.getMcsForms())
+            assert(form.getSize() <= kMismatchIntegerType::UINT_TYPE_SIZE);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testCombinationRange: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testCombinationRange()" << std::endl;
+}
+
+void testSegmentSearch() {
+    std::cout << "Starting testSegmentSearch()" << std::endl;
+    try {
+        const int queryLen = 150;
+        const int misMatches = 6;
+
+        // Substrings of the text with up to misMatches + 1 substitutions
+        std::string text = initRandomText(20000, 4, 2);
+        std::vector<std::string> queries;
+        for (int i = 0; i < 10; i++)
+        {
+            std::string query = text.substr(i * 1000, queryLen);
+            for (int j = 0; j <= i % (misMatches + 2); j++)
+                query[(j * 37) % queryLen] = '-';
+            queries.push_back(query);
+        }
+
+        auto segments = KMismatchSearch::splitQuery(queryLen, 4);
+        assert(segments.size() == 4);
+        assert(segments.front().first == 0 && segments.back().first + segments.back().second == queryLen);
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        for (size_t segmentsNumber : { 0, 10 })
+        {
+            kMismatchSearch.buildSegmentMcs(misMatches, segmentsNumber);
+            auto segmentResult = kMismatchSearch.segmentSearch(misMatches, segmentsNumber);
+            auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+            assert(segmentResult == naiveResult);
+            assert(!segmentResult.empty());
+        }
+
+        // Setting another MCS drops the index of the segment MCS, and an MCS without a contiguous form
+        // fitting in a segment is rejected rather than missing hits
+        MCS segmentMcs = KMismatchSearch::segmentMcs(queries, misMatches, 0);
+        MCS gappedMcs(std::vector<Form>{ Form(0b101) });
+        kMismatchSearch.setMcs(gappedMcs);
+        bool rejected = false;
+        try {
+            kMismatchSearch.segmentSearch(misMatches, 0);
+        } catch (const std::runtime_error&) {
+            rejected = true;
+        }
+        assert(rejected);
+        kMismatchSearch.mcsSearch(misMatches);
+        kMismatchSearch.setMcs(segmentMcs);
+        assert(kMismatchSearch.segmentSearch(misMatches, 0) == kMismatchSearch.naiveSearch(misMatches));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSegmentSearch: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testSegmentSearch()" << std::endl;
+}
+
+void testFftSearch() {
+    std::cout << "Starting testFftSearch()" << std::endl;
+    try {
+        // A transform round trip and a small cyclic convolution
+        NumberTheoreticTransform transform(8);
+        std::vector<uint32_t> a = { 1, 2, 3, 0, 0, 0, 0, 0 };
+        std::vector<uint32_t> b = { 4, 5, 0, 0, 0, 0, 0, 1 };
+        std::vector<uint32_t> product(8, 0);
+        transform.forward(a.data());
+        transform.forward(b.data());
+        transform.multiplyAccumulate(product.data(), a.data(), b.data());
+        transform.inverse(product.data());
+        assert((product == std::vector<uint32_t>{ 6, 16, 22, 15, 0, 0, 0, 1 }));
+
+        // Mixed lengths across several blocks, on DNA and on a larger alphabet
+        for (int alphabetSize : { 4, 20 })
+        {
+            std::string text = initRandomText(30000, alphabetSize, 3);
+            std::vector<std::string> queries;
+            std::vector<size_t> misMatchesPerQuery;
+            for (int i = 0; i < 12; i++)
+            {
+                size_t queryLen = 20 + i * 41;
+                std::string query = text.substr((i * 2477) % (text.size() - queryLen), queryLen);
+                for (int j = 0; j <= i % 5; j++)
+                    query[(j * 53) % queryLen] = query[(j * 53) % queryLen] == 'A' ? 'C' : 'A';
+                queries.push_back(query);
+                misMatchesPerQuery.push_back(i % 6);
+            }
+            queries.emplace_back(text.end() - 25, text.end());
+            misMatchesPerQuery.push_back(0);
+
+            KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+            auto fftResult = kMismatchSearch.fftSearch(4);
+            assert(fftResult == kMismatchSearch.naiveSearch(4));
+            assert(!fftResult.empty());
+            assert(kMismatchSearch.fftSearch(misMatchesPerQuery) == kMismatchSearch.naiveSearch(misMatchesPerQuery));
+        }
+
+        // Queries longer than the text are not found
+        KMismatchSearch shortText;
+        std::string text = "ACGTACGT";
+        std::vector<std::string> queries = { "ACGTACGTA", "GTAC" };
+        shortText.setText(text);
+        shortText.setQueries(queries);
+        auto result = shortText.fftSearch(1);
+        assert(result.size() == 1 && result["GTAC"] == std::set<size_t>({ 2 }));
+
+        // An empty query matches at every text position, with every engine
+        queries = { "", "GTAC" };
+        std::vector<size_t> misMatchesPerQuery = { 0, 1 };
+        KMismatchSearch emptyQuery = makeSearch(text, queries, 1);
+        result = emptyQuery.naiveSearch(misMatchesPerQuery);
+        assert(result[""].size() == text.size());
+        assert(emptyQuery.fftSearch(misMatchesPerQuery) == result);
+        assert(emptyQuery.mcsSearch(misMatchesPerQuery) == result);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testFftSearch: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testFftSearch()" << std::endl;
+}
+
+void testPostingIndex() {
+    std::cout << "Starting testPostingIndex()" << std::endl;
+    try {
+        std::string text = initRandomText(3000, 4, 10);
+        // A direct-address form, a packed form with binary searched keys, and a form too wide to pack
+        std::vector<Form> forms = { Form(0b101), Form((1 << 10) - 1), Form((static_cast<uint64_t>(1) << 40) - 1) };
+        PostingIndex index = PostingIndex::build(text, forms);
+        assert(index.findTable(forms[0])->isDirect());
+        assert(!index.findTable(forms[1])->isDirect());
+        assert(index.findTable(Form(0b11)) == nullptr);
+
+        std::map<std::string, std::set<size_t>> expected;
+        for (auto& form : forms)
+            for (size_t pos = 0; pos + form.getSize() <= text.size(); pos++)
+                expected[form.getStringFromPosition(text, pos)].insert(pos);
+        assert(index.toMap() == expected);
+        assert(index.getKeys() == expected.size());
+
+        for (auto& form : forms)
+        {
+            const PostingIndex::Table* table = index.findTable(form);
+            for (size_t pos = 0; pos + form.getSize() <= text.size(); pos += 97)
+            {
+                std::string key = form.getStringFromPosition(text, pos);
+                auto positions = table->find(key);
+                assert(std::set<size_t>(positions.begin(), positions.end()) == expected[key]);
+                assert(std::is_sorted(positions.begin(), positions.end()));
+                key[0] = 'X';
+                assert(table->find(key).empty());
+            }
+        }
+
+        // A saved index is rebuilt from its keys
+        PostingIndex loaded = PostingIndex::fromMap(expected, forms);
+        assert(loaded.toMap() == expected);
+        assert(loaded.getPostings() == index.getPostings());
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testPostingIndex: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testPostingIndex()" << std::endl;
+}
+
+void testFmIndex() {
+    std::cout << "Starting testFmIndex()" << std::endl;
+    try {
+        // Results match the MCS and naive searches, on DNA and on a larger alphabet
+        for (int alphabetSize : { 4, 20 })
+        {
+            std::string text = initRandomText(20000, alphabetSize, 3);
+            std::vector<std::string> queries = initRandomQueries(text, 20, 16);
+            std::vector<size_t> misMatchesPerQuery;
+            for (size_t i = 0; i < queries.size(); i++)
+            {
+                queries[i][(i * 7) % queries[i].size()] = 'A';
+                misMatchesPerQuery.push_back(i % 4);
+            }
+            queries.push_back("Z" + text.substr(100, 15));
+            misMatchesPerQuery.push_back(1);
+
+            KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+            auto fmResult = kMismatchSearch.fmSearch(3);
+            assert(fmResult == kMismatchSearch.naiveSearch(3));
+            assert(fmResult.contains(queries.back()));
+            kMismatchSearch.buildLengthBucketsMcs(3);
+            assert(kMismatchSearch.fmSearch(misMatchesPerQuery) == kMismatchSearch.mcsSearch(misMatchesPerQuery));
+            assert(kMismatchSearch.getFmIndex()->memoryBytes() == FmIndex::estimateBytes(text.size(), alphabetSize));
+        }
+
+        // A saved index is loaded for its text only
+        std::string text = initRandomText(5000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 10, 12);
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        kMismatchSearch.saveFmIndex("temp_fm_index.bin");
+        auto built = kMismatchSearch.fmSearch(2);
+
+        KMismatchSearch loadedSearch = makeSearch(text, queries);
+        loadedSearch.loadFmIndex("temp_fm_index.bin");
+        assert(loadedSearch.getFmIndex()->memoryBytes() == kMismatchSearch.getFmIndex()->memoryBytes());
+        assert(loadedSearch.fmSearch(2) == built);
+
+        std::string otherText = text;
+        otherText[0] = otherText[0] == 'A' ? 'C' : 'A';
+        loadedSearch.setText(otherText);
+        try {
+            loadedSearch.loadFmIndex("temp_fm_index.bin");
+            assert(false);
+        } catch (const std::runtime_error&) {
+            // Expected
+        }
+        std::remove("temp_fm_index.bin");
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testFmIndex: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testFmIndex()" << std::endl;
+}
+
+void testSeedSearch() {
+    std::cout << "Starting testSeedSearch()" << std::endl;
+    try {
+        // Overlapping patterns, including a pattern that is a suffix of another
+        AhoCorasick automaton({ "he", "she", "his", "hers", "e" });
+        std::string text = "ushers";
+        std::vector<std::pair<uint32_t, size_t>> matches;
+        automaton.scan(text.data(), text.data() + text.size(),
+            [&](uint32_t pattern, size_t end) { matches.emplace_back(pattern, end); });
+        std::sort(matches.begin(), matches.end());
+        assert((matches == std::vector<std::pair<uint32_t, size_t>>{ { 0, 4 }, { 1, 4 }, { 3, 6 }, { 4, 4 } }));
+
+        // Results match the naive search across several chunks, on DNA and on a larger alphabet
+        for (int alphabetSize : { 4, 20 })
+        {
+            std::string text = initRandomText(150000, alphabetSize, 5);
+            std::vector<std::string> queries = initRandomQueries(text, 30, 18);
+            std::vector<size_t> misMatchesPerQuery;
+            for (size_t i = 0; i < queries.size(); i++)
+            {
+                queries[i][(i * 5) % queries[i].size()] = 'A';
+                misMatchesPerQuery.push_back(i % 4);
+            }
+            queries.push_back("AC");
+            misMatchesPerQuery.push_back(2);
+            queries.push_back(text.substr(65530, 12));
+            misMatchesPerQuery.push_back(0);
+
+            KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+            auto seedResult = kMismatchSearch.seedSearch(misMatchesPerQuery);
+            assert(seedResult == kMismatchSearch.naiveSearch(misMatchesPerQuery));
+            assert(seedResult.contains(queries.back()));
+            assert(kMismatchSearch.seedSearch(2) == kMismatchSearch.naiveSearch(2));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSeedSearch: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testSeedSearch()" << std::endl;
+}
+
+/// Returns the reverse complement of a nucleotide string.
+static std::string reverseComplement(const std::string& str)
+{
+    std::string result(str.rbegin(), str.rend());
+    for (auto& c : result)
+        c = complementBase(c);
+    return result;
+}
+
+/// Returns a random nucleotide string.
+static std::string randomDna(size_t size, size_t seed)
+{
+    std::string dna = initRandomText(size, 4, seed);
+    for (auto& c : dna)
+        c = "ACGT"[c - 'A'];
+    return dna;
+}
+
+void testReverseComplementSearch() {
+    std::cout << "Starting testReverseComplementSearch()" << std::endl;
+    try {
+        assert(reverseComplement("ACGTNacgtn") == "nacgtNACGT");
+
+        // The reverse complement kernel agrees with the generic kernel on the materialized reverse complement
+        std::mt19937 gen(11);
+        for (size_t queryLen : { 5, 31, 32, 33, 64, 100 })
+            for (int trial = 0; trial < 100; trial++)
+            {
+                std::string window = randomDna(queryLen, trial);
+                std::string query = reverseComplement(window);
+                for (int m = 0; m < trial % 5; m++)
+                    query[gen() % queryLen] = "ACGT"[gen() % 4];
+                std::string complemented = reverseComplement(query);
+                for (size_t misMatches = 0; misMatches <= 3; misMatches++)
+                    assert(verifyReverseComplement(window.data(), query.data(), queryLen, misMatches)
+                        == verifyGeneric(window.data(), complemented.data(), queryLen, misMatches));
+            }
+
+        // Both keys of a window are the keys of the query and of its reverse complement at the mirrored position
+        std::string query = "ACCGTTAGCATG";
+        std::string complemented = reverseComplement(query);
+        Form form(0b1011001);
+        for (size_t qPos = 0; qPos + form.getSize() <= query.size(); qPos++)
+        {
+            std::string key(form.getSize(), '_');
+            std::string reverseKey(form.getSize(), '_');
+            form.fillStrandKeysFromPosition(query, qPos, key.data(), reverseKey.data());
+            assert(key == form.getStringFromPosition(query, qPos));
+            assert(reverseKey == form.getStringFromPosition(complemented, query.size() - qPos - form.getSize()));
+        }
+
+        // The forward strand matches the MCS search and the reverse strand the search of the reverse complements
+        std::string text = randomDna(20000, 6);
+        std::vector<std::string> queries;
+        for (size_t i = 0; i < 15; i++)
+        {
+            queries.push_back(text.substr(i * 1291, 24));
+            queries[i][i % 24] = 'N';
+            if (i < 5)
+                queries[i] = reverseComplement(queries[i]);
+        }
+        std::vector<std::string> complementedQueries;
+        for (auto& q : queries)
+            complementedQueries.push_back(reverseComplement(q));
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries, 3);
+        auto strandResult = kMismatchSearch.mcsSearchBothStrands(3);
+        auto forwardResult = kMismatchSearch.mcsSearch(3);
+        kMismatchSearch.setQueries(complementedQueries);
+        auto reverseResult = kMismatchSearch.naiveSearch(3);
+
+        size_t reverseHits = 0;
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            std::set<size_t> forward;
+            std::set<size_t> reverse;
+            for (auto& [pos, strand] : strandResult[queries[i]])
+                (strand == Strand::Forward ? forward : reverse).insert(pos);
+            assert(forward == forwardResult[queries[i]]);
+            assert(reverse == reverseResult[complementedQueries[i]]);
+            reverseHits += reverse.size();
+        }
+        assert(reverseHits >= 5);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testReverseComplementSearch: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testReverseComplementSearch()" << std::endl;
+}
+
+void testWildcards() {
+    std::cout << "Starting testWildcards()" << std::endl;
+    try {
+        // Mismatches outside the wildcards of both sides, counted one symbol at a time
+        Wildcards wildcards("N-N");
+        assert(wildcards.getSymbols() == "N-");
+        auto countMismatches = [&](const char* textPtr, const std::string& query) {
+            size_t misMatches = 0;
+            for (size_t i = 0; i < query.size(); i++)
+                misMatches += textPtr[i] != query[i] && !wildcards.contains(textPtr[i]) && !wildcards.contains(query[i]);
+            return misMatches;
+        };
+
+        // The masked kernel agrees with the scalar count across chunk boundaries
+        std::mt19937 gen(13);
+        for (size_t queryLen : { 5, 31, 32, 33, 64, 100 })
+            for (int trial = 0; trial < 100; trial++)
+            {
+                std::string window = randomDna(queryLen, trial);
+                std::string query = window;
+                for (int m = 0; m < trial % 7; m++)
+                    query[gen() % queryLen] = "ACGTN-"[gen() % 6];
+                for (int m = 0; m < trial % 3; m++)
+                    window[gen() % queryLen] = 'N';
+                for (size_t misMatches = 0; misMatches <= 3; misMatches++)
+                    assert(verifyWithWildcards(window.data(), query.data(), queryLen, misMatches, wildcards)
+                        == (countMismatches(window.data(), query) <= misMatches));
+            }
+
+        // The text has runs of N and the queries have N and '-' on sampled and unsampled positions
+        std::string text = randomDna(20000, 8);
+        for (size_t pos = 0; pos < text.size(); pos += 997)
+            for (size_t i = 0; i < 1 + pos % 3 && pos + i < text.size(); i++)
+                text[pos + i] = 'N';
+        std::vector<std::string> queries;
+        for (size_t i = 0; i < 12; i++)
+        {
+            queries.push_back(text.substr(i * 1613 + 980, 20));
+            for (size_t w = 0; w < i % 4; w++)
+                queries[i][(i + 7 * w) % 20] = "N-"[w % 2];
+        }
+        // Wildcards on most sampled positions, too many expansions, so the query is checked everywhere
+        queries.push_back(text.substr(5000, 20));
+        for (size_t i = 0; i < 20; i += 2)
+            queries.back()[i] = 'N';
+
+        const size_t misMatches = 2;
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries, misMatches);
+        kMismatchSearch.setWildcards("N-");
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatches);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+        assert(mcsResult == naiveResult);
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            std::set<size_t> expected;
+            for (size_t pos = 0; pos + queries[i].size() <= text.size(); pos++)
+                if (countMismatches(text.data() + pos, queries[i]) <= misMatches)
+                    expected.insert(pos);
+            assert(expected.contains(i < 12 ? i * 1613 + 980 : 5000));
+            assert(mcsResult[queries[i]] == expected);
+            assert(kMismatchSearch.CheckQueryOnPosition(queries[i], *expected.begin(), 0));
+        }
+
+        // Without wildcards they are ordinary symbols again
+        kMismatchSearch.setWildcards("");
+        assert(!kMismatchSearch.CheckQueryOnPosition(queries.back(), 5000, misMatches));
+        assert(kMismatchSearch.mcsSearch(misMatches) == kMismatchSearch.naiveSearch(misMatches));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testWildcards: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testWildcards()" << std::endl;
+}
+
+void testResultModes() {
+    std::cout << "Starting testResultModes()" << std::endl;
+    try {
+        // A repeat makes high-copy queries, found again through many windows of every form
+        std::string text = initRandomText(20000, 4, 21);
+        std::string repeat = text.substr(100, 40);
+        for (size_t pos = 1000; pos + 40 <= 20000; pos += 400)
+        {
+            text.replace(pos, 40, repeat);
+            text[pos + pos % 40] = 'D';
+        }
+        std::vector<std::string> queries = initRandomQueries(text, 10, 18);
+        queries.push_back(repeat.substr(5, 18));
+        queries.push_back(repeat.substr(20, 18));
+        queries.push_back(std::string(18, 'Z'));
+
+        for (std::string wildcards : { "", "-D" })
+        {
+            const size_t misMatches = 2;
+            KMismatchSearch kMismatchSearch = makeSearch(text, queries, misMatches);
+            kMismatchSearch.setWildcards(wildcards);
+            auto allResult = kMismatchSearch.mcsSearch(misMatches);
+            auto existsResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::Exists);
+            auto countResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::Count);
+            auto firstResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::First, 3);
+            auto bestResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::Best, 5);
+            assert(allResult[repeat.substr(5, 18)].size() > 40);
+            assert(existsResult.size() == allResult.size() && countResult.size() == allResult.size());
+
+            for (auto& [query, positions] : allResult)
+            {
+                // Mismatches of every position of the query
+                std::vector<std::pair<size_t, size_t>> hits;
+                for (size_t pos : positions)
+                {
+                    size_t mismatches = 0;
+                    for (size_t i = 0; i < query.size(); i++)
+                        mismatches += text[pos + i] != query[i]
+                            && !kMismatchSearch.getWildcards().contains(text[pos + i])
+                            && !kMismatchSearch.getWildcards().contains(query[i]);
+                    hits.emplace_back(pos, mismatches);
+                }
+
+                assert(existsResult[query].count == 1);
+                assert(countResult[query].count == positions.size());
+
+                auto& first = firstResult[query];
+                assert(first.count == std::min<size_t>(3, positions.size()) && first.hits.size() == first.count);
+                assert(std::ranges::is_sorted(first.hits));
+                for (auto& hit : first.hits)
+                    assert(std::ranges::find(hits, hit) != hits.end());
+
+                // The kept mismatches are the smallest ones, ties being broken by the search
+                auto& best = bestResult[query];
+                assert(best.count == std::min<size_t>(5, positions.size()));
+                std::ranges::sort(hits, {}, [](auto& hit) { return hit.second; });
+                for (size_t i = 0; i < best.hits.size(); i++)
+                {
+                    assert(best.hits[i].second == hits[i].second);
+                    assert(std::ranges::find(hits, best.hits[i]) != hits.end());
+                }
+            }
+        }
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries, 1);
+        bool thrown = false;
+        try {
+            kMismatchSearch.mcsSearch(1, ResultMode::Best, 0);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testResultModes: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testResultModes()" << std::endl;
+}
+
+void testSearchLimits() {
+    std::cout << "Starting testSearchLimits()" << std::endl;
+    try {
+        // A low-complexity query has far more candidates than the others
+        std::string text = initRandomText(20000, 4, 31);
+        text.replace(5000, 3000, std::string(3000, 'A'));
+        std::vector<std::string> queries = initRandomQueries(text, 10, 16);
+        queries.push_back(std::string(16, 'A'));
+
+        const size_t misMatches = 2;
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries, misMatches);
+        auto fullResult = kMismatchSearch.mcsSearch(misMatches);
+        assert(std::ranges::all_of(kMismatchSearch.getLastQueryStatuses(), [](QueryStatus status) { return status == QueryStatus::Complete; }));
+
+        // The budget truncates the low-complexity query only, the positions found being a subset
+        SearchLimits limits;
+        limits.candidateBudget = 20000;
+        kMismatchSearch.setSearchLimits(limits);
+        auto budgetResult = kMismatchSearch.mcsSearch(misMatches);
+        auto& statuses = kMismatchSearch.getLastQueryStatuses();
+        assert(statuses.size() == queries.size() && statuses.back() == QueryStatus::Truncated);
+        assert(std::ranges::count(statuses, QueryStatus::Complete) >= 5);
+        for (size_t i = 0; i < queries.size(); i++)
+            if (statuses[i] == QueryStatus::Complete)
+                assert(budgetResult[queries[i]] == fullResult[queries[i]]);
+            else
+                assert(std::ranges::includes(fullResult[queries[i]], budgetResult[queries[i]]));
+        auto countResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::Count);
+        assert(countResult[queries.back()].count <= fullResult[queries.back()].size());
+        assert(kMismatchSearch.getLastQueryStatuses().back() == QueryStatus::Truncated);
+
+        // A cancelled search starts no query, and a naive search past its deadline is truncated
+        std::atomic<bool> cancelled = true;
+        limits = SearchLimits();
+        limits.cancelled = &cancelled;
+        kMismatchSearch.setSearchLimits(limits);
+        assert(kMismatchSearch.mcsSearch(misMatches).empty());
+        assert(std::ranges::all_of(kMismatchSearch.getLastQueryStatuses(), [](QueryStatus status) { return status == QueryStatus::NotStarted; }));
+        limits = SearchLimits();
+        limits.deadline = std::chrono::steady_clock::now();
+        kMismatchSearch.setSearchLimits(limits);
+        assert(kMismatchSearch.naiveSearch(misMatches).empty());
+        assert(std::ranges::all_of(kMismatchSearch.getLastQueryStatuses(), [](QueryStatus status) { return status == QueryStatus::Truncated; }));
+
+        kMismatchSearch.setSearchLimits(SearchLimits());
+        assert(kMismatchSearch.naiveSearch(misMatches) == kMismatchSearch.mcsSearch(misMatches));
+        assert(std::ranges::all_of(kMismatchSearch.getLastQueryStatuses(), [](QueryStatus status) { return status == QueryStatus::Complete; }));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSearchLimits: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testSearchLimits()" << std::endl;
+}
+
+void testMixedLengthQueries() {
+    std::cout << "Starting testMixedLengthQueries()" << std::endl;
+    try {
+        const int misMatches = 2;
+        std::string text = initRandomText(3000, 4, 3);
+        std::vector<std::string> queries;
+        for (int queryLen : { 3, 6, 9, 14 })
+            for (auto& query : initRandomQueries(text, 5, queryLen))
+                queries.push_back(query);
+
+        {
+            std::ofstream textFile("temp_mixed_text.txt");
+            textFile << text;
+            std::ofstream queriesFile("temp_mixed_queries.txt");
+            for (const auto& query : queries)
+                queriesFile << query << std::endl;
+        }
+
+        KMismatchSearch kMismatchSearch("temp_mixed_text.txt", "temp_mixed_queries.txt", misMatches);
+        assert(kMismatchSearch.getLengthMcs().size() == 4);
+
+        // Every bucket takes its forms from the shared pool
+        auto& pool = kMismatchSearch.getMcs().getMcsForms();
+        for (auto& [length, bucketMcs] : kMismatchSearch.getLengthMcs())
+            for (auto& form : bucketMcs.getMcsForms())
+            {
+                assert(form.getSize() <= length);
+                assert(std::ranges::find(pool, form) != pool.end());
+            }
+
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatches);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+        assert(mcsResult == naiveResult);
+
+        std::remove("temp_mixed_text.txt");
+        std::remove("temp_mixed_queries.txt");
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testMixedLengthQueries: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testMixedLengthQueries()" << std::endl;
+}
+
+void testBatchedProbes() {
+    std::cout << "Starting testBatchedProbes()" << std::endl;
+    try {
+        const int misMatches = 2;
+        const size_t queryLen = 12;
+        std::string text = initRandomText(4000, 4, 9);
+        // Overlapping and repeated queries share keys within a probe batch, and symbols absent from the text give
+        // keys absent from the index
+        std::vector<std::string> queries;
+        for (size_t i = 0; i < 150; i++)
+            queries.push_back(text.substr(100 + i % 40, queryLen));
+        for (size_t i = 0; i < 10; i++)
+            queries.push_back(std::string(i, 'X') + text.substr(700 + i, queryLen - i));
+
+        {
+            std::ofstream textFile("temp_batch_text.txt");
+            textFile << text;
+            std::ofstream queriesFile("temp_batch_queries.txt");
+            for (const auto& query : queries)
+                queriesFile << query << std::endl;
+        }
+
+        KMismatchSearch kMismatchSearch("temp_batch_text.txt", "temp_batch_queries.txt", misMatches);
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatches);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatches);
+        assert(mcsResult == naiveResult);
+
+        // The probes are resolved without inserting the absent keys
+        auto existsResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::Exists);
+        for (auto& [key, positions] : kMismatchSearch.getCache())
+            assert(key.find('X') == std::string::npos && !positions.empty());
+        for (auto& [query, positions] : naiveResult)
+            assert(existsResult[query].count == (positions.empty() ? 0 : 1));
+
+        std::remove("temp_batch_text.txt");
+        std::remove("temp_batch_queries.txt");
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testBatchedProbes: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testBatchedProbes()" << std::endl;
+}
+
+void testPerQueryMismatches() {
+    std::cout << "Starting testPerQueryMismatches()" << std::endl;
+    try {
+        const size_t maxMisMatches = 3;
+        const uint64_t queryLen = 10;
+        std::string text = initRandomText(5000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 12, queryLen);
+        std::vector<size_t> misMatchesPerQuery;
+        for (size_t i = 0; i < queries.size(); i++)
+            misMatchesPerQuery.push_back(i % (maxMisMatches + 1));
+
+        // Subsets for smaller thresholds still cover all their combinations
+        MCS mcs = MCS::buildMCSNaiveMultithreaded(queryLen, maxMisMatches);
+        for (uint64_t misMatches = 0; misMatches <= maxMisMatches; misMatches++)
+        {
+            MCS subset = mcs.subsetForMismatches(queryLen, misMatches);
+            assert(subset.getMcsForms().size() <= mcs.getMcsForms().size());
+            for (auto& combination : Combination::generateAllCombinations(queryLen, misMatches))
+                assert(std::any_of(subset.getMcsForms().begin(), subset.getMcsForms().end(),
+                    [&combination](const Form& form) { return combination.contains(form); }));
+        }
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        kMismatchSearch.setMcs(mcs, maxMisMatches);
+        auto mcsResult = kMismatchSearch.mcsSearch(misMatchesPerQuery);
+        auto naiveResult = kMismatchSearch.naiveSearch(misMatchesPerQuery);
+        assert(mcsResult == naiveResult);
+
+        // The same resident index answers a single smaller threshold
+        assert(kMismatchSearch.mcsSearch(1) == kMismatchSearch.naiveSearch(1));
+
+        // An MCS of unknown mismatches, such as a loaded one, is searched with all its forms for every threshold,
+        // while a subset of the same forms is enough for exact matches
+        std::vector<std::string> exactQueries = initRandomQueries(text, 12, 12);
+        MCS loadedMcs(std::vector<Form>{ Form(0b11), Form(0b111111) });
+        assert(loadedMcs.subsetForMismatches(12, 0).getMcsForms().size() == 1);
+        KMismatchSearch loadedSearch = makeSearch(text, exactQueries);
+        loadedSearch.setMcs(loadedMcs, 5);
+        loadedSearch.mcsSearch(5);
+        size_t allFormsCandidates = loadedSearch.getLastCandidatesCount();
+        loadedSearch.setMcs(loadedMcs);
+        auto exactResult = loadedSearch.mcsSearch(0);
+        assert(loadedSearch.getLastCandidatesCount() == allFormsCandidates);
+        assert(exactResult == loadedSearch.naiveSearch(0));
+
+        // A single MCS of known mismatches shared by queries of several lengths takes a subset for every length,
+        // and a subset taken for the longer query, searched first, would skip the forms longer than the shorter one
+        std::vector<std::string> mixedQueries = { text.substr(text.find('A'), 12), text.substr(text.find('D'), 6) };
+        MCS sharedMcs = MCS::buildMCSNaiveMultithreaded(6, 4);
+        KMismatchSearch mixedSearch = makeSearch(text, mixedQueries);
+        mixedSearch.setMcs(sharedMcs, 4);
+        auto mixedResult = mixedSearch.mcsSearch(3);
+        auto mixedNaiveResult = mixedSearch.naiveSearch(3);
+        assert(!mixedNaiveResult[mixedQueries[1]].empty());
+        assert(mixedResult == mixedNaiveResult);
+
+        try {
+            kMismatchSearch.mcsSearch(maxMisMatches + 1);
+            assert(false);
+        } catch (const std::runtime_error&) {
+            // Expected
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testPerQueryMismatches: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testPerQueryMismatches()" << std::endl;
+}
+
+void testQueryDeduplication() {
+    std::cout << "Starting testQueryDeduplication()" << std::endl;
+    try {
+        const size_t misMatches = 2;
+        std::string text = initRandomText(5000, 4, 11);
+        std::vector<std::string> distinct = initRandomQueries(text, 8, 12);
+        // Every query three times, in no particular order
+        std::vector<std::string> queries;
+        for (size_t copy = 0; copy < 3; copy++)
+            for (size_t i = 0; i < distinct.size(); i++)
+                queries.push_back(distinct[(i * 5 + copy) % distinct.size()]);
+
+        SearchStats::setEnabled(true);
+        SearchStats::reset();
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        MCS mcs = MCS::buildMCSNaiveMultithreaded(queries, misMatches);
+        kMismatchSearch.setMcs(mcs, misMatches);
+        auto result = kMismatchSearch.mcsSearch(misMatches);
+        std::string json = SearchStats::toJson();
+        SearchStats::setEnabled(false);
+        assert(result == kMismatchSearch.naiveSearch(misMatches));
+#ifdef KMISMATCH_ENABLE_STATS
+        assert(json.find("\"queries\": " + std::to_string(distinct.size())) != std::string::npos);
+        assert(json.find("\"duplicate_queries\": " + std::to_string(queries.size() - distinct.size())) != std::string::npos);
+        assert(json.find("\"dedup_ratio\": 3") != std::string::npos);
+#endif
+
+        // Every duplicate gets the result and the status of the query searched for it
+        auto firstResult = kMismatchSearch.mcsSearch(misMatches, ResultMode::First, 2);
+        for (auto& query : distinct)
+            assert(firstResult[query].count == std::min<size_t>(result[query].size(), 2));
+        for (QueryStatus status : kMismatchSearch.getLastQueryStatuses())
+            assert(status == QueryStatus::Complete);
+
+        // The same query with another threshold is searched on its own
+        std::vector<size_t> misMatchesPerQuery(queries.size(), misMatches);
+        misMatchesPerQuery[0] = 0;
+        auto perQueryResult = kMismatchSearch.mcsSearch(misMatchesPerQuery);
+        assert(perQueryResult == kMismatchSearch.naiveSearch(misMatchesPerQuery));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testQueryDeduplication: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testQueryDeduplication()" << std::endl;
+}
+
+void testCorpus() {
+    std::cout << "Starting testCorpus()" << std::endl;
+    try {
+        const size_t misMatches = 2;
+        // Documents of varied sizes, one shorter than the queries and one empty
+        Corpus corpus;
+        std::vector<std::string> documents = { initRandomText(3000, 4, 21), initRandomText(8, 4, 22), "",
+            initRandomText(5000, 4, 23), initRandomText(2000, 4, 24) };
+        for (size_t d = 0; d < documents.size(); d++)
+            corpus.addDocument("doc" + std::to_string(d), documents[d]);
+        assert(corpus.size() == documents.size() && corpus.getText().size() == 10008);
+        assert(corpus.locate(3005) == (DocumentPosition{ 1, 5 }) && corpus.locate(3008) == (DocumentPosition{ 3, 0 }));
+        assert(Corpus::withinDocument(corpus.getStarts(), 2990, 10) && !Corpus::withinDocument(corpus.getStarts(), 2990, 11));
+
+        // Queries from the documents, and queries spanning two documents that only match across the boundary
+        std::vector<std::string> queries = initRandomQueries(documents[0], 5, 12);
+        for (auto& query : initRandomQueries(documents[3], 5, 12))
+            queries.push_back(query);
+        queries.push_back(corpus.getText().substr(2994, 12));
+        queries.push_back(corpus.getText().substr(8000, 12));
+
+        // Every document searched on its own, positions moved by its start
+        std::map<std::string, std::set<size_t>> expected;
+        for (size_t d = 0; d < documents.size(); d++)
+        {
+            KMismatchSearch documentSearch = makeSearch(documents[d], queries);
+            for (auto& [query, positions] : documentSearch.naiveSearch(misMatches))
+                for (size_t pos : positions)
+                    expected[query].insert(corpus.getStarts()[d] + pos);
+        }
+
+        KMismatchSearch kMismatchSearch;
+        kMismatchSearch.setCorpus(corpus);
+        kMismatchSearch.setQueries(queries);
+        kMismatchSearch.buildLengthBucketsMcs(misMatches);
+        assert(kMismatchSearch.mcsSearch(misMatches) == expected);
+        assert(kMismatchSearch.naiveSearch(misMatches) == expected);
+        assert(kMismatchSearch.fftSearch(misMatches) == expected);
+        assert(kMismatchSearch.fmSearch(misMatches) == expected);
+        assert(kMismatchSearch.seedSearch(misMatches) == expected);
+        for (size_t pos : expected[queries[0]])
+            assert(kMismatchSearch.locate(pos).document == 0 || kMismatchSearch.locate(pos).document == 3);
+
+        // No indexed window crosses a document boundary
+        size_t windows = 0;
+        for (auto& form : kMismatchSearch.getMcs().getMcsForms())
+            for (auto& document : documents)
+                windows += document.size() >= form.getSize() ? document.size() - form.getSize() + 1 : 0;
+        assert(kMismatchSearch.getIndex().getPostings() == windows);
+
+        // A FASTA file has a document per record, named by the first word of its header
+        {
+            std::ofstream fastaFile("temp_corpus.fa");
+            fastaFile << ">chr1 first record\nACGT\nACG\r\n; comment\n>chr2\n\nTTTT\n";
+        }
+        Corpus fastaCorpus = Corpus::loadFromFasta({ "temp_corpus.fa" });
+        std::remove("temp_corpus.fa");
+        assert(fastaCorpus.getNames() == (std::vector<std::string>{ "chr1", "chr2" }));
+        assert(fastaCorpus.getText() == "ACGTACGTTTT" && fastaCorpus.getStarts() == (std::vector<size_t>{ 0, 7 }));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testCorpus: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testCorpus()" << std::endl;
+}
+
+void testShardedSearch() {
+    std::cout << "Starting testShardedSearch()" << std::endl;
+    try {
+        // Shards cover the text, overlap by the given positions and own consecutive ranges
+        std::vector<Shard> shards = ShardCoordinator::partition(10, 3, 2);
+        assert(shards == (std::vector<Shard>{ { 0, 3, 5 }, { 3, 6, 8 }, { 6, 10, 10 } }));
+        assert(ShardCoordinator::partition(2, 5, 4).size() == 2 && ShardCoordinator::partition(0, 3, 4).size() == 1);
+        assert(ShardProtocol::parseShard(ShardProtocol::formatShard(shards[1])) == shards[1]);
+        bool thrown = false;
+        try { ShardProtocol::parseShard("5:3:8"); } catch (const std::runtime_error&) { thrown = true; }
+        assert(thrown);
+
+        // Messages round trip, a query keeping its spaces, and an error reply is thrown with its message
+        std::stringstream channel;
+        std::vector<std::string> sent = { "AB CD", "", "ABC" };
+        ShardProtocol::writeQueries(channel, sent, { 1, 0, 2 }, 1, 3);
+        ShardProtocol::writeQueries(channel, sent, { 1, 0, 2 }, 0, 1);
+        ShardProtocol::writeEnd(channel);
+        std::vector<std::string> received;
+        std::vector<size_t> receivedMisMatches;
+        assert(ShardProtocol::readQueries(channel, received, receivedMisMatches));
+        assert(received == (std::vector<std::string>{ "", "ABC" }) && receivedMisMatches == (std::vector<size_t>{ 0, 2 }));
+        assert(ShardProtocol::readQueries(channel, received, receivedMisMatches));
+        assert(received == (std::vector<std::string>{ "AB CD" }) && receivedMisMatches == (std::vector<size_t>{ 1 }));
+        assert(!ShardProtocol::readQueries(channel, received, receivedMisMatches));
+        std::stringstream replies;
+        ShardProtocol::writeHits(replies, { { 0, 7 }, { 2, 1 } });
+        ShardProtocol::writeError(replies, "no\nluck");
+        assert(ShardProtocol::readHits(replies) == (std::vector<std::pair<size_t, size_t>>{ { 0, 7 }, { 2, 1 } }));
+        std::string error;
+        try { ShardProtocol::readHits(replies); } catch (const std::runtime_error& e) { error = e.what(); }
+        assert(error == "no luck");
+
+        // Queries of two lengths, the second batch bringing a longer one, and alignments across the shard borders
+        const size_t misMatches = 2;
+        std::string text = initRandomText(20000, 4, 31);
+        std::vector<std::string> firstBatch = initRandomQueries(text, 20, 12);
+        firstBatch.push_back(text.substr(6660, 12));
+        std::vector<std::string> secondBatch = initRandomQueries(text, 20, 16);
+        secondBatch.push_back(text.substr(13328, 16));
+        std::vector<std::string> queries = firstBatch;
+        queries.insert(queries.end(), secondBatch.begin(), secondBatch.end());
+
+        KMismatchSearch fullSearch = makeSearch(text, queries);
+        std::map<std::string, std::set<size_t>> expected = fullSearch.naiveSearch(misMatches);
+        fullSearch.setQueries(secondBatch);
+        std::map<std::string, std::set<size_t>> expectedSecond = fullSearch.naiveSearch(1);
+
+        // Workers over in-memory streams, the second batch searched with one mismatch, their hits moved by the
+        // shard begin
+        shards = ShardCoordinator::partition(text.size(), 3, 15);
+        for (std::string engine : { "mcs", "naive", "fft", "fm", "seed" })
+        {
+            std::vector<std::map<std::string, std::set<size_t>>> merged(2);
+            for (auto& shard : shards)
+            {
+                std::stringstream requests;
+                std::stringstream hits;
+                ShardProtocol::writeQueries(requests, firstBatch, std::vector<size_t>(firstBatch.size(), misMatches), 0, firstBatch.size());
+                ShardProtocol::writeQueries(requests, secondBatch, std::vector<size_t>(secondBatch.size(), 1), 0, secondBatch.size());
+                ShardProtocol::writeEnd(requests);
+
+                KMismatchSearch shardSearch;
+                std::string shardText = text.substr(shard.begin, shard.end - shard.begin);
+                shardSearch.setText(shardText);
+                ShardWorker worker(shardSearch, shard, engine, misMatches);
+                worker.serve(requests, hits);
+                for (auto& [query, position] : ShardProtocol::readHits(hits))
+                    merged[0][firstBatch[query]].insert(shard.begin + position);
+                for (auto& [query, position] : ShardProtocol::readHits(hits))
+                    merged[1][secondBatch[query]].insert(shard.begin + position);
+            }
+            for (auto& query : firstBatch)
+                assert(merged[0][query] == expected[query]);
+            for (auto& query : secondBatch)
+                assert(merged[1][query] == expectedSecond[query]);
+        }
+
+#ifdef KMISMATCH_APP_PATH
+        // Worker processes of the application, talking to the coordinator over pipes
+        {
+            std::ofstream textFile("temp_sharded_text.txt");
+            textFile << text;
+        }
+        ShardCoordinator coordinator({ KMISMATCH_APP_PATH, "-t", "temp_sharded_text.txt", "-m", std::to_string(misMatches),
+            "-e", "mcs" }, ShardCoordinator::partition(text.size(), 3, 15));
+        std::vector<size_t> misMatchesPerQuery(queries.size(), misMatches);
+        auto result = coordinator.search(queries, misMatchesPerQuery);
+        for (auto& query : queries)
+            assert(result[query] == expected[query]);
+
+        // A failed batch is reported, and the workers go on with the next one
+        std::string failure;
+        try { coordinator.search({ "AC" }, { 3 }); } catch (const std::runtime_error& e) { failure = e.what(); }
+        assert(!failure.empty());
+        result = coordinator.search(queries, misMatchesPerQuery);
+        for (auto& query : queries)
+            assert(result[query] == expected[query]);
+        std::remove("temp_sharded_text.txt");
+
+        // A worker that exited fails the search with an error, and the signal handling of the process is left as
+        // it was
+        ShardCoordinator exitedCoordinator({ "/bin/true" }, ShardCoordinator::partition(text.size(), 1, 15));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        failure.clear();
+        try { exitedCoordinator.search(queries, misMatchesPerQuery); } catch (const std::runtime_error& e) { failure = e.what(); }
+        assert(!failure.empty());
+        struct sigaction pipeAction {};
+        sigaction(SIGPIPE, nullptr, &pipeAction);
+        assert(pipeAction.sa_handler == SIG_DFL);
+#endif
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testShardedSearch: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testShardedSearch()" << std::endl;
+}
+
+void testSearchStats() {
+    std::cout << "Starting testSearchStats()" << std::endl;
+#ifdef KMISMATCH_ENABLE_STATS
+    try {
+        std::string text = initRandomText(5000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 10, 8);
+
+        SearchStats::setEnabled(true);
+        SearchStats::reset();
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        MCS mcs = MCS::buildMCSNaiveMultithreaded(queries, 2);
+        kMismatchSearch.setMcs(mcs, 2);
+        auto result = kMismatchSearch.mcsSearch(2);
+        std::string json = SearchStats::toJson();
+        SearchStats::setEnabled(false);
+
+        assert(json.find("\"queries\": 10") != std::string::npos);
+        assert(json.find("\"candidates\": " + std::to_string(kMismatchSearch.getLastCandidatesCount())) != std::string::npos);
+        assert(json.find("\"mcs_forms\": " + std::to_string(mcs.getMcsForms().size())) != std::string::npos);
+        assert(json.find("\"false_positive_rate\"") != std::string::npos);
+
+        // Disabled statistics are not collected
+        SearchStats::reset();
+        kMismatchSearch.mcsSearch(2);
+        assert(SearchStats::toJson().find("\"queries\": 0") != std::string::npos);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSearchStats: " << e.what() << std::endl;
+        throw;
+    }
+#endif
+    std::cout << "Finished testSearchStats()" << std::endl;
+}
+
+void testSearchTrace() {
+    std::cout << "Starting testSearchTrace()" << std::endl;
+#ifdef KMISMATCH_ENABLE_TRACE
+    try {
+        std::string text = initRandomText(2000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 5, 8);
+
+        SearchTrace::setEnabled(true);
+        SearchTrace::reset();
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        MCS mcs = MCS::buildMCSNaiveMultithreaded(queries, 2);
+        kMismatchSearch.setMcs(mcs, 2);
+        kMismatchSearch.mcsSearch(2);
+        SearchTrace::setEnabled(false);
+
+        const std::string traceFile = "test_trace.json";
+        SearchTrace::writeChromeTrace(traceFile);
+        std::ifstream file(traceFile);
+        std::stringstream trace;
+        trace << file.rdbuf();
+        file.close();
+        std::remove(traceFile.c_str());
+
+        for (const char* span : { "\"mcs_build\"", "\"mcs_greedy_iteration\"", "\"index_build\"", "\"mcs_search\"", "\"length_bucket\"",
+            "\"query_batch\"" })
+            assert(trace.str().find(span) != std::string::npos);
+        assert(trace.str().find("\"ph\": \"X\"") != std::string::npos);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testSearchTrace: " << e.what() << std::endl;
+        throw;
+    }
+#endif
+    std::cout << "Finished testSearchTrace()" << std::endl;
+}
+
+void testResourcePlanner() {
+    std::cout << "Starting testResourcePlanner()" << std::endl;
+    try {
+        std::string text = initRandomText(20000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 10, 12);
+
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries, 2);
+        ResourcePlanner planner(kMismatchSearch, 2, 0);
+        auto plans = planner.planAll();
+        assert(plans.size() == 6);
+        assert(!planner.formatPlans(plans, 0).empty());
+
+        // The index estimates match the index the search builds
+        EnginePlan mcsPlan = planner.planEngine("mcs");
+        kMismatchSearch.mcsSearch(2);
+        size_t postings = 0;
+        for (auto& [key, positions] : kMismatchSearch.getCache())
+            postings += positions.size();
+        assert(mcsPlan.available);
+        assert(mcsPlan.indexPostings == postings);
+        assert(mcsPlan.indexKeys >= kMismatchSearch.getCache().size() * 0.5);
+        assert(mcsPlan.indexKeys <= kMismatchSearch.getCache().size() * 2.0);
+        assert(mcsPlan.peakBytes > mcsPlan.indexBytes);
+
+        // The naive engine builds no index
+        EnginePlan naivePlan = planner.planEngine("naive");
+        assert(naivePlan.indexBytes == 0.0 && naivePlan.peakBytes < mcsPlan.peakBytes);
+
+        // The FFT engine scores every alignment without an index
+        EnginePlan fftPlan = planner.planEngine("fft");
+        assert(fftPlan.available && fftPlan.indexBytes == 0.0 && fftPlan.seconds > 0.0);
+        assert(fftPlan.candidatesPerQuery == text.size());
+
+        // The FM-index is smaller than the MCS index
+        EnginePlan fmPlan = planner.planEngine("fm");
+        assert(fmPlan.available && fmPlan.indexBytes > 0.0 && fmPlan.indexBytes < mcsPlan.indexBytes);
+
+        // The seed engine indexes the query pieces only, and verifies fewer candidates than the naive engine
+        EnginePlan seedPlan = planner.planEngine("seed");
+        assert(seedPlan.available && seedPlan.indexBytes < fmPlan.indexBytes);
+        assert(seedPlan.candidatesPerQuery > 0.0 && seedPlan.candidatesPerQuery < naivePlan.candidatesPerQuery);
+
+        // The index built by the search is not built again, and the naive engine has no shared part
+        assert(planner.planEngine("mcs").buildSeconds == 0.0 && mcsPlan.buildSeconds > 0.0);
+        assert(naivePlan.buildSeconds == 0.0);
+
+        // The selection gives every query length one engine, each picked engine searching some groups
+        std::vector<std::string> mixedQueries = queries;
+        for (auto& query : initRandomQueries(text, 5, 20))
+            mixedQueries.push_back(query);
+        kMismatchSearch.setQueries(mixedQueries);
+        kMismatchSearch.buildLengthBucketsMcs(2);
+        ResourcePlanner mixedPlanner(kMismatchSearch, 2, 0);
+        EngineSelection selection = mixedPlanner.selectEngines({ "mcs", "naive", "fft", "fm", "seed" }, 0);
+        assert(selection.groups.size() == 2 && selection.plans.size() == 5);
+        std::vector<size_t> selected(mixedQueries.size(), 0);
+        for (auto& group : selection.groups)
+        {
+            assert(selection.engineSeconds.contains(group.engine));
+            for (size_t q : group.queryIndices)
+            {
+                assert(mixedQueries[q].size() == group.queryLength);
+                selected[q]++;
+            }
+        }
+        assert(std::ranges::count(selected, 1) == static_cast<long>(mixedQueries.size()));
+        assert(mixedPlanner.selectEngines({ "mcs", "naive" }, 1).groups.empty());
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testResourcePlanner: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testResourcePlanner()" << std::endl;
+}
+
+void testScratchArena() {
+    std::cout << "Starting testScratchArena()" << std::endl;
+    try {
+        std::string text = initRandomText(1000, 4, 4);
+        std::vector<std::string> queries = initRandomQueries(text, 5, 12);
+        MCS mcs = MCS::buildMCSNaiveMultithreaded(queries, 3);
+        {
+            ScratchArena arena;
+            for (auto& form : mcs.getMcsForms())
+                for (size_t pos = 0; pos + form.getSize() <= text.size(); pos++)
+                    assert(form.getStringFromPosition(text, pos, arena.resource()) == form.getStringFromPosition(text, pos).c_str());
+
+            // A nested arena shares the memory of the outer one, which stays valid after the inner one ends
+            std::pmr::vector<size_t> outer(arena.resource());
+            outer.assign(100, 7);
+            {
+                ScratchArena inner;
+                std::pmr::vector<size_t> innerValues(inner.resource());
+                innerValues.assign(1000, 1);
+            }
+            assert(std::all_of(outer.begin(), outer.end(), [](size_t value) { return value == 7; }));
+
+            Combination combination(0b1101111);
+            auto forms = combination.getAllForms(2);
+            auto arenaForms = combination.getAllForms(2, arena.resource());
+            assert(std::equal(forms.begin(), forms.end(), arenaForms.begin(), arenaForms.end()));
+        }
+
+        // Searches allocating their temporaries from the arenas find the same occurrences
+        KMismatchSearch kMismatchSearch = makeSearch(text, queries);
+        kMismatchSearch.setMcs(mcs, 3);
+        assert(kMismatchSearch.mcsSearch(3) == kMismatchSearch.naiveSearch(3));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testScratchArena: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testScratchArena()" << std::endl;
+}
+
+void testVerificationKernels() {
+    std::cout << "Starting testVerificationKernels()" << std::endl;
+    try {
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<int> symbol(0, 3);
+        const std::string alphabet = "ACGT";
+        for (size_t queryLen : { 16, 20, 31, 32, 36, 50, 64, 75, 100, 150 })
+            for (size_t misMatches = 0; misMatches <= 5; misMatches++)
+            {
+                VerificationKernel kernel = selectVerificationKernel(queryLen, misMatches);
+                for (int trial = 0; trial < 200; trial++)
+                {
+                    std::string query(queryLen, 'A');
+                    for (auto& c : query)
+                        c = alphabet[symbol(gen)];
+
+                    // Mismatches at random places, including the chunk boundaries and the query tail
+                    std::string window = query;
+                    size_t mutations = trial % (misMatches + 3);
+                    for (size_t m = 0; m < mutations; m++)
+                    {
+                        size_t pos = (m == 0) ? queryLen - 1 : gen() % queryLen;
+                        window[pos] = window[pos] == 'A' ? 'C' : 'A';
+                    }
+                    size_t expected = 0;
+                    for (size_t i = 0; i < queryLen; i++)
+                        expected += window[i] != query[i];
+
+                    assert(kernel(window.data(), query.data(), queryLen, misMatches) == (expected <= misMatches));
+                    assert(verifyGeneric(window.data(), query.data(), queryLen, misMatches) == (expected <= misMatches));
+                }
+            }
+
+        // Mismatches within a 32-byte chunk are all counted
+        std::string text(40, 'A');
+        std::string query(40, 'A');
+        for (size_t i = 0; i < 10; i++)
+            query[i] = 'C';
+        KMismatchSearch kMismatchSearch;
+        kMismatchSearch.setText(text);
+        assert(!kMismatchSearch.CheckQueryOnPosition(query, 0, 2));
+        assert(kMismatchSearch.CheckQueryOnPosition(query, 0, 10));
+    } catch (const std::exception& e) {
+        std::cerr << "Exception in testVerificationKernels: " << e.what() << std::endl;
+        throw;
+    }
+    std::cout << "Finished testVerificationKernels()" << std::endl;
+}
+
 void runAllTests() {
     std::cout << "Starting runAllTests()" << std::endl;
     try {
@@ -237,6 +1616,36 @@ void runAllTests() {
 
         // Test with random inputs
         testRandomTextAndQueries();
+        testMixedLengthQueries();
+        testPerQueryMismatches();
+        testBatchedProbes();
+        testQueryDeduplication();
+        testCorpus();
+        testShardedSearch();
+
+        // MCS construction variants
+        testSelectivityAwareMCS();
+        testSelectivityAwareMixedLengths();
+        testOptimizeMCS();
+        testCombinationRange();
+
+        // Alternative search engines
+        testSegmentSearch();
+        testFftSearch();
+        testPostingIndex();
+        testFmIndex();
+        testSeedSearch();
+        testReverseComplementSearch();
+        testWildcards();
+        testResultModes();
+        testSearchLimits();
+
+        // Instrumentation
+        testSearchStats();
+        testSearchTrace();
+        testResourcePlanner();
+        testScratchArena();
+        testVerificationKernels();
 
         // Finally, run the most time-consuming test
         testLargeInputs();
@@ -244,6 +1653,7 @@ void runAllTests() {
         std::cout << "All tests passed successfully!" << std::endl;
     } catch (const std::exception& e) {
         std::cerr << "Exception in runAllTests: " << e.what() << std::endl;
+        throw;
     }
     std::cout << "Finished runAllTests()" << std::endl;
 }